@@ -0,0 +1,252 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header arena (bump) allocator.
+ *  Allocations are carved out of big chunks one after another and are not 
+ *  freed one by one, instead everything past a mark, or everything at all, 
+ *  is dropped in a single reset. Meant for request scoped work where lots 
+ *  of short lived containers die together, see arr_init_arena, 
+ *  rbtree_init_arena, map_init_arena and gio_mem_new_arena. 
+ *  There is also a thread local arena, to use it define KK_ARENA_IMPL 
+ *  in exactly one translation unit, the rest is header only.
+ */
+
+#ifndef _KK_ARENA_H_
+#define _KK_ARENA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARENA_CHUNK_SIZE
+# define ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+#ifndef ARENA_ALIGN
+# define ARENA_ALIGN 16
+#endif
+
+/* where the chunks come from */
+#ifndef ARENA_REALLOC
+# define ARENA_REALLOC(PTR, SZ) realloc((PTR), (SZ))
+#endif
+
+#define ARENA_UNLIKELY(X) __builtin_expect((X),0)
+
+struct arena_chunk {
+  struct arena_chunk *prev;
+  size_t sz;
+};
+
+/* A zeroed struct arena is a valid empty arena with the default chunk size */
+struct arena {
+  struct arena_chunk *chunk;
+  uint8_t *cur;
+  uint8_t *end;
+  size_t chunk_size;
+};
+
+struct arena_mark {
+  struct arena_chunk *chunk;
+  uint8_t *cur;
+};
+
+#define _ARENA_ROUND(X) (((X) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define _ARENA_HDR _ARENA_ROUND(sizeof(struct arena_chunk))
+
+static inline
+int arena_init(struct arena *a, size_t chunk_size)
+{
+  memset(a, 0, sizeof(*a));
+  a->chunk_size = chunk_size;
+  return 0;
+}
+
+/* Gives all the chunks back. */
+static inline
+void arena_cleanup(struct arena *a)
+{
+  struct arena_chunk *c, *prev;
+
+  for(c = a->chunk; c; c = prev) {
+    prev = c->prev;
+    if(ARENA_REALLOC(c, 0)) { /* ignore realloc return value */ }
+  }
+  a->chunk = NULL;
+  a->cur = a->end = NULL;
+}
+
+static inline
+int _arena_add_chunk(struct arena *a, size_t need)
+{
+  struct arena_chunk *c;
+  size_t sz = a->chunk_size ? a->chunk_size : ARENA_CHUNK_SIZE;
+
+  /* big allocations get a chunk of their own */
+  if(need > sz - _ARENA_HDR) {
+    if(need > SIZE_MAX - _ARENA_HDR)
+      return -1;
+    sz = _ARENA_HDR + need;
+  }
+
+  if(!(c = ARENA_REALLOC(NULL, sz)))
+    return -1;
+
+  c->prev = a->chunk;
+  c->sz = sz;
+  a->chunk = c;
+  a->cur = (uint8_t*)c + _ARENA_HDR;
+  a->end = (uint8_t*)c + sz;
+  return 0;
+}
+
+/* ARENA_ALIGN aligned, NULL when out of memory. Can't be freed on its own. */
+static inline
+void *arena_alloc(struct arena *a, size_t sz)
+{
+  void *ret;
+
+  sz = _ARENA_ROUND(sz);
+  if(ARENA_UNLIKELY(sz > (size_t)(a->end - a->cur)) && _arena_add_chunk(a, sz))
+    return NULL;
+
+  ret = a->cur;
+  a->cur += sz;
+  return ret;
+}
+
+/* Same contract as realloc, so containers can take an arena in place of 
+ * the heap. Each block remembers its size in front of it, which lets the 
+ * most recent block grow or be freed in place, any other block is 
+ * simply copied on growth and left for the next reset on free. 
+ * Don't mix with pointers from arena_alloc. */
+static inline
+void *arena_realloc(struct arena *a, void *ptr, size_t sz)
+{
+  uint8_t *blk, *nptr;
+  size_t osz;
+
+  if(!ptr) {
+    if(!sz)
+      return NULL;
+
+    if(!(blk = arena_alloc(a, ARENA_ALIGN + sz)))
+      return NULL;
+
+    *(size_t*)blk = _ARENA_ROUND(sz);
+    return blk + ARENA_ALIGN;
+  }
+
+  blk = (uint8_t*)ptr - ARENA_ALIGN;
+  osz = *(size_t*)blk;
+
+  /* last one in the chunk, we can move the bump pointer */
+  if((uint8_t*)ptr + osz == a->cur) {
+    if(!sz) {
+      a->cur = blk;
+      return NULL;
+    }
+
+    if(_ARENA_ROUND(sz) <= (size_t)(a->end - (uint8_t*)ptr)) {
+      *(size_t*)blk = _ARENA_ROUND(sz);
+      a->cur = (uint8_t*)ptr + _ARENA_ROUND(sz);
+      return ptr;
+    }
+  }
+
+  if(!sz || sz <= osz)
+    return sz ? ptr : NULL;
+
+  if(!(nptr = arena_realloc(a, NULL, sz)))
+    return NULL;
+
+  memcpy(nptr, ptr, osz);
+  return nptr;
+}
+
+static inline
+struct arena_mark arena_mark(const struct arena *a)
+{
+  struct arena_mark m = { a->chunk, a->cur };
+  return m;
+}
+
+/* Drops everything allocated since the mark was taken. */
+static inline
+void arena_reset_to(struct arena *a, struct arena_mark m)
+{
+  struct arena_chunk *c;
+
+  while(a->chunk != m.chunk) {
+    c = a->chunk;
+    a->chunk = c->prev;
+    if(ARENA_REALLOC(c, 0)) { /* ignore realloc return value */ }
+  }
+
+  a->cur = m.cur;
+  a->end = m.chunk ? (uint8_t*)m.chunk + m.chunk->sz : NULL;
+}
+
+/* Drops everything but keeps the first chunk around for reuse, 
+ * the cost is one free per chunk and not per allocation. */
+static inline
+void arena_reset(struct arena *a)
+{
+  struct arena_chunk *c = a->chunk;
+
+  if(!c)
+    return;
+
+  while(c->prev)
+    c = c->prev;
+
+  arena_reset_to(a, (struct arena_mark){ c, (uint8_t*)c + _ARENA_HDR });
+}
+
+/* thread local arena, needs KK_ARENA_IMPL */
+
+extern _Thread_local struct arena arena_tls;
+
+/* realloc like hook working on arena_tls, fits rbtree_realloc_proc */
+void *arena_tls_realloc(void *ptr, size_t sz);
+
+#endif /* _KK_ARENA_H_ */
+
+/* implementation */
+
+#ifdef KK_ARENA_IMPL
+
+#ifndef _KK_ARENA_IMPL_
+#define _KK_ARENA_IMPL_
+
+_Thread_local struct arena arena_tls;
+
+void *arena_tls_realloc(void *ptr, size_t sz)
+{
+  return arena_realloc(&arena_tls, ptr, sz);
+}
+
+#endif /* _KK_ARENA_IMPL_ */
+
+#endif /* KK_ARENA_IMPL */
@@ -31,6 +31,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include "arena.h"
+#include "hash.h"
 
 #if !defined(NDEBUG)
 
@@ -51,13 +53,91 @@
 
 #else 
 
-# define ARR_ASSERT()
-# define ARR_ASSERT_MSG()
+# define ARR_ASSERT(COND) ((void)0)
+# define ARR_ASSERT_MSG(COND, ...) ((void)0)
 
 #endif
 
 #define ARR_API 
 
+/* all the memory arr ever gets goes through this one */
+#ifndef ARR_REALLOC
+# define ARR_REALLOC(PTR, SZ) realloc((PTR), (SZ))
+#endif
+
+/* capacity of the first allocation unless the array says otherwise */
+#ifndef ARR_MIN_CAP
+# define ARR_MIN_CAP 8
+#endif
+
+/* with ARR_MMAP, arrays at least this big live in their own mapping 
+ * and grow with mremap, which moves pages instead of copying bytes */
+#ifndef ARR_MMAP_THRESHOLD
+# define ARR_MMAP_THRESHOLD (64u << 20)
+#endif
+
+#ifndef ARR_ALIGNMENT
+# define ARR_ALIGNMENT 64
+#endif
+
+/* arr flags */
+enum {
+  /* grow by 1.5x instead of 2x */
+  ARR_GROW_HALF = 1 << 0,
+  /* use mmap/mremap past ARR_MMAP_THRESHOLD, needs linux and _GNU_SOURCE
+   * defined before the first include, ignored otherwise */
+  ARR_MMAP      = 1 << 1,
+  /* mem is aligned to ARR_ALIGNMENT, allocated with posix_memalign and 
+   * freed with free rather than ARR_REALLOC, takes precedence over ARR_MMAP
+   * but not over an arena */
+  ARR_ALIGNED   = 1 << 2,
+
+  /* internal, mem is currently a mapping */
+  _ARR_MAPPED   = 1 << 16,
+  /* internal, mem is the caller's buffer, never freed nor reallocated */
+  _ARR_BORROWED = 1 << 17,
+};
+
+#define _ARR_INTERNAL_FLAGS (_ARR_MAPPED | _ARR_BORROWED)
+
+/* Define ARR_STATS to have every thread count what its arrays cost it, 
+ * arr_stats() gives the counters of the calling thread. Without it none 
+ * of this exists and nothing is counted. If you define 
+ * ARR_STATS_HOOK(ARR, EV, VAL) as well it is called on every event 
+ * counted, with VAL the bytes involved. */
+#ifdef ARR_STATS
+
+#include <stdio.h>
+
+enum {
+  ARR_EV_REALLOC,
+  ARR_EV_MOVE,
+};
+
+struct arr_stats {
+  /* successful arr_realloc calls and the bytes they asked for */
+  size_t reallocs;
+  size_t realloc_bytes;
+  /* reallocs that ended up at another address, and the elements' bytes 
+   * that had to come along */
+  size_t relocs;
+  size_t reloc_bytes;
+  /* shifts of the tail by inserts and removes in the middle */
+  size_t moves;
+  size_t moved_bytes;
+  /* the biggest single allocation asked for */
+  size_t peak_bytes;
+};
+
+/* counters of the calling thread, needs KK_ARR_IMPL */
+struct arr_stats *arr_stats(void);
+
+void arr_stats_reset(void);
+
+void arr_stats_dump(FILE *f);
+
+#endif /* ARR_STATS */
+
 #define ARR_LIKELY(X) __builtin_expect((X),1)
 
 #define arr_for(TYPE, VAR, ARR) \
@@ -70,20 +150,83 @@
       (VAR);\
       VAR = arr_prev((ARR), VAR))
 
+/* Unchecked loops, begin, end and esz are read once up front and VAR just 
+ * steps by esz, as fast as a hand written loop. The body must not push to 
+ * or remove from the array, use arr_for for that. For arrays of TYPE, 
+ * i.e. esz == sizeof(TYPE), arr_tfor and arr_trfor below work on plain 
+ * struct arr too and step with ++VAR. */
+#define arr_ufor(TYPE, VAR, ARR) \
+  for(size_t _##VAR##_esz = (ARR)->esz, _##VAR##_once = 1; \
+      _##VAR##_once; _##VAR##_once = 0) \
+    for(TYPE * VAR = (TYPE*)(ARR)->mem, \
+        * _##VAR##_end = (TYPE*)((uint8_t*)(ARR)->mem + (ARR)->cnt * _##VAR##_esz); \
+        VAR != _##VAR##_end; \
+        VAR = (TYPE*)((uint8_t*)VAR + _##VAR##_esz))
+
+#define arr_urfor(TYPE, VAR, ARR) \
+  for(size_t _##VAR##_esz = (ARR)->esz, _##VAR##_once = 1; \
+      _##VAR##_once; _##VAR##_once = 0) \
+    for(TYPE * VAR = (TYPE*)((uint8_t*)(ARR)->mem + (ARR)->cnt * _##VAR##_esz), \
+        * _##VAR##_beg = (TYPE*)(ARR)->mem; \
+        VAR != _##VAR##_beg && (VAR = (TYPE*)((uint8_t*)VAR - _##VAR##_esz), true); )
+
 #define arr_att(TYPE, ARR, IDX) ((TYPE*)arr_at(ARR, IDX))
 
 typedef int (arr_cmp_proc)(const void *, const void*);
 
+typedef bool (arr_pred_proc)(const void *e, void *user);
+
+typedef uint64_t (arr_hash_proc)(const void *e, size_t esz);
+
+/* shared with ARR_DEFINE so typed arrays keep the exact same layout */
+#define _ARR_FIELDS(T) \
+  size_t cap; \
+  size_t cnt; \
+  size_t esz; \
+  T * mem; \
+  /* 0 means ARR_MIN_CAP */ \
+  uint32_t min_cap; \
+  uint32_t flags; \
+  /* if set memory comes from here instead of ARR_REALLOC */ \
+  struct arena *arena;
+
 struct arr {
-  size_t cap;
-  size_t cnt;
-  size_t esz;
-  void * mem;
+  _ARR_FIELDS(void)
 };
 
 ARR_API
 int arr_init(struct arr *arr, size_t esz);
 
+/* same as arr_init but with a growth policy, flags are ARR_GROW_HALF etc. */
+ARR_API
+int arr_init_ex(struct arr *arr, size_t esz, uint32_t min_cap, uint32_t flags);
+
+/* Memory is taken from the arena, cleanup is then optional 
+ * as resetting the arena takes the array with it. */
+ARR_API
+int arr_init_arena(struct arr *arr, size_t esz, struct arena *arena);
+
+/* Starts out in buf, with room for cap elements, and moves to the heap 
+ * (or the arena) only once it outgrows it. From then on it's an ordinary 
+ * array, arr_cleanup knows not to free buf. buf must outlive the array. */
+ARR_API
+int arr_init_inline(struct arr *arr, size_t esz, void *buf, size_t cap);
+
+/* Array with embedded storage for N elements, for small arrays that 
+ * mostly never allocate. Initialise with ARR_INLINE_INIT, and mind the
+ * struct can't be copied around while the elements live inline.
+ *
+ *   ARR_INLINE(int, 8) ints;
+ *   ARR_INLINE_INIT(&ints);
+ *   arr_push(&ints.arr, &i);
+ */
+#define ARR_INLINE(T, N) \
+  struct { struct arr arr; T buf[N]; }
+
+#define ARR_INLINE_INIT(X) \
+  arr_init_inline(&(X)->arr, sizeof((X)->buf[0]), (X)->buf, \
+      sizeof((X)->buf) / sizeof((X)->buf[0]))
+
 ARR_API
 int arr_init_resize(struct arr *arr, size_t esz, size_t cnt);
 
@@ -108,9 +251,19 @@ int arr_move(struct arr *dst, struct arr *src);
 ARR_API
 int arr_realloc(struct arr * arr, size_t ncap);
 
+/* Grows by the array's growth factor, starting at its min_cap. */
 ARR_API
 int arr_grow(struct arr *arr);
 
+/* Makes room for at least cap elements in total, without rounding up, 
+ * so that many pushes are guaranteed not to reallocate. */
+ARR_API
+int arr_reserve(struct arr *arr, size_t cap);
+
+/* Gives back the capacity past cnt, does nothing while in an inline buffer. */
+ARR_API
+int arr_shrink_to_fit(struct arr *arr);
+
 ARR_API
 void arr_zero(struct arr *arr);
 
@@ -205,9 +358,30 @@ bool arr_belongs(const struct arr *arr, const void *e);
 
 size_t arr_idx(const struct arr *arr, const void *e);
 
-void * arr_prev(const struct arr *arr, const void *e);
+/* Step by esz and compare against the current end, no division, 
+ * and since mem and cnt are read anew on every call arr_for keeps working
+ * when the body pushes to or removes from the array. Both take the end, 
+ * what arr_remove_in_loop leaves behind after removing the last element, 
+ * so arr_rfor goes on with the new last one. A NULL e ends the loop. */
+static inline
+void * arr_prev(const struct arr *arr, const void *e) 
+{
+  if(!e) return NULL;
+  ARR_ASSERT(!arr->cnt || ((uint8_t*)arr->mem <= (uint8_t*)e && 
+        (uint8_t*)e <= (uint8_t*)arr->mem + arr->cnt * arr->esz));
 
-void * arr_next(const struct arr * arr, const void *e);
+  return arr->cnt && (uint8_t*)e > (uint8_t*)arr->mem 
+    ? (uint8_t*)e - arr->esz 
+    : NULL;
+}
+
+static inline
+void * arr_next(const struct arr * arr, const void *e) 
+{
+  if(!e) return NULL;
+  uint8_t *n = (uint8_t*)e + arr->esz;
+  return n < (uint8_t*)arr->mem + arr->cnt * arr->esz ? n : NULL;
+}
 
 void arr_append(struct arr * dst, struct arr * src);
 
@@ -217,6 +391,44 @@ void arr_prepend(struct arr * dst, struct arr * src);
 
 void arr_qsort(struct arr * arr, arr_cmp_proc *cmp);
 
+/* Key types for arr_radix_sort. */
+enum {
+  ARR_KEY_U32,
+  ARR_KEY_I32,
+  ARR_KEY_F32,
+  ARR_KEY_U64,
+  ARR_KEY_I64,
+  ARR_KEY_F64,
+};
+
+/* Stable LSD radix sort of elements by the numeric key at byte offset 
+ * key_off within each element, one pass per key byte, passes over bytes 
+ * that are the same in all keys are skipped. Needs a temporary copy of 
+ * the array, returns -1 if it can't get one. */
+int arr_radix_sort(struct arr * arr, size_t key_off, int key_type);
+
+/* Arrays at least this long are merge sorted on multiple threads, 
+ * but only if ARR_THREADS is defined (and you link with -lpthread). 
+ * Every call creates up to 2 * nt - 1 threads (nt as ARR_MSORT_THREADS 
+ * below), at about 10us to create and join each, against some 150ns per 
+ * element of sorting u64s. So the threads make up for themselves from a 
+ * few thousand elements, the default keeps them down to a few percent of 
+ * the sort with 8 cpus. 
+ * The threads are raw since tpool.h is built on top of this header, 
+ * arr_parallel_qsort from there is the pooled alternative. */
+#ifndef ARR_MSORT_PAR_MIN
+# define ARR_MSORT_PAR_MIN (1 << 16)
+#endif
+
+/* number of threads to sort with, 0 means one per cpu (at most 64) */
+#ifndef ARR_MSORT_THREADS
+# define ARR_MSORT_THREADS 0
+#endif
+
+/* Stable merge sort, needs a temporary copy of the array, 
+ * returns -1 if it can't get one. */
+int arr_msort(struct arr * arr, arr_cmp_proc *cmp);
+
 void arr_swap(struct arr *arr, void *a, void *b);
 
 void arr_clear(struct arr *arr);
@@ -227,10 +439,39 @@ int arr_remove(struct arr *arr, void *e);
 
 int arr_insert_at(struct arr *arr, void *e, size_t idx);
 
-void arr_uniq(struct arr * arr, arr_cmp_proc *cmp);
+/* Removes duplicates keeping the first occurrences in order. 
+ * Sorts pointers to the elements, so O(n log n) but allocates n pointers,
+ * returns number of elements removed or (size_t)-1 when out of memory. */
+size_t arr_uniq(struct arr * arr, arr_cmp_proc *cmp);
 
+/* Same for an array already sorted by cmp, a single pass, no allocation. */
+size_t arr_uniq_sorted(struct arr * arr, arr_cmp_proc *cmp);
+
+/* Same as arr_uniq in expected linear time using a hash set. Elements that
+ * compare equal must hash equal, NULL hash hashes the element bytes and 
+ * NULL cmp compares them with memcmp. */
+size_t arr_uniq_stable(struct arr * arr, arr_hash_proc *hash, arr_cmp_proc *cmp);
+
+/* Removes every element the predicate holds for, or every i'th element 
+ * with !keep[i], moving each kept element at most once. 
+ * Both return number of elements removed. */
+size_t arr_remove_if(struct arr * arr, arr_pred_proc *pred, void *user);
+
+size_t arr_compact(struct arr * arr, const uint8_t *keep);
+
+/* Linear search, see arr_bsearch for sorted arrays. */
 void * arr_find(const struct arr * arr, const void *key, arr_cmp_proc *cmp);
 
+/* Binary search in an array sorted by cmp (e.g. by arr_qsort with the same 
+ * cmp), key is passed as the first argument to cmp. */
+void * arr_bsearch(const struct arr * arr, const void *key, arr_cmp_proc *cmp);
+
+/* index of the first element not less than key, cnt if there is none */
+size_t arr_lower_bound(const struct arr * arr, const void *key, arr_cmp_proc *cmp);
+
+/* index of the first element greater than key, cnt if there is none */
+size_t arr_upper_bound(const struct arr * arr, const void *key, arr_cmp_proc *cmp);
+
 char ** arr_findstr(const struct arr * arr, const void *key);
 
 int arr_resize(struct arr *arr, size_t ncnt);
@@ -245,6 +486,215 @@ void * arr_push_in_loop(struct arr * arr, const void * e, void ** const loop_e);
 
 void arr_print(struct arr *arr, const char * name);
 
+#define ARR_UNLIKELY(X) __builtin_expect((X),0)
+
+/* Typed arrays
+ *
+ * ARR_DEFINE(NAME, T) declares struct NAME, laid out exactly as struct arr 
+ * but with mem typed as T*, plus a few inline helpers in which the element 
+ * size is a constant, so push and at boil down to a single store or load 
+ * and loops are plain pointer increments the compiler can vectorize.
+ * The .arr member is an ordinary struct arr, pass &x.arr to any arr_* call.
+ *
+ *   ARR_DEFINE(u64arr, uint64_t)
+ *
+ *   struct u64arr a;
+ *   u64arr_init(&a);
+ *   u64arr_push(&a, 42);
+ *   arr_qsort(&a.arr, cmp);
+ *   arr_tfor(uint64_t, e, &a) 
+ *     sum += *e;
+ */
+#define ARR_DEFINE(NAME, T) \
+  struct NAME { \
+    union { \
+      struct arr arr; \
+      struct { _ARR_FIELDS(T) }; \
+    }; \
+  }; \
+  _Static_assert(sizeof(struct NAME) == sizeof(struct arr), \
+      "struct " #NAME " must match struct arr"); \
+  \
+  static inline \
+  int NAME##_init(struct NAME *a) \
+  { \
+    return arr_init(&a->arr, sizeof(T)); \
+  } \
+  \
+  static inline \
+  void NAME##_cleanup(struct NAME *a) \
+  { \
+    arr_cleanup(&a->arr); \
+  } \
+  \
+  static inline \
+  T *NAME##_at(const struct NAME *a, size_t idx) \
+  { \
+    ARR_ASSERT_MSG(idx < a->cnt, \
+        "Index out of bounds, idx=%zu, cnt=%zu", idx, a->cnt); \
+    return a->mem + idx; \
+  } \
+  \
+  static inline \
+  T *NAME##_begin(const struct NAME *a) \
+  { \
+    return a->mem; \
+  } \
+  \
+  static inline \
+  T *NAME##_end(const struct NAME *a) \
+  { \
+    return a->mem + a->cnt; \
+  } \
+  \
+  /* NULL if growing failed */ \
+  static inline \
+  T *NAME##_push(struct NAME *a, T e) \
+  { \
+    if(ARR_UNLIKELY(a->cnt == a->cap) && arr_grow(&a->arr)) \
+      return NULL; \
+    a->mem[a->cnt] = e; \
+    return a->mem + a->cnt++; \
+  } \
+  \
+  static inline \
+  T NAME##_pop(struct NAME *a) \
+  { \
+    ARR_ASSERT(a->cnt); \
+    return a->mem[--a->cnt]; \
+  } \
+  \
+  static inline \
+  void NAME##_swap(struct NAME *a, size_t i, size_t j) \
+  { \
+    T tmp = a->mem[i]; \
+    a->mem[i] = a->mem[j]; \
+    a->mem[j] = tmp; \
+  }
+
+/* Loop over a typed array, or a struct arr of TYPE, end is read once up 
+ * front so unlike arr_for the body must not push to or remove from it. */
+#define arr_tfor(TYPE, VAR, ARR) \
+  for(TYPE * VAR = (ARR)->mem, * _##VAR##_end = VAR + (ARR)->cnt; \
+      VAR != _##VAR##_end; \
+      ++VAR)
+
+#define arr_trfor(TYPE, VAR, ARR) \
+  for(TYPE * VAR = (ARR)->mem + (ARR)->cnt, * _##VAR##_beg = (ARR)->mem; \
+      VAR != _##VAR##_beg && (--VAR, true); )
+
+/* Typed sort
+ *
+ * ARR_DEFINE_SORT(NAME, T, LESS) defines NAME_sort(T *base, size_t n), 
+ * an introsort (quicksort with median of three, insertion sort for short 
+ * ranges and heapsort once recursion gets too deep) with LESS(a, b) and 
+ * the swaps inlined, and NAME_sort_arr(struct arr *) for arrays of T.
+ * LESS gets two values of type T and must be a strict weak ordering.
+ * Not stable, see arr_msort or arr_radix_sort for that.
+ *
+ *   #define rec_less(A, B) ((A).key < (B).key)
+ *   ARR_DEFINE_SORT(rec, struct rec, rec_less)
+ *
+ *   rec_sort_arr(&recs);
+ */
+#define ARR_DEFINE_SORT(NAME, T, LESS) \
+  static inline \
+  void NAME##_isort_(T *a, size_t n) \
+  { \
+    size_t i, j; \
+    for(i = 1; i < n; ++i) { \
+      T x = a[i]; \
+      for(j = i; j && LESS(x, a[j - 1]); --j) \
+        a[j] = a[j - 1]; \
+      a[j] = x; \
+    } \
+  } \
+  \
+  static inline \
+  void NAME##_sift_(T *a, size_t i, size_t n) \
+  { \
+    size_t c; \
+    T x = a[i]; \
+    while((c = 2 * i + 1) < n) { \
+      if(c + 1 < n && LESS(a[c], a[c + 1])) \
+        c++; \
+      if(!LESS(x, a[c])) \
+        break; \
+      a[i] = a[c]; \
+      i = c; \
+    } \
+    a[i] = x; \
+  } \
+  \
+  static inline \
+  void NAME##_hsort_(T *a, size_t n) \
+  { \
+    size_t i; \
+    T t; \
+    for(i = n / 2; i--;) \
+      NAME##_sift_(a, i, n); \
+    while(n > 1) { \
+      t = a[0]; a[0] = a[--n]; a[n] = t; \
+      NAME##_sift_(a, 0, n); \
+    } \
+  } \
+  \
+  static \
+  void NAME##_intro_(T *a, size_t n, unsigned depth) \
+  { \
+    size_t m, i, j; \
+    T p, t; \
+    while(n > 16) { \
+      if(!depth--) { \
+        NAME##_hsort_(a, n); \
+        return; \
+      } \
+      /* order a[0] <= a[m] <= a[n-1], the ends then stop both scans */ \
+      m = (n - 1) / 2; \
+      if(LESS(a[m], a[0])) { t = a[m]; a[m] = a[0]; a[0] = t; } \
+      if(LESS(a[n - 1], a[m])) { \
+        t = a[m]; a[m] = a[n - 1]; a[n - 1] = t; \
+        if(LESS(a[m], a[0])) { t = a[m]; a[m] = a[0]; a[0] = t; } \
+      } \
+      p = a[m]; \
+      /* hoare, leaves [0, j] <= p <= (j, n) */ \
+      for(i = 0, j = n - 1;; ++i, --j) { \
+        while(LESS(a[i], p)) i++; \
+        while(LESS(p, a[j])) j--; \
+        if(i >= j) \
+          break; \
+        t = a[i]; a[i] = a[j]; a[j] = t; \
+      } \
+      /* recurse into the smaller half, loop on the bigger one */ \
+      if(j + 1 < n - j - 1) { \
+        NAME##_intro_(a, j + 1, depth); \
+        a += j + 1; \
+        n -= j + 1; \
+      } else { \
+        NAME##_intro_(a + j + 1, n - j - 1, depth); \
+        n = j + 1; \
+      } \
+    } \
+    NAME##_isort_(a, n); \
+  } \
+  \
+  static inline \
+  void NAME##_sort(T *base, size_t n) \
+  { \
+    unsigned depth = 0; \
+    size_t k; \
+    for(k = n; k > 1; k >>= 1) \
+      depth += 2; \
+    NAME##_intro_(base, n, depth); \
+  } \
+  \
+  static inline \
+  void NAME##_sort_arr(struct arr *arr) \
+  { \
+    ARR_ASSERT(arr->esz == sizeof(T)); \
+    NAME##_sort((T*)arr->mem, arr->cnt); \
+  }
+
 #endif /* _KK_ARR_H_ */
 
 /* implementation */
@@ -260,8 +710,59 @@ void arr_print(struct arr *arr, const char * name);
 #include <stdint.h>
 #include <stdio.h>
 
+#if defined(__linux__)
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+/* mremap is only declared with _GNU_SOURCE */
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+# define _ARR_HAS_MREMAP 1
+#else
+# define _ARR_HAS_MREMAP 0
+#endif
+
 #define _arr_pdiff(A,B) (((uint8_t*)A) - ((uint8_t*)B))
 
+#ifdef ARR_STATS
+
+# ifndef ARR_STATS_HOOK
+#  define ARR_STATS_HOOK(ARR, EV, VAL) ((void)0)
+# endif
+
+static _Thread_local struct arr_stats _arr_stats;
+
+# define _ARR_STAT(ARR, EV, CNT, BYTES, VAL) \
+  do { \
+    _arr_stats.CNT++; \
+    _arr_stats.BYTES += (VAL); \
+    ARR_STATS_HOOK((ARR), (EV), (VAL)); \
+  } while(0)
+
+struct arr_stats *arr_stats(void)
+{
+  return &_arr_stats;
+}
+
+void arr_stats_reset(void)
+{
+  memset(&_arr_stats, 0, sizeof(_arr_stats));
+}
+
+void arr_stats_dump(FILE *f)
+{
+  const struct arr_stats *s = &_arr_stats;
+
+  fprintf(f, "arr: %zu reallocs (%zu bytes, peak %zu), "
+      "%zu relocations (%zu bytes), %zu moves (%zu bytes)\n",
+      s->reallocs, s->realloc_bytes, s->peak_bytes, 
+      s->relocs, s->reloc_bytes, s->moves, s->moved_bytes);
+}
+
+#else
+# define _ARR_STAT(ARR, EV, CNT, BYTES, VAL) ((void)0)
+#endif /* ARR_STATS */
+
 ARR_API
 int arr_init(struct arr * arr, size_t esz) 
 {
@@ -271,6 +772,41 @@ int arr_init(struct arr * arr, size_t esz)
   return 0;
 }
 
+ARR_API
+int arr_init_ex(struct arr *arr, size_t esz, uint32_t min_cap, uint32_t flags)
+{
+  if(arr_init(arr, esz))
+    return -1;
+
+  arr->min_cap = min_cap;
+  arr->flags = flags & ~_ARR_INTERNAL_FLAGS;
+  return 0;
+}
+
+ARR_API
+int arr_init_inline(struct arr *arr, size_t esz, void *buf, size_t cap)
+{
+  if(arr_init(arr, esz))
+    return -1;
+
+  if(buf && cap) {
+    arr->mem = buf;
+    arr->cap = cap;
+    arr->flags |= _ARR_BORROWED;
+  }
+  return 0;
+}
+
+ARR_API
+int arr_init_arena(struct arr *arr, size_t esz, struct arena *arena)
+{
+  if(arr_init(arr, esz))
+    return -1;
+
+  arr->arena = arena;
+  return 0;
+}
+
 ARR_API
 int arr_init_resize(struct arr *arr, size_t esz, size_t init_cnt) 
 {
@@ -301,7 +837,8 @@ void arr_cleanup(struct arr * arr)
 ARR_API
 void arr_clear(struct arr *arr)
 {
-  memset(arr->mem, 0, arr->cnt * arr->esz);
+  if(arr->cnt)
+    memset(arr->mem, 0, arr->cnt * arr->esz);
   arr->cnt = 0;
 }
 
@@ -316,8 +853,13 @@ int arr_reinit(struct arr *arr, size_t esz)
     if(arr->esz == esz)
       return 0;
 
+    /* keep the growth policy and the allocator */
+    struct arr tmp = *arr;
     arr_cleanup(arr);
-    return arr_init(arr, esz);
+    if(arr_init_ex(arr, esz, tmp.min_cap, tmp.flags))
+      return -1;
+    arr->arena = tmp.arena;
+    return 0;
   }
 
   return arr_init(arr, esz);
@@ -358,25 +900,178 @@ void _arr_expand(struct arr * arr, size_t idx, size_t n) {
 
   memmove(to, from, size);
   memset(from, 0, (to - from));
+  _ARR_STAT(arr, ARR_EV_MOVE, moves, moved_bytes, size);
+}
+
+#if _ARR_HAS_MREMAP
+
+static inline
+size_t _arr_map_len(size_t sz)
+{
+  size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+  return (sz + pg - 1) & ~(pg - 1);
 }
 
+/* Moves between heap and mapping when crossing the threshold, 
+ * which costs one copy, from then on mremap just moves the pages. */
+static
+void *_arr_realloc_mapped(struct arr *arr, size_t sz)
+{
+  void *nmem;
+  size_t osz = arr->cap * arr->esz;
+  bool mapped = arr->flags & _ARR_MAPPED;
+
+  if(sz >= ARR_MMAP_THRESHOLD) {
+    if(mapped) {
+      nmem = mremap(arr->mem, _arr_map_len(osz), _arr_map_len(sz), 
+          MREMAP_MAYMOVE);
+      return nmem == MAP_FAILED ? NULL : nmem; 
+    }
+
+    nmem = mmap(NULL, _arr_map_len(sz), PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(nmem == MAP_FAILED)
+      return NULL;
+
+    if(arr->mem) {
+      memcpy(nmem, arr->mem, arr->cnt * arr->esz);
+      if(ARR_REALLOC(arr->mem, 0)) { /* ignore realloc return value */ }
+    }
+    arr->flags |= _ARR_MAPPED;
+    return nmem;
+  }
+
+  if(!mapped)
+    return ARR_REALLOC(arr->mem, sz);
+
+  /* shrinking back below the threshold */
+  nmem = NULL;
+  if(sz && !(nmem = ARR_REALLOC(NULL, sz)))
+    return NULL;
+
+  if(nmem)
+    memcpy(nmem, arr->mem, arr->cnt * arr->esz);
+  munmap(arr->mem, _arr_map_len(osz));
+  arr->flags &= ~_ARR_MAPPED;
+  return nmem;
+}
+
+#endif /* _ARR_HAS_MREMAP */
+
+/* there is no aligned realloc, so it's always a copy */
+static
+void *_arr_realloc_aligned(struct arr *arr, size_t sz)
+{
+  void *nmem = NULL;
+
+  if(sz && posix_memalign(&nmem, ARR_ALIGNMENT, sz))
+    return NULL;
+
+  if(nmem && arr->mem)
+    memcpy(nmem, arr->mem, 
+        arr->cnt * arr->esz < sz ? arr->cnt * arr->esz : sz);
+  free(arr->mem);
+  return nmem;
+}
+
+/* On failure the array is left as it was. */
 int arr_realloc(struct arr * arr, size_t ncap) 
 {
+  void *nmem;
   ARR_ASSERT(arr);
 
   ARR_ASSERT(arr->cnt <= ncap);
 
-  void * nmem = realloc(arr->mem, ncap * arr->esz);
+  if(arr->esz && ncap > SIZE_MAX / arr->esz)
+    return -1;
+
+  /* never shrink into or free a borrowed buffer, only spill out of it */
+  if(arr->flags & _ARR_BORROWED) {
+    struct arr spill;
+
+    if(ncap <= arr->cap)
+      return 0;
+
+    spill = *arr;
+    spill.mem = NULL;
+    spill.cap = spill.cnt = 0;
+    spill.flags &= ~_ARR_BORROWED;
+
+    if(arr_realloc(&spill, ncap))
+      return -1;
+
+    memcpy(spill.mem, arr->mem, arr->cnt * arr->esz);
+    spill.cnt = arr->cnt;
+    *arr = spill;
+    return 0;
+  }
+
+  /* realloc(NULL, 0) may well allocate */
+  if(!ncap && !arr->mem) {
+    arr->cap = 0;
+    return 0;
+  }
+
+  if(arr->arena)
+    nmem = arena_realloc(arr->arena, arr->mem, ncap * arr->esz);
+  else if(arr->flags & ARR_ALIGNED)
+    nmem = _arr_realloc_aligned(arr, ncap * arr->esz);
+#if _ARR_HAS_MREMAP
+  else if(arr->flags & (ARR_MMAP | _ARR_MAPPED))
+    nmem = _arr_realloc_mapped(arr, ncap * arr->esz);
+#endif
+  else
+    nmem = ARR_REALLOC(arr->mem, ncap * arr->esz);
+
+  if(!nmem && ncap)
+    return -1;
+
+#ifdef ARR_STATS
+  if(ncap) {
+    _ARR_STAT(arr, ARR_EV_REALLOC, reallocs, realloc_bytes, ncap * arr->esz);
+    if(ncap * arr->esz > _arr_stats.peak_bytes)
+      _arr_stats.peak_bytes = ncap * arr->esz;
+    if(arr->mem && nmem != arr->mem) {
+      _arr_stats.relocs++;
+      _arr_stats.reloc_bytes += arr->cnt * arr->esz;
+    }
+  }
+#endif
 
-  //ARR_ARR_ASSERT((ncap == 0) == (nmem == 0));
   arr->cap = ncap;
-  arr->mem = nmem;
+  arr->mem = ncap ? nmem : NULL;
   return 0;
 }
 
+/* next capacity under the array's growth policy that fits need elements */
+static inline
+size_t _arr_grow_cap(const struct arr *arr, size_t need)
+{
+  size_t ncap = arr->cap;
+
+  if(!ncap)
+    ncap = arr->min_cap ? arr->min_cap : ARR_MIN_CAP;
+  else if(arr->flags & ARR_GROW_HALF)
+    ncap += (ncap >> 1) + 1;
+  else
+    ncap *= 2;
+
+  return ncap < need ? need : ncap;
+}
+
 int arr_grow(struct arr * arr)
 {
-  return arr_realloc(arr, arr->cap ? arr->cap * 2 : 1);
+  return arr_realloc(arr, _arr_grow_cap(arr, arr->cap + 1));
+}
+
+int arr_reserve(struct arr *arr, size_t cap)
+{
+  return cap > arr->cap ? arr_realloc(arr, cap) : 0;
+}
+
+int arr_shrink_to_fit(struct arr *arr)
+{
+  return arr->cnt < arr->cap ? arr_realloc(arr, arr->cnt) : 0;
 }
 
 void arr_zero(struct arr *arr) 
@@ -401,8 +1096,8 @@ void * arr_push(struct arr * arr, const void * e)
 {
   ARR_ASSERT(arr);
 
-  if(arr->cnt == arr->cap) 
-    ARR_ASSERT( !arr_grow(arr) );
+  if(arr->cnt == arr->cap && arr_grow(arr))
+    return NULL;
 
   ARR_ASSERT(arr->cnt < arr->cap) ;
 
@@ -451,31 +1146,6 @@ size_t arr_idx(const struct arr *arr, const void *e)
   return _arr_idx(arr, e);
 }
 
-void * arr_prev(const struct arr *arr, const void *e) 
-{
-  if(arr->cnt == 0) return NULL;
-
-  void *lst = arr_lst(arr);
-  void *end = (uint8_t*)lst + arr->esz;
-
-  if(e == end) return lst;
-
-  size_t idx = arr_idx(arr, e);
-  return idx ? arr_at(arr, idx - 1) : NULL;
-}
-
-void * arr_next(const struct arr * arr, const void *e) 
-{
-  return arr_at(arr, _arr_idx(arr, e) + 1);
-  //if(arr->cnt == 0) return NULL;
-
-  //void *lst = arr_lst(arr);
-  //void *end = (uint8_t*)lst + arr->esz;
-  //if(e == end) return NULL;
-
-  //size_t idx = arr_idx(arr, e);
-  //return idx < arr->cnt ? arr_at(arr, idx + 1) : NULL;
-}
 
 // FIXME
 void arr_append(struct arr * dst, struct arr * src)
@@ -496,7 +1166,8 @@ void arr_append_raw(struct arr * dst, const void *data, size_t cnt)
   else
     assert(data);
 
-  arr_resize(dst, prev_cnt + cnt);
+  if(arr_resize(dst, prev_cnt + cnt))
+    return;
 
   memcpy(arr_at(dst, prev_cnt), data, cnt * dst->esz);
 }
@@ -508,7 +1179,9 @@ void arr_prepend(struct arr * dst, struct arr * src)
 
   if(src->cnt == 0) return;
 
-  arr_realloc(dst, 100);
+  if(dst->cnt + src->cnt > dst->cap && 
+      arr_realloc(dst, _arr_grow_cap(dst, dst->cnt + src->cnt)))
+    return;
 
   _arr_expand(dst, 0, src->cnt);
   dst->cnt += src->cnt;
@@ -524,6 +1197,254 @@ void arr_qsort(struct arr * arr, arr_cmp_proc *cmp)
   qsort(arr->mem, arr->cnt, arr->esz, cmp);
 }
 
+/* radix sort */
+
+/* maps the key to an unsigned integer with the same order */
+static inline
+uint64_t _arr_radix_key(const uint8_t *e, int type)
+{
+  uint32_t u32;
+  uint64_t u64;
+
+  switch(type) {
+  case ARR_KEY_U32: memcpy(&u32, e, 4); return u32;
+  case ARR_KEY_I32: memcpy(&u32, e, 4); return u32 ^ 0x80000000u;
+  /* negative floats are flipped whole, positive only get the sign bit set */
+  case ARR_KEY_F32: memcpy(&u32, e, 4); 
+    return u32 ^ (-(u32 >> 31) | 0x80000000u);
+  case ARR_KEY_U64: memcpy(&u64, e, 8); return u64;
+  case ARR_KEY_I64: memcpy(&u64, e, 8); return u64 ^ 0x8000000000000000ull;
+  case ARR_KEY_F64: memcpy(&u64, e, 8); 
+    return u64 ^ (-(u64 >> 63) | 0x8000000000000000ull);
+  }
+  return 0;
+}
+
+/* always inlined so the common element sizes get a constant esz */
+static inline __attribute__((always_inline))
+void _arr_radix_scatter(const uint8_t *src, uint8_t *dst, size_t n, 
+    size_t esz, size_t key_off, int type, unsigned shift, size_t *off)
+{
+  size_t i;
+  for(i = 0; i < n; ++i, src += esz) {
+    uint8_t b = _arr_radix_key(src + key_off, type) >> shift;
+    memcpy(dst + off[b]++ * esz, src, esz);
+  }
+}
+
+int arr_radix_sort(struct arr * arr, size_t key_off, int key_type)
+{
+  size_t i, n = arr->cnt, esz = arr->esz, sum, tmp_off[256];
+  size_t (*cnt)[256];
+  unsigned p, nbytes = key_type >= ARR_KEY_U64 ? 8 : 4;
+  uint8_t *src = arr->mem, *dst, *e;
+  uint64_t k;
+
+  ARR_ASSERT(key_off + nbytes <= esz);
+
+  if(n < 2)
+    return 0;
+
+  /* histograms first, then the buffer */
+  if(!(cnt = ARR_REALLOC(NULL, 8 * sizeof(*cnt) + n * esz)))
+    return -1;
+  memset(cnt, 0, 8 * sizeof(*cnt));
+  dst = (uint8_t*)(cnt + 8);
+
+  /* all histograms in one go */
+  for(i = 0, e = src; i < n; ++i, e += esz) {
+    k = _arr_radix_key(e + key_off, key_type);
+    for(p = 0; p < nbytes; ++p)
+      cnt[p][(k >> (8 * p)) & 0xff]++;
+  }
+
+  for(p = 0; p < nbytes; ++p) {
+    /* every key has the same byte here, nothing to do */
+    k = _arr_radix_key(src + key_off, key_type);
+    if(cnt[p][(k >> (8 * p)) & 0xff] == n)
+      continue;
+
+    for(i = 0, sum = 0; i < 256; ++i) {
+      tmp_off[i] = sum;
+      sum += cnt[p][i];
+    }
+
+    switch(esz) {
+    case 4:  _arr_radix_scatter(src, dst, n, 4,  key_off, key_type, 8*p, tmp_off); break;
+    case 8:  _arr_radix_scatter(src, dst, n, 8,  key_off, key_type, 8*p, tmp_off); break;
+    case 16: _arr_radix_scatter(src, dst, n, 16, key_off, key_type, 8*p, tmp_off); break;
+    default: _arr_radix_scatter(src, dst, n, esz, key_off, key_type, 8*p, tmp_off);
+    }
+
+    e = src; src = dst; dst = e;
+  }
+
+  if(src != arr->mem)
+    memcpy(arr->mem, src, n * esz);
+
+  if(ARR_REALLOC(cnt, 0)) { /* ignore realloc return value */ }
+  return 0;
+}
+
+/* merge sort */
+
+/* merges sorted a and b into dst, ties go to a so it stays stable */
+static
+void _arr_merge(uint8_t *dst, const uint8_t *a, size_t na, 
+    const uint8_t *b, size_t nb, size_t esz, arr_cmp_proc *cmp)
+{
+  const uint8_t *ae = a + na * esz, *be = b + nb * esz;
+
+  while(a != ae && b != be) {
+    if(cmp(b, a) < 0) {
+      memcpy(dst, b, esz);
+      b += esz;
+    } else {
+      memcpy(dst, a, esz);
+      a += esz;
+    }
+    dst += esz;
+  }
+  memcpy(dst, a, ae - a);
+  dst += ae - a;
+  memcpy(dst, b, be - b);
+}
+
+/* sorts base by way of tmp, both n elements */
+static
+void _arr_msort_rec(uint8_t *base, uint8_t *tmp, size_t n, 
+    size_t esz, arr_cmp_proc *cmp)
+{
+  size_t i, j, h = n / 2;
+
+  if(n <= 16) {
+    /* stable insertion sort, tmp holds the one being inserted */
+    for(i = 1; i < n; ++i) {
+      if(cmp(base + (i - 1) * esz, base + i * esz) <= 0)
+        continue;
+      memcpy(tmp, base + i * esz, esz);
+      for(j = i; j && cmp(tmp, base + (j - 1) * esz) < 0; --j) ;
+      memmove(base + (j + 1) * esz, base + j * esz, (i - j) * esz);
+      memcpy(base + j * esz, tmp, esz);
+    }
+    return;
+  }
+
+  _arr_msort_rec(base, tmp, h, esz, cmp);
+  _arr_msort_rec(base + h * esz, tmp, n - h, esz, cmp);
+
+  /* halves already in order */
+  if(cmp(base + (h - 1) * esz, base + h * esz) <= 0)
+    return;
+
+  _arr_merge(tmp, base, h, base + h * esz, n - h, esz, cmp);
+  memcpy(base, tmp, n * esz);
+}
+
+#ifdef ARR_THREADS
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct _arr_msort_task {
+  pthread_t thread;
+  uint8_t *base;
+  uint8_t *tmp;
+  size_t n;
+  /* for merges, length of the first run */
+  size_t na;
+  size_t esz;
+  arr_cmp_proc *cmp;
+};
+
+static
+void *_arr_msort_task_sort(void *_t)
+{
+  struct _arr_msort_task *t = _t;
+  _arr_msort_rec(t->base, t->tmp, t->n, t->esz, t->cmp);
+  return NULL;
+}
+
+static
+void *_arr_msort_task_merge(void *_t)
+{
+  struct _arr_msort_task *t = _t;
+  _arr_merge(t->tmp, t->base, t->na, t->base + t->na * t->esz, 
+      t->n - t->na, t->esz, t->cmp);
+  memcpy(t->base, t->tmp, t->n * t->esz);
+  return NULL;
+}
+
+/* Sorts nt runs on their own threads, then merges pairs of neighbouring 
+ * runs level by level, also in parallel. Falls back to the calling 
+ * thread whenever a thread can't be created. */
+static
+void _arr_msort_par(uint8_t *base, uint8_t *tmp, size_t n, 
+    size_t esz, arr_cmp_proc *cmp, size_t nt)
+{
+  struct _arr_msort_task t[64];
+  size_t run[65], i, step, w;
+  bool spawned[64];
+
+  for(i = 0; i <= nt; ++i)
+    run[i] = n * i / nt;
+
+  for(i = 0; i < nt; ++i) {
+    t[i] = (struct _arr_msort_task){ 
+      .base = base + run[i] * esz, .tmp = tmp + run[i] * esz, 
+      .n = run[i + 1] - run[i], .esz = esz, .cmp = cmp,
+    };
+    spawned[i] = !pthread_create(&t[i].thread, NULL, _arr_msort_task_sort, &t[i]);
+    if(!spawned[i])
+      _arr_msort_task_sort(&t[i]);
+  }
+  for(i = 0; i < nt; ++i)
+    if(spawned[i])
+      pthread_join(t[i].thread, NULL);
+
+  for(step = 1; step < nt; step *= 2) {
+    for(i = 0, w = 0; i + step < nt; i += 2 * step, ++w) {
+      size_t hi = i + 2 * step < nt ? i + 2 * step : nt;
+      t[w] = (struct _arr_msort_task){ 
+        .base = base + run[i] * esz, .tmp = tmp + run[i] * esz, 
+        .n = run[hi] - run[i], .na = run[i + step] - run[i], 
+        .esz = esz, .cmp = cmp,
+      };
+      spawned[w] = !pthread_create(&t[w].thread, NULL, _arr_msort_task_merge, &t[w]);
+      if(!spawned[w])
+        _arr_msort_task_merge(&t[w]);
+    }
+    for(i = 0; i < w; ++i)
+      if(spawned[i])
+        pthread_join(t[i].thread, NULL);
+  }
+}
+
+#endif /* ARR_THREADS */
+
+int arr_msort(struct arr * arr, arr_cmp_proc *cmp)
+{
+  uint8_t *tmp;
+
+  if(arr->cnt < 2)
+    return 0;
+
+  if(!(tmp = ARR_REALLOC(NULL, arr->cnt * arr->esz)))
+    return -1;
+
+#ifdef ARR_THREADS
+  long nt = ARR_MSORT_THREADS ? ARR_MSORT_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+  if(arr->cnt >= ARR_MSORT_PAR_MIN && nt > 1)
+    _arr_msort_par(arr->mem, tmp, arr->cnt, arr->esz, cmp, 
+        nt < 64 ? (size_t)nt : 64);
+  else
+#endif
+    _arr_msort_rec(arr->mem, tmp, arr->cnt, arr->esz, cmp);
+
+  if(ARR_REALLOC(tmp, 0)) { /* ignore realloc return value */ }
+  return 0;
+}
+
 void arr_swap(struct arr *arr, void *a, void *b) 
 {
   ARR_ASSERT(arr->mem <= a && a <= arr_lst(arr));
@@ -541,7 +1462,7 @@ void arr_swap(struct arr *arr, void *a, void *b)
 
   uint8_t tmp[arr->esz];
   memcpy(tmp, a, arr->esz);
-  memcpy(b,   a, arr->esz);
+  memcpy(a,   b, arr->esz);
   memcpy(b, tmp, arr->esz);
 }
 
@@ -556,6 +1477,7 @@ static void _arr_collapse(struct arr * arr, size_t idx, size_t n) {
   size_t size = arr->esz * (arr->cnt - idx - n);
 
   memmove(to, from, size);
+  _ARR_STAT(arr, ARR_EV_MOVE, moves, moved_bytes, size);
 }
 
 int arr_remove_at(struct arr * arr, size_t idx)
@@ -575,8 +1497,8 @@ int arr_remove(struct arr *arr, void *e)
 
 int arr_insert_at(struct arr *arr, void *e, size_t idx)
 {
-  if(arr->cnt == arr->cap) 
-    ARR_ASSERT( !arr_grow(arr) );
+  if(arr->cnt == arr->cap && arr_grow(arr))
+    return -1;
 
   _arr_expand(arr, idx, 1);
   arr->cnt++;
@@ -590,17 +1512,186 @@ int arr_insert_at(struct arr *arr, void *e, size_t idx)
 }
 
 
-void arr_uniq(struct arr * arr, arr_cmp_proc *cmp) 
+size_t arr_compact(struct arr * arr, const uint8_t *keep)
 {
-  void *e, *lkp;
+  size_t i, w = 0, esz = arr->esz, removed;
+  uint8_t *mem = arr->mem;
+
+  for(i = 0; i < arr->cnt; ++i) {
+    if(!keep[i])
+      continue;
+    if(w != i)
+      memcpy(mem + w * esz, mem + i * esz, esz);
+    w++;
+  }
 
-  for(e = arr_lst(arr); e; e = arr_prev(arr, e)) {
-    for(lkp = arr_prev(arr, e); lkp; lkp = arr_prev(arr, lkp)) {
-      if(cmp(e, lkp) == 0) {
-        arr_remove(arr, e); break;
-      }
+  removed = arr->cnt - w;
+  arr->cnt = w;
+  return removed;
+}
+
+size_t arr_remove_if(struct arr * arr, arr_pred_proc *pred, void *user)
+{
+  size_t i, w = 0, esz = arr->esz, removed;
+  uint8_t *mem = arr->mem;
+
+  for(i = 0; i < arr->cnt; ++i) {
+    if(pred(mem + i * esz, user))
+      continue;
+    if(w != i)
+      memcpy(mem + w * esz, mem + i * esz, esz);
+    w++;
+  }
+
+  removed = arr->cnt - w;
+  arr->cnt = w;
+  return removed;
+}
+
+size_t arr_uniq_sorted(struct arr * arr, arr_cmp_proc *cmp)
+{
+  size_t i, w = 1, esz = arr->esz, removed;
+  uint8_t *mem = arr->mem;
+
+  if(arr->cnt < 2)
+    return 0;
+
+  /* compare against the last kept one, i.e. keep the first of each run */
+  for(i = 1; i < arr->cnt; ++i) {
+    if(!cmp(mem + (w - 1) * esz, mem + i * esz))
+      continue;
+    if(w != i)
+      memcpy(mem + w * esz, mem + i * esz, esz);
+    w++;
+  }
+
+  removed = arr->cnt - w;
+  arr->cnt = w;
+  return removed;
+}
+
+/* qsort has no user pointer */
+static _Thread_local arr_cmp_proc *_arr_uniq_cmp;
+
+static 
+int _arr_uniq_ptr_cmp(const void *_a, const void *_b)
+{
+  const uint8_t *a = *(const uint8_t**)_a, *b = *(const uint8_t**)_b;
+  int c = _arr_uniq_cmp(a, b);
+
+  /* ties by position so the first occurrence leads its group */
+  return c ? c : (a < b ? -1 : a > b);
+}
+
+size_t arr_uniq(struct arr * arr, arr_cmp_proc *cmp) 
+{
+  size_t i, n = arr->cnt, removed = 0;
+  uint8_t *mem = arr->mem, **ptrs, *keep;
+
+  if(n < 2)
+    return 0;
+
+  /* one block, the pointers go first to keep them aligned */
+  if(!(ptrs = ARR_REALLOC(NULL, n * (sizeof(*ptrs) + 1))))
+    return (size_t)-1;
+  keep = (uint8_t*)(ptrs + n);
+
+  for(i = 0; i < n; ++i)
+    ptrs[i] = mem + i * arr->esz;
+
+  _arr_uniq_cmp = cmp;
+  qsort(ptrs, n, sizeof(*ptrs), _arr_uniq_ptr_cmp);
+
+  memset(keep, 0, n);
+  keep[(ptrs[0] - mem) / arr->esz] = 1;
+  for(i = 1; i < n; ++i) 
+    if(cmp(ptrs[i - 1], ptrs[i]))
+      keep[(ptrs[i] - mem) / arr->esz] = 1;
+
+  removed = arr_compact(arr, keep);
+  if(ARR_REALLOC(ptrs, 0)) { /* ignore realloc return value */ }
+  return removed;
+}
+
+size_t arr_uniq_stable(struct arr * arr, arr_hash_proc *hash, arr_cmp_proc *cmp)
+{
+  size_t i, j, w = 0, cap = 8, mask, esz = arr->esz, removed;
+  uint8_t *mem = arr->mem, *e;
+  uint64_t h;
+  /* slot holds position of a kept element plus one, 0 is empty */
+  size_t *slots;
+
+  if(arr->cnt < 2)
+    return 0;
+
+  while(cap < 2 * arr->cnt)
+    cap <<= 1;
+  mask = cap - 1;
+
+  if(!(slots = ARR_REALLOC(NULL, cap * sizeof(*slots))))
+    return (size_t)-1;
+  memset(slots, 0, cap * sizeof(*slots));
+
+  for(i = 0; i < arr->cnt; ++i) {
+    e = mem + i * esz;
+    h = hash ? hash(e, esz) : kk_hash(e, esz);
+
+    /* kept elements have been moved to positions below w already */
+    for(j = h & mask; slots[j]; j = (j + 1) & mask) {
+      const uint8_t *k = mem + (slots[j] - 1) * esz;
+      if(!(cmp ? cmp(k, e) : memcmp(k, e, esz)))
+        break;
     }
+    if(slots[j])
+      continue;
+
+    if(w != i)
+      memcpy(mem + w * esz, e, esz);
+    slots[j] = ++w;
+  }
+
+  if(ARR_REALLOC(slots, 0)) { /* ignore realloc return value */ }
+
+  removed = arr->cnt - w;
+  arr->cnt = w;
+  return removed;
+}
+
+size_t arr_lower_bound(const struct arr * arr, const void *key, arr_cmp_proc *cmp)
+{
+  size_t lo = 0, hi = arr->cnt, mid;
+
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(cmp(key, _arr_at(arr, mid)) > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+size_t arr_upper_bound(const struct arr * arr, const void *key, arr_cmp_proc *cmp)
+{
+  size_t lo = 0, hi = arr->cnt, mid;
+
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(cmp(key, _arr_at(arr, mid)) >= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return lo;
+}
+
+void * arr_bsearch(const struct arr * arr, const void *key, arr_cmp_proc *cmp)
+{
+  size_t idx = arr_lower_bound(arr, key, cmp);
+
+  if(idx < arr->cnt && !cmp(key, _arr_at(arr, idx)))
+    return _arr_at(arr, idx);
+  return NULL;
 }
 
 void * arr_find(const struct arr * arr, const void *key, arr_cmp_proc *cmp) 
@@ -622,7 +1713,7 @@ char ** arr_findstr(const struct arr * arr, const void *key)
 
 int arr_copy(struct arr *dst, struct arr *src) 
 {
-  int ret = 0;
+  int ret = -1;
   ARR_ASSERT(dst && src);
   ARR_ASSERT(arr_alive(src));
 
@@ -641,14 +1732,15 @@ exit:
 
 static void _arr_zero_range(struct arr *arr, size_t b, size_t e) {
   ARR_ASSERT( b <= e );
-  memset((uint8_t*)arr->mem + b * arr->esz, '\0', e - b);
+  memset((uint8_t*)arr->mem + b * arr->esz, '\0', (e - b) * arr->esz);
 }
 
 int arr_resize(struct arr *arr, size_t ncnt) 
 {
   int ret = -1;
   if(arr->cnt < ncnt)  {
-    if(arr_realloc(arr, ncnt))
+    /* grow geometrically, repeated appends would be quadratic otherwise */
+    if(ncnt > arr->cap && arr_realloc(arr, _arr_grow_cap(arr, ncnt)))
       goto exit;
 
     _arr_zero_range(arr, arr->cnt, ncnt);
@@ -674,7 +1766,8 @@ int arr_remove_in_loop(struct arr * arr, void * e, void ** const loop_e)
 {
   size_t idx = arr_idx(arr, *loop_e);
   int ret = arr_remove(arr, e);
-  *loop_e = arr_at(arr, idx);
+  /* the end rather than NULL, arr_rfor steps back from it */
+  *loop_e = _arr_at(arr, idx < arr->cnt ? idx : arr->cnt);
 
   return ret;
 }
@@ -0,0 +1,126 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * Cost of the arr iteration macros against a hand written loop, summing
+ * an array of uint64_t and of 16 byte records a number of times over.
+ *
+ *   $ gcc -O2 -I.. arr_for.c -o arr_for && ./arr_for [nelems] [nreps]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define KK_ARR_IMPL
+#include "arr.h"
+
+struct rec {
+  uint64_t key;
+  uint64_t val;
+};
+
+ARR_DEFINE(u64arr, uint64_t)
+
+static size_t nelems = 1 << 22;
+static size_t nreps = 20;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* keeps the compiler from dropping the loops */
+static volatile uint64_t sink;
+
+#define BENCH(NAME, ...) \
+  do { \
+    double t = now(); \
+    for(size_t r = 0; r < nreps; ++r) { \
+      uint64_t sum = 0; \
+      __VA_ARGS__ \
+      sink += sum; \
+    } \
+    t = now() - t; \
+    printf("%-28s %8.3f ms %8.3f ns/elem\n", NAME, t * 1e3, \
+        t * 1e9 / (nelems * nreps)); \
+  } while(0)
+
+int main(int argc, char **argv)
+{
+  struct arr a, recs;
+  struct u64arr ta;
+
+  if(argc > 1) nelems = strtoul(argv[1], NULL, 0);
+  if(argc > 2) nreps = strtoul(argv[2], NULL, 0);
+
+  arr_init(&a, sizeof(uint64_t));
+  arr_init(&recs, sizeof(struct rec));
+  u64arr_init(&ta);
+  arr_reserve(&a, nelems);
+  arr_reserve(&recs, nelems);
+  arr_reserve(&ta.arr, nelems);
+
+  for(uint64_t i = 0; i < nelems; ++i) {
+    struct rec r = { i, i * 3 };
+    arr_push(&a, &i);
+    arr_push(&recs, &r);
+    u64arr_push(&ta, i);
+  }
+
+  printf("%zu elements, %zu reps\n\nuint64_t\n", nelems, nreps);
+
+  BENCH("hand written", {
+    const uint64_t *p = a.mem;
+    for(size_t i = 0; i < a.cnt; ++i)
+      sum += p[i];
+  });
+  BENCH("arr_for", { arr_for(uint64_t, e, &a) sum += *e; });
+  BENCH("arr_rfor", { arr_rfor(uint64_t, e, &a) sum += *e; });
+  BENCH("arr_ufor", { arr_ufor(uint64_t, e, &a) sum += *e; });
+  BENCH("arr_urfor", { arr_urfor(uint64_t, e, &a) sum += *e; });
+  BENCH("arr_tfor (struct arr)", { arr_tfor(uint64_t, e, &a) sum += *e; });
+  BENCH("arr_tfor (ARR_DEFINE)", { arr_tfor(uint64_t, e, &ta) sum += *e; });
+  BENCH("arr_at", {
+    for(size_t i = 0; i < a.cnt; ++i)
+      sum += *arr_att(uint64_t, &a, i);
+  });
+
+  printf("\nstruct rec\n");
+
+  BENCH("hand written", {
+    const struct rec *p = recs.mem;
+    for(size_t i = 0; i < recs.cnt; ++i)
+      sum += p[i].val;
+  });
+  BENCH("arr_for", { arr_for(struct rec, e, &recs) sum += e->val; });
+  BENCH("arr_ufor", { arr_ufor(struct rec, e, &recs) sum += e->val; });
+  BENCH("arr_tfor", { arr_tfor(struct rec, e, &recs) sum += e->val; });
+
+  arr_cleanup(&a);
+  arr_cleanup(&recs);
+  u64arr_cleanup(&ta);
+  return 0;
+}
@@ -0,0 +1,641 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * The benchmark suite: arr, rbtree, map and gio under fixed seed workloads.
+ * Every benchmark runs in a fresh child process and reports time per 
+ * operation, heap allocations per operation, the peak of heap bytes it held
+ * on top of its input and the peak RSS of the process. Apart from the 
+ * timings and RSS the output is the same run after run, so runs from two 
+ * commits can be diffed line by line.
+ *
+ *   $ gcc -O2 -I.. bench.c -o bench -lm -lpthread && ./bench [n] [filter]
+ *
+ * n is the number of elements/keys/records (default 1 << 16), filter runs
+ * only the benchmarks with it in their name, e.g. ./bench 100000 map/
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define KK_ARR_IMPL
+#define KK_RBTREE_IMPL
+#define KK_INTERN_IMPL
+#define KK_MAP_IMPL
+#include "map.h"
+#define KK_RING_IMPL
+#include "ring.h"
+#define KK_GIO_THREADS
+#define KK_GIO_IMPL
+#include "gio.h"
+
+#include "workload.h"
+
+#define SEED 0x5eedULL
+
+/* Every allocation in the process goes through these, including the ones
+ * map and intern make with plain realloc, they count and pass the call on 
+ * to glibc. Only what happens between bench_start and bench_stop counts. */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+/* GIO_LIST_ASYNC workers allocate too, so the counters are atomic */
+static struct {
+  size_t allocs;
+  size_t live;
+  size_t peak;
+} bstat;
+
+static inline void _bench_grow(size_t d)
+{
+  size_t live = __atomic_add_fetch(&bstat.live, d, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&bstat.peak, __ATOMIC_RELAXED);
+
+  while(live > peak && !__atomic_compare_exchange_n(&bstat.peak, &peak, live, 
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static inline void *_bench_track(void *p)
+{
+  if(p) {
+    __atomic_add_fetch(&bstat.allocs, 1, __ATOMIC_RELAXED);
+    _bench_grow(malloc_usable_size(p));
+  }
+  return p;
+}
+
+static inline void _bench_untrack(void *p)
+{
+  if(p) __atomic_sub_fetch(&bstat.live, malloc_usable_size(p), __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t sz)
+{
+  return _bench_track(__libc_malloc(sz));
+}
+
+void *calloc(size_t n, size_t sz)
+{
+  return _bench_track(__libc_calloc(n, sz));
+}
+
+void *realloc(void *p, size_t sz)
+{
+  void *np;
+  size_t osz = p ? malloc_usable_size(p) : 0;
+
+  if(!sz) {
+    _bench_untrack(p);
+    __libc_free(p);
+    return NULL;
+  }
+  if(!(np = __libc_realloc(p, sz)))
+    return NULL;
+
+  __atomic_sub_fetch(&bstat.live, osz, __ATOMIC_RELAXED);
+  return _bench_track(np);
+}
+
+void free(void *p)
+{
+  _bench_untrack(p);
+  __libc_free(p);
+}
+
+int posix_memalign(void **p, size_t align, size_t sz)
+{
+  return (*p = _bench_track(__libc_memalign(align, sz))) ? 0 : 12 /* ENOMEM */;
+}
+
+void *aligned_alloc(size_t align, size_t sz)
+{
+  return _bench_track(__libc_memalign(align, sz));
+}
+
+struct bench {
+  const char *name;
+  void (*run)(struct bench *b);
+  /* filled in by the run */
+  size_t n;
+  size_t ops;
+  double t;
+  size_t allocs;
+  size_t live;
+  size_t peak;
+  /* folded into the output so that nothing gets optimised away */
+  uint64_t sink;
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_start(struct bench *b)
+{
+  b->allocs = __atomic_load_n(&bstat.allocs, __ATOMIC_RELAXED);
+  b->live = __atomic_load_n(&bstat.live, __ATOMIC_RELAXED);
+  __atomic_store_n(&bstat.peak, b->live, __ATOMIC_RELAXED);
+  b->t = now();
+}
+
+static void bench_stop(struct bench *b, size_t ops)
+{
+  b->t = now() - b->t;
+  b->allocs = __atomic_load_n(&bstat.allocs, __ATOMIC_RELAXED) - b->allocs;
+  b->peak = __atomic_load_n(&bstat.peak, __ATOMIC_RELAXED) - b->live;
+  b->ops = ops;
+}
+
+/* a benchmark that can't set itself up exits, the parent reports it failed */
+static void *xcheck(void *p)
+{
+  if(!p) exit(1);
+  return p;
+}
+
+static uint64_t *rand_u64(size_t n, struct wl_rng *r)
+{
+  uint64_t *v = xcheck(malloc(n * sizeof(*v)));
+  for(size_t i = 0; i < n; ++i)
+    v[i] = wl_next(r);
+  return v;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/* arr */
+
+static void arr_push_u64(struct bench *b)
+{
+  struct arr a;
+
+  arr_init(&a, sizeof(uint64_t));
+  bench_start(b);
+  for(uint64_t i = 0; i < b->n; ++i)
+    arr_push(&a, &i);
+  bench_stop(b, b->n);
+  b->sink = a.cnt;
+  arr_cleanup(&a);
+}
+
+static void arr_push_reserved(struct bench *b)
+{
+  struct arr a;
+
+  arr_init(&a, sizeof(uint64_t));
+  bench_start(b);
+  arr_reserve(&a, b->n);
+  for(uint64_t i = 0; i < b->n; ++i)
+    arr_push(&a, &i);
+  bench_stop(b, b->n);
+  b->sink = a.cnt;
+  arr_cleanup(&a);
+}
+
+#define ITER_REPS 32
+
+static void arr_iter_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct arr a;
+  uint64_t sum = 0;
+
+  arr_init_resize(&a, sizeof(uint64_t), b->n);
+  arr_for(uint64_t, e, &a) *e = wl_next(&r);
+
+  bench_start(b);
+  for(int rep = 0; rep < ITER_REPS; ++rep)
+    arr_for(uint64_t, e, &a) sum += *e;
+  bench_stop(b, b->n * ITER_REPS);
+  b->sink = sum;
+  arr_cleanup(&a);
+}
+
+static void arr_msort_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct arr a;
+
+  arr_init_resize(&a, sizeof(uint64_t), b->n);
+  arr_for(uint64_t, e, &a) *e = wl_next(&r);
+
+  bench_start(b);
+  arr_msort(&a, cmp_u64);
+  bench_stop(b, b->n);
+  b->sink = *arr_att(uint64_t, &a, 0);
+  arr_cleanup(&a);
+}
+
+static void arr_radix_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct arr a;
+
+  arr_init_resize(&a, sizeof(uint64_t), b->n);
+  arr_for(uint64_t, e, &a) *e = wl_next(&r);
+
+  bench_start(b);
+  arr_radix_sort(&a, 0, ARR_KEY_U64);
+  bench_stop(b, b->n);
+  b->sink = *arr_att(uint64_t, &a, 0);
+  arr_cleanup(&a);
+}
+
+/* rbtree, uint64_t keys in random order with a uint64_t of data */
+
+static void _rbtree_fill(struct rbtree *t, uint64_t *keys, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    *(uint64_t*)rbnode_get_data(t, rbtree_insert(t, &keys[i])) = i;
+}
+
+static void rbtree_insert_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint64_t *keys = rand_u64(b->n, &r);
+  struct rbtree t;
+
+  rbtree_init(&t, sizeof(uint64_t), sizeof(uint64_t), cmp_u64, NULL);
+  bench_start(b);
+  _rbtree_fill(&t, keys, b->n);
+  bench_stop(b, b->n);
+  b->sink = t.cnt;
+  rbtree_cleanup(&t);
+  free(keys);
+}
+
+static void rbtree_insert_pool(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint64_t *keys = rand_u64(b->n, &r);
+  struct rbpool pool;
+  struct rbtree t;
+
+  bench_start(b);
+  rbpool_init(&pool, rbtree_node_size(sizeof(uint64_t), sizeof(uint64_t)), 
+      NULL);
+  rbtree_init_pool(&t, sizeof(uint64_t), sizeof(uint64_t), cmp_u64, &pool);
+  _rbtree_fill(&t, keys, b->n);
+  bench_stop(b, b->n);
+  b->sink = t.cnt;
+  rbpool_cleanup(&pool);
+  free(keys);
+}
+
+static void rbtree_search_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint64_t *keys = rand_u64(b->n, &r);
+  struct rbtree t;
+  uint64_t hits = 0;
+
+  rbtree_init(&t, sizeof(uint64_t), sizeof(uint64_t), cmp_u64, NULL);
+  _rbtree_fill(&t, keys, b->n);
+  wl_shuffle(keys, b->n, sizeof(*keys), &r);
+
+  bench_start(b);
+  for(size_t i = 0; i < b->n; ++i)
+    hits += rbtree_search(&t, &keys[i]) != NULL;
+  bench_stop(b, b->n);
+  b->sink = hits;
+  rbtree_cleanup(&t);
+  free(keys);
+}
+
+static void rbtree_delete_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint64_t *keys = rand_u64(b->n, &r);
+  struct rbtree t;
+
+  rbtree_init(&t, sizeof(uint64_t), sizeof(uint64_t), cmp_u64, NULL);
+  _rbtree_fill(&t, keys, b->n);
+  wl_shuffle(keys, b->n, sizeof(*keys), &r);
+
+  /* the search is part of it, that is how keys get deleted */
+  bench_start(b);
+  for(size_t i = 0; i < b->n; ++i)
+    rbtree_delete(&t, rbtree_search(&t, &keys[i]));
+  bench_stop(b, b->n);
+  b->sink = t.cnt;
+  rbtree_cleanup(&t);
+  free(keys);
+}
+
+struct _rbtree_sum {
+  struct rbtree *t;
+  uint64_t sum;
+};
+
+static void _rbtree_sum(struct rbnode *n, void *user)
+{
+  struct _rbtree_sum *s = user;
+  s->sum += *(const uint64_t*)rbnode_get_key(s->t, n);
+}
+
+static void rbtree_inorder_u64(struct bench *b)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint64_t *keys = rand_u64(b->n, &r);
+  struct rbtree t;
+  struct _rbtree_sum sum = { .t = &t };
+
+  rbtree_init(&t, sizeof(uint64_t), sizeof(uint64_t), cmp_u64, NULL);
+  _rbtree_fill(&t, keys, b->n);
+
+  bench_start(b);
+  for(int rep = 0; rep < ITER_REPS; ++rep)
+    rbtree_inorder(&t, _rbtree_sum, &sum);
+  bench_stop(b, b->n * ITER_REPS);
+  b->sink = sum.sum;
+  rbtree_cleanup(&t);
+  free(keys);
+}
+
+/* map */
+
+static void _map_insert(struct bench *b, int kind)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct wl_keys k;
+  struct map m;
+
+  if(wl_keys_init(&k, b->n, kind, &r)) exit(1);
+  bench_start(b);
+  map_init(&m);
+  for(size_t i = 0; i < k.n; ++i)
+    map_insert(&m, k.keys[i], k.keys[i]);
+  bench_stop(b, k.n);
+  b->sink = m.rbt.cnt;
+  map_destroy(&m);
+  wl_keys_cleanup(&k);
+}
+
+static void map_insert_short(struct bench *b)
+{
+  _map_insert(b, WL_KEYS_SHORT);
+}
+
+static void map_insert_prefix(struct bench *b)
+{
+  _map_insert(b, WL_KEYS_PREFIX);
+}
+
+/* zipf false looks every key up once in random order, 
+ * zipf true draws lookups from a Zipf(0.99) over the keys */
+static void _map_search(struct bench *b, int kind, bool zipf)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct wl_keys k;
+  struct wl_zipf z;
+  struct map m;
+  const char **q;
+  uint64_t hits = 0;
+
+  if(wl_keys_init(&k, b->n, kind, &r)) exit(1);
+  map_init(&m);
+  for(size_t i = 0; i < k.n; ++i)
+    map_insert(&m, k.keys[i], k.keys[i]);
+
+  q = xcheck(malloc(k.n * sizeof(*q)));
+  if(zipf) {
+    if(wl_zipf_init(&z, k.n, 0.99)) exit(1);
+    for(size_t i = 0; i < k.n; ++i)
+      q[i] = k.keys[wl_zipf_next(&z, &r)];
+    wl_zipf_cleanup(&z);
+  } else {
+    memcpy(q, k.keys, k.n * sizeof(*q));
+    wl_shuffle(q, k.n, sizeof(*q), &r);
+  }
+
+  bench_start(b);
+  for(size_t i = 0; i < k.n; ++i)
+    hits += map_search(&m, q[i]) != NULL;
+  bench_stop(b, k.n);
+  b->sink = hits;
+
+  free(q);
+  map_destroy(&m);
+  wl_keys_cleanup(&k);
+}
+
+static void map_search_short(struct bench *b)
+{
+  _map_search(b, WL_KEYS_SHORT, false);
+}
+
+static void map_search_prefix(struct bench *b)
+{
+  _map_search(b, WL_KEYS_PREFIX, false);
+}
+
+static void map_search_zipf(struct bench *b)
+{
+  _map_search(b, WL_KEYS_PREFIX, true);
+}
+
+/* gio, n records of 64 bytes, or about that much printed */
+
+#define REC_SZ 64
+
+enum { SINK_MEM, SINK_FILE, SINK_LIST, SINK_LIST_ASYNC };
+
+static int _tmpfd(void)
+{
+  char path[] = "/tmp/kk-bench-XXXXXX";
+  int fd = mkstemp(path);
+  if(fd >= 0) unlink(path);
+  return fd;
+}
+
+union gio_any {
+  struct gio_mem m;
+  struct gio_file f;
+  struct gio_ops l;
+};
+
+/* the file is buffered with the default buffer, the list writes to 
+ * a growing mem and a buffered file */
+static gio_t *_gio_open(union gio_any *g, int sink)
+{
+  struct gio_mem m;
+  struct gio_file f;
+
+  switch(sink) {
+  case SINK_MEM:
+    g->m = gio_mem_new(NULL, 0, GIO_MEM_AUTOGROW);
+    return &g->m;
+  case SINK_FILE:
+    g->f = gio_file_new_fd_buf(_tmpfd(), KK_GIO_FILE_BUFSZ, 0);
+    return &g->f;
+  case SINK_LIST:
+  case SINK_LIST_ASYNC:
+    g->l = gio_list_new(sink == SINK_LIST_ASYNC ? GIO_LIST_ASYNC : 0);
+    m = gio_mem_new(NULL, 0, GIO_MEM_AUTOGROW);
+    f = gio_file_new_fd_buf(_tmpfd(), KK_GIO_FILE_BUFSZ, 0);
+    gio_list_add(&g->l, &m.gio);
+    gio_list_add(&g->l, &f.gio);
+    return &g->l;
+  }
+  return NULL;
+}
+
+static void _gio_write(struct bench *b, int sink)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  uint8_t *recs = (uint8_t*)rand_u64(b->n * REC_SZ / 8, &r);
+  union gio_any g;
+  gio_t *gio;
+  uint64_t wr = 0;
+
+  bench_start(b);
+  gio = _gio_open(&g, sink);
+  for(size_t i = 0; i < b->n; ++i)
+    wr += gio_write(gio, recs + i * REC_SZ, REC_SZ) == REC_SZ;
+  gio_sync(gio);
+  gio_close(gio);
+  bench_stop(b, b->n);
+  b->sink = wr;
+  free(recs);
+}
+
+static void _gio_printf(struct bench *b, int sink)
+{
+  struct wl_rng r = wl_rng_new(SEED);
+  struct wl_keys k;
+  union gio_any g;
+  gio_t *gio;
+  uint64_t wr = 0;
+
+  if(wl_keys_init(&k, b->n, WL_KEYS_PREFIX, &r)) exit(1);
+
+  bench_start(b);
+  gio = _gio_open(&g, sink);
+  for(size_t i = 0; i < b->n; ++i)
+    wr += gio_nprintf(gio, 256, "%zu %s %d\n", i, k.keys[i], (int)(i % 997));
+  gio_sync(gio);
+  gio_close(gio);
+  bench_stop(b, b->n);
+  b->sink = wr;
+  wl_keys_cleanup(&k);
+}
+
+static void gio_write_mem(struct bench *b)   { _gio_write(b, SINK_MEM); }
+static void gio_write_file(struct bench *b)  { _gio_write(b, SINK_FILE); }
+static void gio_write_list(struct bench *b)  { _gio_write(b, SINK_LIST); }
+static void gio_write_lista(struct bench *b) { _gio_write(b, SINK_LIST_ASYNC); }
+static void gio_printf_mem(struct bench *b)  { _gio_printf(b, SINK_MEM); }
+static void gio_printf_file(struct bench *b) { _gio_printf(b, SINK_FILE); }
+static void gio_printf_list(struct bench *b) { _gio_printf(b, SINK_LIST); }
+
+static struct bench benches[] = {
+  { .name = "arr/push_u64",          .run = arr_push_u64 },
+  { .name = "arr/push_reserved",     .run = arr_push_reserved },
+  { .name = "arr/iter_u64",          .run = arr_iter_u64 },
+  { .name = "arr/msort_u64",         .run = arr_msort_u64 },
+  { .name = "arr/radix_u64",         .run = arr_radix_u64 },
+  { .name = "rbtree/insert",         .run = rbtree_insert_u64 },
+  { .name = "rbtree/insert_pool",    .run = rbtree_insert_pool },
+  { .name = "rbtree/search",         .run = rbtree_search_u64 },
+  { .name = "rbtree/delete",         .run = rbtree_delete_u64 },
+  { .name = "rbtree/inorder",        .run = rbtree_inorder_u64 },
+  { .name = "map/insert_short",      .run = map_insert_short },
+  { .name = "map/insert_prefix",     .run = map_insert_prefix },
+  { .name = "map/search_short",      .run = map_search_short },
+  { .name = "map/search_prefix",     .run = map_search_prefix },
+  { .name = "map/search_zipf",       .run = map_search_zipf },
+  { .name = "gio/write_mem",         .run = gio_write_mem },
+  { .name = "gio/write_file",        .run = gio_write_file },
+  { .name = "gio/write_list",        .run = gio_write_list },
+  { .name = "gio/write_list_async",  .run = gio_write_lista },
+  { .name = "gio/printf_mem",        .run = gio_printf_mem },
+  { .name = "gio/printf_file",       .run = gio_printf_file },
+  { .name = "gio/printf_list",       .run = gio_printf_list },
+};
+
+/* runs in its own process so that the peak RSS is its own */
+static void run(struct bench *b)
+{
+  struct rusage ru;
+
+  b->run(b);
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("%-22s %10zu %10.2f %10.3f %10zu %10ld %16llx\n", b->name, b->ops,
+      b->t * 1e9 / b->ops, (double)b->allocs / b->ops, b->peak / 1024, 
+      ru.ru_maxrss, (unsigned long long)b->sink);
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = 1 << 16;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+
+  if(argc > 1) n = strtoull(argv[1], NULL, 10);
+  if(!n) return 1;
+
+  printf("n %zu seed %#llx\n", n, SEED);
+  printf("%-22s %10s %10s %10s %10s %10s %16s\n", "bench", "ops", "ns/op", 
+      "allocs/op", "peak KiB", "rss KiB", "check");
+  fflush(stdout);
+
+  for(size_t i = 0; i < sizeof(benches) / sizeof(*benches); ++i) {
+    struct bench *b = &benches[i];
+    pid_t pid;
+    int st;
+
+    if(filter && !strstr(b->name, filter))
+      continue;
+
+    b->n = n;
+    if(!(pid = fork())) {
+      run(b);
+      fflush(stdout);
+      _exit(0);
+    }
+    if(pid < 0 || waitpid(pid, &st, 0) < 0 || !WIFEXITED(st) || 
+        WEXITSTATUS(st)) {
+      printf("%-22s failed\n", b->name);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * Read throughput of struct cmap against struct map behind one global mutex,
+ * with 1, 2, 4, ... threads up to the number of online cpus.
+ *
+ *   $ gcc -O2 -I.. cmap.c -o cmap -lpthread && ./cmap [nkeys] [nops]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define KK_ARR_IMPL
+#define KK_RBTREE_IMPL
+#define KK_INTERN_IMPL
+#define KK_MAP_IMPL
+#include "map.h"
+#define KK_HMAP_IMPL
+#include "hmap.h"
+#define KK_CMAP_IMPL
+#include "cmap.h"
+
+static size_t nkeys = 1 << 18;
+static size_t nops = 1 << 21;
+
+static char **keys;
+static struct map gmap;
+static pthread_mutex_t gmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cmap cmap;
+static pthread_barrier_t barrier;
+
+struct worker {
+  pthread_t thread;
+  uint64_t seed;
+  size_t hits;
+  bool use_cmap;
+};
+
+static inline uint64_t xorshift64(uint64_t *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *worker_main(void *user)
+{
+  struct worker *w = user;
+  const char *key;
+
+  pthread_barrier_wait(&barrier);
+
+  for(size_t i = 0; i < nops; ++i) {
+    key = keys[xorshift64(&w->seed) % nkeys];
+
+    if(w->use_cmap) {
+      w->hits += cmap_search(&cmap, key) != NULL;
+    } else {
+      pthread_mutex_lock(&gmap_lock);
+      w->hits += map_search(&gmap, key) != NULL;
+      pthread_mutex_unlock(&gmap_lock);
+    }
+  }
+
+  pthread_barrier_wait(&barrier);
+  return NULL;
+}
+
+/* returns million lookups per second over all threads */
+static double run(int nthreads, bool use_cmap)
+{
+  struct worker w[nthreads];
+  double t0, t1;
+
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+
+  for(int i = 0; i < nthreads; ++i) {
+    w[i] = (struct worker){ .seed = 0x9e3779b97f4a7c15ULL * (i + 1), 
+                            .use_cmap = use_cmap };
+    pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+  }
+
+  pthread_barrier_wait(&barrier);
+  t0 = now();
+  pthread_barrier_wait(&barrier);
+  t1 = now();
+
+  for(int i = 0; i < nthreads; ++i) {
+    pthread_join(w[i].thread, NULL);
+    if(w[i].hits != nops)
+      fprintf(stderr, "thread %d missed %zu keys\n", i, nops - w[i].hits);
+  }
+
+  pthread_barrier_destroy(&barrier);
+  return (double)nthreads * nops / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t seed = 42;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(argc > 1) nkeys = strtoull(argv[1], NULL, 10);
+  if(argc > 2) nops = strtoull(argv[2], NULL, 10);
+
+  if(!(keys = malloc(nkeys * sizeof(*keys))))
+    return 1;
+
+  map_init(&gmap);
+  cmap_init(&cmap);
+
+  /* shared prefixes, like the keys this is meant for */
+  for(size_t i = 0; i < nkeys; ++i) {
+    keys[i] = malloc(48);
+    snprintf(keys[i], 48, "namespace:service/path/%016llx", 
+        (unsigned long long)xorshift64(&seed));
+    map_insert(&gmap, keys[i], keys[i]);
+    cmap_insert(&cmap, keys[i], keys[i]);
+  }
+
+  printf("%zu keys, %zu lookups per thread, %ld cpus\n", nkeys, nops, ncpus);
+  printf("%8s %16s %16s\n", "threads", "map+mutex Mop/s", "cmap Mop/s");
+
+  for(int n = 1; n <= ncpus; n *= 2)
+    printf("%8d %16.2f %16.2f\n", n, run(n, false), run(n, true));
+
+  cmap_cleanup(&cmap);
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * Reproducible workloads for the benchmarks: a seeded generator, Zipf 
+ * distributed ranks and key sets that look like real keys. Everything is
+ * derived from the seed alone, so two builds given the same seed run on 
+ * exactly the same data.
+ */
+
+#ifndef _KK_BENCH_WORKLOAD_H_
+#define _KK_BENCH_WORKLOAD_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+/* splitmix64, tiny and good enough to drive benchmarks */
+struct wl_rng {
+  uint64_t s;
+};
+
+static inline struct wl_rng wl_rng_new(uint64_t seed)
+{
+  return (struct wl_rng){ .s = seed };
+}
+
+static inline uint64_t wl_next(struct wl_rng *r)
+{
+  uint64_t z = (r->s += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* uniform in [0, n), the modulo bias is irrelevant here */
+static inline uint64_t wl_below(struct wl_rng *r, uint64_t n)
+{
+  return wl_next(r) % n;
+}
+
+/* uniform in [0, 1) */
+static inline double wl_unit(struct wl_rng *r)
+{
+  return (wl_next(r) >> 11) * 0x1.0p-53;
+}
+
+/* Zipf over ranks [0, n), rank k is drawn with probability proportional 
+ * to 1/(k+1)^s. The cdf is built once, sampling is a binary search. */
+struct wl_zipf {
+  double *cdf;
+  size_t n;
+};
+
+static inline int wl_zipf_init(struct wl_zipf *z, size_t n, double s)
+{
+  double sum = 0;
+
+  if(!n || !(z->cdf = malloc(n * sizeof(*z->cdf))))
+    return -1;
+
+  for(size_t k = 0; k < n; ++k)
+    z->cdf[k] = (sum += 1.0 / pow((double)(k + 1), s));
+  for(size_t k = 0; k < n; ++k)
+    z->cdf[k] /= sum;
+
+  z->n = n;
+  return 0;
+}
+
+static inline size_t wl_zipf_next(struct wl_zipf *z, struct wl_rng *r)
+{
+  double u = wl_unit(r);
+  size_t lo = 0, hi = z->n - 1;
+
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(z->cdf[mid] < u) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static inline void wl_zipf_cleanup(struct wl_zipf *z)
+{
+  free(z->cdf);
+  z->cdf = NULL;
+}
+
+/* n distinct keys, all strings live in one buffer so generating them 
+ * costs two allocations no matter n */
+struct wl_keys {
+  char **keys;
+  char *buf;
+  size_t n;
+};
+
+enum {
+  /* 8 to 16 hex digits, short enough to be kept inline by map */
+  WL_KEYS_SHORT,
+  /* "tenant03/orders-svc/v2/item:0000a1b2c3d4" and the like, a handful of 
+   * long shared prefixes followed by a unique tail */
+  WL_KEYS_PREFIX,
+};
+
+#define WL_KEY_MAX 64
+
+static inline int wl_keys_init(struct wl_keys *k, size_t n, int kind, 
+    struct wl_rng *r)
+{
+  static const char *svc[] = { 
+    "orders-svc", "users-svc", "billing", "search-frontend", "inventory", 
+    "auth", "notifications", "media-transcode",
+  };
+  size_t nsvc = sizeof(svc) / sizeof(*svc);
+  char *p;
+
+  if(!(k->keys = malloc(n * sizeof(*k->keys))))
+    return -1;
+  if(!(k->buf = malloc(n * WL_KEY_MAX))) {
+    free(k->keys);
+    return -1;
+  }
+
+  p = k->buf;
+  for(size_t i = 0; i < n; ++i) {
+    /* the part derived from i makes every key distinct, the rest is noise */
+    uint64_t x = wl_next(r);
+    int len;
+
+    if(kind == WL_KEYS_SHORT)
+      len = snprintf(p, WL_KEY_MAX, "%08x%.*s", 
+          (unsigned)((uint32_t)i * 0x9e3779b1U), (int)(x & 7), 
+          "0123456789abcdef" + ((x >> 3) & 7));
+    else
+      len = snprintf(p, WL_KEY_MAX, "tenant%02u/%s/v%u/item:%012llx", 
+          (unsigned)(x % 12), svc[(x >> 8) % nsvc], (unsigned)(x >> 16) % 3, 
+          (unsigned long long)(i * 0x9e3779b97f4a7c15ULL & 0xffffffffffffULL));
+
+    k->keys[i] = p;
+    p += len + 1;
+  }
+
+  k->n = n;
+  return 0;
+}
+
+static inline void wl_keys_cleanup(struct wl_keys *k)
+{
+  free(k->keys);
+  free(k->buf);
+  k->keys = NULL;
+  k->buf = NULL;
+}
+
+/* Fisher-Yates over an array of n elements of esz bytes */
+static inline void wl_shuffle(void *base, size_t n, size_t esz, 
+    struct wl_rng *r)
+{
+  unsigned char tmp[esz], *a = base;
+
+  for(size_t i = n; i > 1; --i) {
+    size_t j = wl_below(r, i);
+    memcpy(tmp, a + (i - 1) * esz, esz);
+    memcpy(a + (i - 1) * esz, a + j * esz, esz);
+    memcpy(a + j * esz, tmp, esz);
+  }
+}
+
+#endif /* #ifndef _KK_BENCH_WORKLOAD_H_ */
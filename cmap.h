@@ -0,0 +1,161 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header concurrent string to pointer hash map.
+ *  Keys are spread over CMAP_SHARDS independent hmaps by their hash, each 
+ *  with its own reader-writer lock on its own cache line, so threads only 
+ *  meet on a lock when they use keys from the same shard and never 
+ *  serialise on a writer working elsewhere. Mind that taking the read lock
+ *  writes the lock word, readers of one shard still bounce its cache line
+ *  between them, they just don't wait on each other.
+ *  Define KK_CMAP_IMPL (along with KK_HMAP_IMPL) to spawn the implementation.
+ *  Link with -lpthread.
+ */
+
+#ifndef _KK_CMAP_H_
+#define _KK_CMAP_H_
+
+#include <pthread.h>
+#include "hmap.h"
+
+/* must be a power of two */
+#ifndef CMAP_SHARDS
+# define CMAP_SHARDS 64
+#endif
+
+#ifndef CMAP_CACHELINE
+# define CMAP_CACHELINE 64
+#endif
+
+struct cmap_shard {
+  pthread_rwlock_t lock;
+  struct hmap map;
+} __attribute__((aligned(CMAP_CACHELINE)));
+
+struct cmap {
+  struct cmap_shard *shards;
+};
+
+int cmap_init(struct cmap *map);
+
+/* not thread safe, nobody else may use the map by then */
+void cmap_cleanup(struct cmap *map);
+
+/* replaces data if the key is already there, just as hmap_insert does */
+int cmap_insert(struct cmap *map, const char *key, void *data);
+
+void *cmap_search(struct cmap *map, const char *key);
+
+int cmap_remove(struct cmap *map, const char *key);
+
+#endif /* _KK_CMAP_H_ */
+
+/* implementation */
+
+#ifdef KK_CMAP_IMPL
+
+#ifndef _KK_CMAP_IMPL_
+#define _KK_CMAP_IMPL_
+
+_Static_assert(!(CMAP_SHARDS & (CMAP_SHARDS - 1)), 
+    "CMAP_SHARDS must be a power of two");
+
+/* hmap indexes by the low bits, so pick the shard with the high ones */
+static inline
+struct cmap_shard *_cmap_shard(struct cmap *map, uint64_t hash)
+{
+  return &map->shards[(hash >> 32) & (CMAP_SHARDS - 1)];
+}
+
+int cmap_init(struct cmap *map)
+{
+  size_t i;
+
+  if(posix_memalign((void**)&map->shards, CMAP_CACHELINE, 
+        CMAP_SHARDS * sizeof(*map->shards)))
+    return -1;
+
+  for(i = 0; i < CMAP_SHARDS; ++i) {
+    hmap_init(&map->shards[i].map);
+    if(pthread_rwlock_init(&map->shards[i].lock, NULL))
+      goto fail;
+  }
+  return 0;
+
+fail:
+  while(i--)
+    pthread_rwlock_destroy(&map->shards[i].lock);
+  free(map->shards);
+  map->shards = NULL;
+  return -1;
+}
+
+void cmap_cleanup(struct cmap *map)
+{
+  for(size_t i = 0; i < CMAP_SHARDS; ++i) {
+    hmap_cleanup(&map->shards[i].map);
+    pthread_rwlock_destroy(&map->shards[i].lock);
+  }
+  free(map->shards);
+  map->shards = NULL;
+}
+
+int cmap_insert(struct cmap *map, const char *key, void *data)
+{
+  int ret;
+  uint64_t hash = kk_hash_str(key);
+  struct cmap_shard *shard = _cmap_shard(map, hash);
+
+  pthread_rwlock_wrlock(&shard->lock);
+  ret = hmap_insert_hash(&shard->map, key, hash, data);
+  pthread_rwlock_unlock(&shard->lock);
+  return ret;
+}
+
+void *cmap_search(struct cmap *map, const char *key)
+{
+  void *ret;
+  uint64_t hash = kk_hash_str(key);
+  struct cmap_shard *shard = _cmap_shard(map, hash);
+
+  pthread_rwlock_rdlock(&shard->lock);
+  ret = hmap_search_hash(&shard->map, key, hash);
+  pthread_rwlock_unlock(&shard->lock);
+  return ret;
+}
+
+int cmap_remove(struct cmap *map, const char *key)
+{
+  int ret;
+  uint64_t hash = kk_hash_str(key);
+  struct cmap_shard *shard = _cmap_shard(map, hash);
+
+  pthread_rwlock_wrlock(&shard->lock);
+  ret = hmap_remove_hash(&shard->map, key, hash);
+  pthread_rwlock_unlock(&shard->lock);
+  return ret;
+}
+
+#endif /* _KK_CMAP_IMPL_ */
+
+#endif /* KK_CMAP_IMPL */
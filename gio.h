@@ -33,12 +33,30 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include "arena.h"
+
+/* GIO_LIST_ASYNC worker threads, define along with KK_RING_IMPL and 
+ * KK_ARR_IMPL and link with -lpthread */
+#ifdef KK_GIO_THREADS
+# include <pthread.h>
+# include <stdlib.h>
+# include "ring.h"
+#endif
+
+/* io_uring backed GIO_ASYNC, define KK_GIO_NO_URING to leave it out */
+#if !defined(KK_GIO_NO_URING) && defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define KK_GIO_HAS_URING
+#  include <linux/io_uring.h>
+# endif
+#endif
 
 #ifndef KK_GIO_XALLOC
 # include <stdlib.h>
@@ -64,6 +82,11 @@ static inline void * _kk_gio_xalloc(void *ptr, size_t sz)
 # define KK_GIO_PRINTF_BUFSZ 256
 #endif
 
+/* bounce buffer of gio_pipe() when neither end can do better */
+#ifndef KK_GIO_PIPE_BUFSZ
+# define KK_GIO_PIPE_BUFSZ (64 * 1024)
+#endif
+
 #ifdef KK_GIO_ENABLE_TRACING
 # ifndef KK_GIO_TRACE
 #  define KK_GIO_TRACE(...) printf(__VA_ARGS__); fflush(stdout)
@@ -85,6 +108,8 @@ enum {
   GIO_FILE,
   GIO_MEM,
   GIO_OPS,
+  GIO_MMAP,
+  GIO_ASYNC,
 };
 
 struct gio {
@@ -126,14 +151,47 @@ struct gio_mem {
   void *buf;
   size_t sz;
   size_t off;
+  /* if set allocated buffers come from here instead of KK_GIO_XALLOC */
+  struct arena *arena;
+};
+
+/* Read only mapping of a whole file, reads and seeks as a gio_mem would,
+ * writes fail. The first fields are laid out as in gio_mem. */
+struct gio_mmap {
+  struct gio gio;
+  void *buf;
+  size_t sz;
+  size_t off;
+};
+
+enum {
+  /* access pattern hints passed to posix_madvise */
+  GIO_MMAP_SEQUENTIAL = 0x1,
+  GIO_MMAP_RANDOM     = 0x2,
+  GIO_MMAP_WILLNEED   = 0x4,
+  /* prefault the whole mapping up front, where MAP_POPULATE is supported */
+  GIO_MMAP_POPULATE   = 0x8,
 };
 
 struct gio_file {
   struct gio gio;
   FILE *fp;
   int fd;
+  /* fd only, see gio_file_init_fd_buf(), buffers are NULL when unbuffered */
+  uint8_t *wbuf;
+  size_t wcap;
+  size_t wlen;
+  uint8_t *rbuf;
+  size_t rcap;
+  size_t roff;
+  size_t rlen;
 };
 
+/* A reasonable buffer size for gio_file_init_fd_buf() */
+#ifndef KK_GIO_FILE_BUFSZ
+# define KK_GIO_FILE_BUFSZ 8192
+#endif
+
 enum {
   GIO_CTL_CLOSE, 
   GIO_CTL_SYNC,
@@ -154,6 +212,10 @@ struct gio_ops {
   /* This should work as sync, close and user-defined
    * custom operations. */
   int (*ctl)(struct gio_ops *, int op, void *user);
+  /* optional, when NULL gio_writev and gio_readv call write and read 
+   * once per iovec */
+  ssize_t (*writev)(struct gio_ops *, const struct iovec *, int);
+  ssize_t (*readv)(struct gio_ops *, const struct iovec *, int);
 };
 
 #define KK_GIO_API
@@ -178,6 +240,10 @@ struct gio_mem gio_mem_new(void *buf, size_t sz, uint8_t flags);
 KK_GIO_API
 struct gio_mem gio_mem_new_alloc(size_t sz);
 
+/* Autogrowing buffer in the arena, closing it is optional. */
+KK_GIO_API
+struct gio_mem gio_mem_new_arena(struct arena *arena, size_t sz);
+
 /* file pointer api */
 
 KK_GIO_API
@@ -194,6 +260,37 @@ int gio_file_init_fd(struct gio_file *gio, int fd);
 KK_GIO_API
 struct gio_file gio_file_new_fd(int fd);
 
+/* Buffered file descriptor. Writes are gathered in a wsz bytes buffer and
+ * only written out when it fills up, on GIO_CTL_SYNC, seek, read or close. 
+ * Reads are served from a rsz bytes read-ahead buffer, refilled with one 
+ * read(2) at a time. Writes and reads at least as big as the buffer bypass
+ * it. Either size may be 0 to leave that direction unbuffered. 
+ * Buffers are freed on close. */
+KK_GIO_API
+int gio_file_init_fd_buf(struct gio_file *gio, int fd, size_t wsz, size_t rsz);
+
+KK_GIO_API
+struct gio_file gio_file_new_fd_buf(int fd, size_t wsz, size_t rsz);
+
+/* memory mapped file api */
+
+/* Maps the whole regular file fd refers to, fd may be closed right after. */
+KK_GIO_API
+int gio_mmap_init_fd(struct gio_mmap *gio, int fd, uint8_t flags);
+
+KK_GIO_API
+struct gio_mmap gio_mmap_new_fd(int fd, uint8_t flags);
+
+KK_GIO_API
+int gio_mmap_init_open(struct gio_mmap *gio, const char *filepath, uint8_t flags);
+
+KK_GIO_API
+struct gio_mmap gio_mmap_new_open(const char *filepath, uint8_t flags);
+
+/* Changes the access hints for the whole mapping. */
+KK_GIO_API
+int gio_mmap_advise(struct gio_mmap *gio, uint8_t flags);
+
 /* file api */
 
 KK_GIO_API
@@ -205,10 +302,25 @@ struct gio_file gio_file_new_open(const char *filepath);
 /* list api */
 
 enum {
-  GIO_LIST_READ       = (1 << 0), /* not impelmented */
+  /* Reading reads the gios one after another, as cat would, 
+   * writing is not supported. Without it writes go to every gio. */
+  GIO_LIST_READ       = (1 << 0),
   GIO_LIST_FAIL_FAST  = (1 << 1), 
+  /* Every gio added gets its own worker thread and a KK_GIO_LIST_QUEUE_SZ 
+   * bytes queue, writes return as soon as the data is queued (or wait for
+   * room when a queue is full), GIO_CTL_SYNC waits for all the queues to 
+   * be written out. GIO_ASYNC gios are already asynchronous and are added
+   * as they are. Needs KK_GIO_THREADS, without it the flag is ignored. */
+  GIO_LIST_ASYNC      = (1 << 2),
 };
 
+#ifndef KK_GIO_LIST_QUEUE_SZ
+# define KK_GIO_LIST_QUEUE_SZ (256 * 1024)
+#endif
+
+/* Syncing the list syncs every gio on it, closing closes them all, 
+ * both return -1 if any of them did (and with GIO_LIST_FAIL_FAST 
+ * stop at the first one). */
 KK_GIO_API
 struct gio_ops gio_list_new(uint8_t flags);
 
@@ -221,6 +333,146 @@ int gio_list_add(struct gio_ops *list, struct gio *gio);
 
 //int gio_imux_add(struct gio *gio);
 
+/* asynchronous api, io_uring based, Linux only */
+
+#ifdef KK_GIO_HAS_URING
+
+struct gio_async;
+
+/* res is what the syscall would return, bytes moved or -errno */
+typedef void (gio_async_proc)(struct gio_async *gio, ssize_t res, void *user);
+
+struct _gio_async_op {
+  struct gio_async *gio;
+  gio_async_proc *cb;
+  void *user;
+  /* copy made by plain gio_write, freed on completion */
+  void *owned;
+  size_t len;
+  /* set when someone blocks on this op */
+  ssize_t *wait_res;
+  bool *wait_done;
+  struct _gio_async_op *next_free;
+};
+
+/* One submission and completion queue pair shared by any number of 
+ * gio_async. Ops are only queued until the queue fills up or one of 
+ * gio_uring_submit, gio_uring_reap, a sync, close or a blocking read 
+ * is called, then everything queued goes in one io_uring_enter, so writing
+ * through a gio_list to many gio_async sinks then submitting is one syscall.
+ * Not thread safe, use one per thread. */
+struct gio_uring {
+  int fd;
+  unsigned sq_entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_sz;
+  size_t cq_map_sz;
+  /* queued but not submitted yet */
+  unsigned queued;
+  /* queued or submitted and not completed yet */
+  unsigned inflight;
+  /* as many as the completion queue holds so it never overflows */
+  struct _gio_async_op *ops;
+  struct _gio_async_op *free_ops;
+  /* registered with gio_uring_register_buffers() */
+  struct iovec *bufs;
+  unsigned nbufs;
+};
+
+enum {
+  /* Link every op to the next one queued on the same ring, so they run 
+   * in order across gios. Chains end at a submission and a failed or 
+   * short op cancels the rest of its chain. */
+  GIO_ASYNC_LINK = 0x1,
+};
+
+struct gio_async {
+  struct gio gio;
+  struct gio_uring *ring;
+  int fd;
+  /* offset of the next op, advanced as they are queued, 
+   * -1 to use (and move) the file position, e.g. for sockets */
+  off_t off;
+  unsigned inflight;
+  /* submission queue index of the last op, streams chain onto it */
+  unsigned last_sq;
+  /* range the positional ops in flight cover, ops overlapping it wait */
+  off_t busy_lo;
+  off_t busy_hi;
+  /* errno of the first failed plain gio_write since the last sync */
+  int err;
+};
+
+KK_GIO_API
+int gio_uring_init(struct gio_uring *ring, unsigned entries);
+
+/* Waits for whatever is still in flight. */
+KK_GIO_API
+void gio_uring_cleanup(struct gio_uring *ring);
+
+/* Registers buffers with the kernel, replacing those registered before. 
+ * Ops on memory within one of them use the fixed buffer variants, 
+ * which skip mapping the pages on every op. */
+KK_GIO_API
+int gio_uring_register_buffers(struct gio_uring *ring, 
+    const struct iovec *iov, unsigned n);
+
+/* Same with buffers of the gio_mems. */
+KK_GIO_API
+int gio_uring_register_mem(struct gio_uring *ring, 
+    struct gio_mem * const *mems, unsigned n);
+
+/* Submits everything queued, returns how many or -1. */
+KK_GIO_API
+int gio_uring_submit(struct gio_uring *ring);
+
+/* Submits everything queued, waits for at least min completions and 
+ * runs the callbacks of all there are. Returns how many completed or -1. */
+KK_GIO_API
+int gio_uring_reap(struct gio_uring *ring, unsigned min);
+
+/* Waits until nothing is in flight. */
+KK_GIO_API
+int gio_uring_drain(struct gio_uring *ring);
+
+/* off as in struct gio_async, flags GIO_ASYNC_*. The fd is closed along 
+ * with the gio. 
+ * Ops of a stream (off -1) always run in the order they were queued, each 
+ * is linked to the one before while that is still queued, otherwise 
+ * queueing waits for the ones in flight. */
+KK_GIO_API
+int gio_async_init(struct gio_async *gio, struct gio_uring *ring, int fd, 
+    off_t off, uint8_t flags);
+
+KK_GIO_API
+struct gio_async gio_async_new(struct gio_uring *ring, int fd, off_t off, 
+    uint8_t flags);
+
+/* Queue a write or read of buf, which must stay valid until cb is called 
+ * from gio_uring_reap(). cb may be NULL. Return 0 or -1.
+ *
+ * Plain gio_write on a gio_async copies buf and queues it, returning 
+ * right away, errors surface on the next sync. gio_read blocks. */
+KK_GIO_API
+int gio_write_async(struct gio_async *gio, const void *buf, size_t sz, 
+    gio_async_proc *cb, void *user);
+
+KK_GIO_API
+int gio_read_async(struct gio_async *gio, void *buf, size_t sz, 
+    gio_async_proc *cb, void *user);
+
+#endif /* KK_GIO_HAS_URING */
+
 /* generic api */
 
 KK_GIO_API
@@ -229,9 +481,32 @@ ssize_t gio_write(gio_t *_gio, const void *buf, size_t sz);
 KK_GIO_API
 ssize_t gio_read(gio_t *_gio, void *buf, size_t sz);
 
+/* Scatter/gather versions, a single writev/readv on fds, a single grow on 
+ * autogrowing gio_mem. Return the total number of bytes moved or -1. */
+KK_GIO_API
+ssize_t gio_writev(gio_t *_gio, const struct iovec *iov, int iovcnt);
+
+KK_GIO_API
+ssize_t gio_readv(gio_t *_gio, const struct iovec *iov, int iovcnt);
+
 KK_GIO_API
 off_t gio_seek(gio_t *_gio, off_t off, int whence);
 
+/* Zero-copy gio_read for gios backed by memory (GIO_MEM and GIO_MMAP). 
+ * Returns pointer to the current position and advances it by *len, 
+ * which is up to max bytes. The pointer stays valid until the gio is 
+ * closed (or a GIO_MEM grows). Other types return NULL with *len = 0, 
+ * so do a NULL at the end of data. To peek, seek back by *len. */
+KK_GIO_API
+const void *gio_borrow(gio_t *_gio, size_t max, size_t *len);
+
+/* Moves everything from src's current position until its end to dst, 
+ * returns how many bytes were moved or -1 on error. Between two file 
+ * descriptors data stays in the kernel (copy_file_range, sendfile or 
+ * splice, whichever the pair supports), when either end is a gio_mem its
+ * buffer is written from or read into directly, anything else goes 
+ * through a KK_GIO_PIPE_BUFSZ bounce buffer. A gio_mem that can't grow 
+ * stops the pipe once full. */
 KK_GIO_API
 off_t gio_pipe(gio_t *src, gio_t *dst);
 
@@ -241,11 +516,18 @@ off_t gio_pipe(gio_t *src, gio_t *dst);
 /* NOTE:
  * You know how you can only call v*print family of functions once as the 
  * va_list passed is undefined after a call? Well, now you know. 
- * This is unfortunate if you need to buffer the output and need to first 
- * query for the buffer size with vsprintf. Because of that you cannot have 
- * multiple wrapper functions around printf.
+ * We va_copy the list for a second pass, which only happens when the output
+ * didn't fit the space we formatted into the first time (what is left of a
+ * gio_mem or of a buffered fd's write buffer, or KK_GIO_PRINTF_BUFSZ bytes 
+ * on the stack), so there is gio_vnprintf for wrappers.
+ *
+ * Writes at most maxn characters (for gio_mem that includes the null 
+ * terminator), returns how many, not counting the terminator, or -1.
  */
 
+KK_GIO_API
+int gio_vnprintf(gio_t *_gio, size_t maxn, const char *fmt, va_list args);
+
 KK_GIO_API
 int gio_nprintf(gio_t *_gio, size_t maxn, const char *fmt, ...);
 
@@ -279,6 +561,48 @@ int gio_close(gio_t *_gio)
   return gio_ctl(_gio, GIO_CTL_CLOSE, NULL);
 }
 
+/* Define KK_GIO_STATS to have every thread count its reads, writes, 
+ * system calls and errors per gio type. Unlike KK_GIO_ENABLE_TRACING it 
+ * costs a couple of increments per call. Writes to a list count for the 
+ * list as GIO_OPS and again for every gio on it, the GIO_LIST_ASYNC 
+ * workers count in their own threads. If you define 
+ * KK_GIO_STATS_HOOK(GIO, EV, VAL) as well it is called on every read and 
+ * write with VAL the bytes moved, and on errors with VAL the errno. */
+#ifdef KK_GIO_STATS
+
+enum {
+  GIO_EV_WRITE,
+  GIO_EV_READ,
+  GIO_EV_ERROR,
+};
+
+#define _GIO_NTYPES (GIO_ASYNC + 1)
+
+struct gio_stats {
+  /* gio_write, gio_writev and gio_nprintf calls that succeeded */
+  size_t writes;
+  size_t wbytes;
+  /* gio_read and gio_readv */
+  size_t reads;
+  size_t rbytes;
+  /* system calls made for gios of the type, buffering shows up here */
+  size_t syscalls;
+  size_t errors;
+};
+
+/* counters of the calling thread for gios of type (GIO_FILE, GIO_MEM...) */
+KK_GIO_API
+struct gio_stats *gio_stats(int type);
+
+KK_GIO_API
+void gio_stats_reset(void);
+
+/* one line per type that saw any use */
+KK_GIO_API
+int gio_stats_dump(gio_t *out);
+
+#endif /* KK_GIO_STATS */
+
 
 
 #endif /* _KK_GIO_H_ */
@@ -293,6 +617,94 @@ int gio_close(gio_t *_gio)
 
 #ifdef KK_GIO_IMPL
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+#endif
+
+#ifdef KK_GIO_STATS
+
+# ifndef KK_GIO_STATS_HOOK
+#  define KK_GIO_STATS_HOOK(GIO, EV, VAL) ((void)0)
+# endif
+
+static _Thread_local struct gio_stats _gio_stats[_GIO_NTYPES];
+
+/* counts CALL as a system call made for a gio of TYPE */
+# define _GIO_SYS(TYPE, CALL) (_gio_stats[(TYPE)].syscalls++, (CALL))
+
+static inline
+void _gio_stat_io(const void *_gio, int ev, ssize_t ret)
+{
+  struct gio_stats *st;
+  
+  if(!_gio)
+    return;
+
+  st = &_gio_stats[((const struct gio*)_gio)->type];
+  if(ret < 0) {
+    st->errors++;
+    KK_GIO_STATS_HOOK(_gio, GIO_EV_ERROR, errno);
+    return;
+  }
+
+  if(ev == GIO_EV_WRITE) {
+    st->writes++;
+    st->wbytes += ret;
+  } else {
+    st->reads++;
+    st->rbytes += ret;
+  }
+  KK_GIO_STATS_HOOK(_gio, ev, ret);
+}
+
+KK_GIO_API
+struct gio_stats *gio_stats(int type)
+{
+  return type >= 0 && type < _GIO_NTYPES ? &_gio_stats[type] : NULL;
+}
+
+KK_GIO_API
+void gio_stats_reset(void)
+{
+  memset(_gio_stats, 0, sizeof(_gio_stats));
+}
+
+KK_GIO_API
+int gio_stats_dump(gio_t *out)
+{
+  static const char *names[_GIO_NTYPES] = {
+    [GIO_INVALID] = "invalid", [GIO_FILE] = "file", [GIO_MEM] = "mem", 
+    [GIO_OPS] = "ops", [GIO_MMAP] = "mmap", [GIO_ASYNC] = "async",
+  };
+  /* writing the dump counts as well, don't let it show in the dump */
+  struct gio_stats snap[_GIO_NTYPES];
+  int ret = 0;
+
+  memcpy(snap, _gio_stats, sizeof(snap));
+  for(int i = 0; i < _GIO_NTYPES; ++i) {
+    const struct gio_stats *st = &snap[i];
+
+    if(!st->writes && !st->reads && !st->syscalls && !st->errors)
+      continue;
+
+    if(gio_nprintf(out, 256, "gio %s: %zu writes (%zu bytes), "
+          "%zu reads (%zu bytes), %zu syscalls, %zu errors\n", names[i], 
+          st->writes, st->wbytes, st->reads, st->rbytes, 
+          st->syscalls, st->errors) < 0)
+      ret = -1;
+  }
+  return ret;
+}
+
+#else
+# define _GIO_SYS(TYPE, CALL) (CALL)
+# define _gio_stat_io(GIO, EV, RET) ((void)0)
+#endif /* KK_GIO_STATS */
+
 static inline void * _gio_xalloc(void *ptr, size_t sz)
 {
   void * ret = KK_GIO_XALLOC(ptr, sz);
@@ -342,6 +754,22 @@ struct gio_mem gio_mem_new_alloc(size_t sz)
   return ret;
 }
 
+KK_GIO_API
+struct gio_mem gio_mem_new_arena(struct arena *arena, size_t sz)
+{
+  struct gio_mem ret = gio_mem_new(NULL, 0, GIO_MEM_AUTOGROW);
+  ret.arena = arena;
+  if(sz && (ret.buf = arena_realloc(arena, NULL, sz)))
+    ret.sz = sz;
+  return ret;
+}
+
+static inline 
+void *_gio_mem_xalloc(struct gio_mem *gio, void *ptr, size_t sz)
+{
+  return gio->arena ? arena_realloc(gio->arena, ptr, sz) : _gio_xalloc(ptr, sz);
+}
+
 /* file pointer api */
 
 KK_GIO_API
@@ -377,7 +805,7 @@ int gio_file_init_fd(struct gio_file *gio, int fd)
   if(gio_alive(&gio->gio))
     return -1;
 
-  if(fcntl(fd, F_GETFD) == -1 || errno == EBADF)
+  if(fcntl(fd, F_GETFD) == -1)
     return -1;
 
   memset(gio, 0, sizeof(*gio));
@@ -396,119 +824,1160 @@ struct gio_file gio_file_new_fd(int fd)
   return gio_file;
 }
 
-/* generic api */
+KK_GIO_API
+int gio_file_init_fd_buf(struct gio_file *gio, int fd, size_t wsz, size_t rsz)
+{
+  if(gio_file_init_fd(gio, fd))
+    return -1;
 
-size_t _gio_mem_left(struct gio_mem *gio) 
+  if(wsz && !(gio->wbuf = _gio_xalloc(NULL, wsz)))
+    goto fail;
+  gio->wcap = wsz;
+
+  if(rsz && !(gio->rbuf = _gio_xalloc(NULL, rsz)))
+    goto fail;
+  gio->rcap = rsz;
+  return 0;
+
+fail:
+  _gio_xalloc(gio->wbuf, 0);
+  memset(gio, 0, sizeof(*gio));
+  return -1;
+}
+
+KK_GIO_API
+struct gio_file gio_file_new_fd_buf(int fd, size_t wsz, size_t rsz)
 {
-  KK_GIO_ASSERT(gio->sz >= gio->off);
-  return gio->sz - gio->off;
+  struct gio_file gio_file = {};
+  int rc = gio_file_init_fd_buf(&gio_file, fd, wsz, rsz);
+  assert(rc == 0);
+  return gio_file;
 }
 
-int _gio_mem_maybe_grow(struct gio_mem *gio, size_t sz)
+/* Writes all of buf unless write(2) fails, returns how much got written. */
+static
+size_t _gio_fd_write_all(int fd, const void *buf, size_t sz)
 {
-  if(gio->gio.flags & GIO_MEM_ALLOC && gio->gio.flags & GIO_MEM_AUTOGROW) {
-    if(sz > _gio_mem_left(gio)) {
-      size_t new_sz = GIO_MAX(gio->sz * 2, gio->sz + sz);
-      void *new_buf = _gio_xalloc(gio->buf, new_sz);
-      if(!new_buf)
-        return -1;
+  size_t done = 0;
 
-      gio->buf = new_buf;
-      gio->sz = new_sz;
+  while(done < sz) {
+    ssize_t rc = _GIO_SYS(GIO_FILE, write(fd, (const uint8_t*)buf + done, sz - done));
+    if(rc < 0) {
+      if(errno == EINTR) continue;
+      break;
     }
+    done += rc;
+  }
+  return done;
+}
+
+/* Writes out the write buffer, whatever couldn't be written stays in it. */
+static
+int _gio_file_drain(struct gio_file *gio)
+{
+  size_t done;
+
+  if(!gio->wlen)
+    return 0;
+
+  done = _gio_fd_write_all(gio->fd, gio->wbuf, gio->wlen);
+  if(done < gio->wlen) {
+    memmove(gio->wbuf, gio->wbuf + done, gio->wlen - done);
+    gio->wlen -= done;
+    return -1;
   }
+  gio->wlen = 0;
   return 0;
 }
 
+/* After a buffered read the fd is past the logical position by whatever 
+ * is left in the read-ahead, before writing move it back and drop the 
+ * read-ahead. Pipes and sockets read and write separate streams, 
+ * their read-ahead stays. */
+static
+int _gio_file_drop_ahead(struct gio_file *gio)
+{
+  off_t ahead = gio->rlen - gio->roff;
 
-KK_GIO_API
-ssize_t gio_write(gio_t *_gio, const void *buf, size_t sz)
+  if(!ahead)
+    return 0;
+
+  if(_GIO_SYS(GIO_FILE, lseek(gio->fd, -ahead, SEEK_CUR)) < 0)
+    return errno == ESPIPE ? 0 : -1;
+
+  gio->roff = gio->rlen = 0;
+  return 0;
+}
+
+static
+ssize_t _gio_file_write_buf(struct gio_file *gio, const void *buf, size_t sz)
 {
-  ssize_t ret = -1;
+  if(sz > gio->wcap - gio->wlen && _gio_file_drain(gio))
+    return -1;
 
-  if(!_gio)
-    goto out;
+  /* too big to be worth copying, goes straight through */
+  if(sz >= gio->wcap) {
+    size_t done = _gio_fd_write_all(gio->fd, buf, sz);
+    return done ? (ssize_t)done : -1;
+  }
 
-  switch(((struct gio*)_gio)->type) {
-  case GIO_MEM: {
-    struct gio_mem *gio = (struct gio_mem*)_gio;
+  memcpy(gio->wbuf + gio->wlen, buf, sz);
+  gio->wlen += sz;
+  return sz;
+}
 
-    if(_gio_mem_maybe_grow(gio, sz))
-      goto out;
+static
+ssize_t _gio_file_read_buf(struct gio_file *gio, void *buf, size_t sz)
+{
+  ssize_t rc;
 
-    assert(gio->sz >= gio->off);
-    sz = GIO_MIN(sz, gio->sz - gio->off);
-    /* TODO: handle case when the buffer written from is already part of the buffer
-     * written to, i.e. memmove */
-    memcpy(gio->buf + gio->off, buf, sz);
-    gio->off += sz;
-    ret = sz;
-  } break;
+  /* the fd may be open for both, pending writes go first */
+  if(_gio_file_drain(gio))
+    return -1;
 
-  case GIO_FILE: {
-    struct gio_file *gio = (struct gio_file*)_gio;
-    if(gio->fp)
-      ret = fwrite(buf, 1, sz, gio->fp);
-    else
-      ret = write(gio->fd, buf, sz);
-  } break;
+  if(gio->roff == gio->rlen) {
+    gio->roff = gio->rlen = 0;
 
-  case GIO_OPS: {
-    struct gio_ops *gio = (struct gio_ops*)_gio;
-    if(gio->write) 
-      ret = gio->write(gio, buf, sz);
-  } break;
+    if(sz >= gio->rcap) {
+      while((rc = _GIO_SYS(GIO_FILE, read(gio->fd, buf, sz))) < 0 && errno == EINTR)
+        ;
+      return rc;
+    }
 
-  defualt:
-    KK_GIO_UNREACHABLE();
+    while((rc = _GIO_SYS(GIO_FILE, read(gio->fd, gio->rbuf, gio->rcap))) < 0 && 
+        errno == EINTR)
+      ;
+    if(rc <= 0)
+      return rc;
+    gio->rlen = rc;
   }
-out:
-#ifdef KK_GIO_ENABLE_TRACING
-  fprintf(stderr,
-      "%s(): gio=%p { .type=%d }, buf=%p, sz=%zu = %zd\n", 
-      __func__, _gio, ((struct gio*)_gio)->type, buf, sz, ret);
-  fflush(stderr);
-#endif
-  return ret;
+
+  sz = GIO_MIN(sz, gio->rlen - gio->roff);
+  memcpy(buf, gio->rbuf + gio->roff, sz);
+  gio->roff += sz;
+  return sz;
+}
+
+/* Before seeking, writes out pending writes, returns by how much the fd 
+ * position is ahead of the logical one. The read-ahead is only dropped 
+ * once the seek went through, a failed one leaves it as it was. */
+static
+int _gio_file_unbuffer(struct gio_file *gio, off_t *ahead)
+{
+  *ahead = gio->rlen - gio->roff;
+  return _gio_file_drain(gio);
 }
 
+/* memory mapped file api */
+
+_Static_assert(offsetof(struct gio_mmap, buf) == offsetof(struct gio_mem, buf) &&
+    offsetof(struct gio_mmap, sz) == offsetof(struct gio_mem, sz) &&
+    offsetof(struct gio_mmap, off) == offsetof(struct gio_mem, off),
+    "gio_mmap is read through the gio_mem paths");
 
 KK_GIO_API
-ssize_t gio_read(gio_t *_gio, void *buf, size_t sz)
+int gio_mmap_advise(struct gio_mmap *gio, uint8_t flags)
 {
-  ssize_t ret = -1;
+  int rc = 0;
 
-  switch(((struct gio*)_gio)->type) {
-  case GIO_MEM: {
-    struct gio_mem *gio = (struct gio_mem*)_gio;
-    assert(gio->sz >= gio->off);
-    sz = GIO_MIN(sz, gio->sz - gio->off);
-    memcpy(buf, gio->buf + gio->off, sz);
-    gio->off += sz;
-  } break;
+  if(!gio->sz)
+    return 0;
 
-  case GIO_FILE: {
-    struct gio_file *gio = (struct gio_file*)_gio;
-    if(gio->fp)
-      ret = fread(buf, 1, sz, gio->fp);
-    else
-      ret = read(gio->fd, buf, sz);
-  } break;
+  if(flags & GIO_MMAP_SEQUENTIAL)
+    rc |= posix_madvise(gio->buf, gio->sz, POSIX_MADV_SEQUENTIAL);
+  else if(flags & GIO_MMAP_RANDOM)
+    rc |= posix_madvise(gio->buf, gio->sz, POSIX_MADV_RANDOM);
+  else
+    rc |= posix_madvise(gio->buf, gio->sz, POSIX_MADV_NORMAL);
+
+  if(flags & GIO_MMAP_WILLNEED)
+    rc |= posix_madvise(gio->buf, gio->sz, POSIX_MADV_WILLNEED);
+
+  return rc ? -1 : 0;
+}
+
+KK_GIO_API
+int gio_mmap_init_fd(struct gio_mmap *gio, int fd, uint8_t flags)
+{
+  struct stat st;
+  int mflags = MAP_PRIVATE;
+  void *buf = NULL;
+
+  if(gio_alive(&gio->gio))
+    return -1;
+
+  /* pipes, sockets and the like have no size to map */
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode) || 
+      st.st_size < 0 || (uint64_t)st.st_size > SIZE_MAX)
+    return -1;
+
+#ifdef MAP_POPULATE
+  if(flags & GIO_MMAP_POPULATE)
+    mflags |= MAP_POPULATE;
+#endif
+
+  /* mmap refuses empty mappings, an empty file is just an empty buffer */
+  if(st.st_size && 
+      (buf = _GIO_SYS(GIO_MMAP, mmap(NULL, st.st_size, PROT_READ, mflags, fd, 0)))
+        == MAP_FAILED)
+    return -1;
+
+  memset(gio, 0, sizeof(*gio));
+  gio->gio.type = GIO_MMAP;
+  gio->gio.flags = flags;
+  gio->buf = buf;
+  gio->sz = st.st_size;
+
+  /* only hints, failing them is no reason to fail */
+  gio_mmap_advise(gio, flags);
+  return 0;
+}
+
+KK_GIO_API
+struct gio_mmap gio_mmap_new_fd(int fd, uint8_t flags)
+{
+  struct gio_mmap gio_mmap = {};
+  int rc = gio_mmap_init_fd(&gio_mmap, fd, flags);
+  assert(rc == 0);
+  return gio_mmap;
+}
+
+KK_GIO_API
+int gio_mmap_init_open(struct gio_mmap *gio, const char *filepath, uint8_t flags)
+{
+  int rc, fd;
+
+  if((fd = open(filepath, O_RDONLY)) < 0)
+    return -1;
+
+  rc = gio_mmap_init_fd(gio, fd, flags);
+  close(fd);
+  return rc;
+}
+
+KK_GIO_API
+struct gio_mmap gio_mmap_new_open(const char *filepath, uint8_t flags)
+{
+  struct gio_mmap gio_mmap = {};
+  int rc = gio_mmap_init_open(&gio_mmap, filepath, flags);
+  assert(rc == 0);
+  return gio_mmap;
+}
+
+/* asynchronous api */
+
+#ifdef KK_GIO_HAS_URING
+
+static inline
+int _gio_uring_enter(struct gio_uring *ring, unsigned submit, unsigned min)
+{
+  return _GIO_SYS(GIO_ASYNC, syscall(__NR_io_uring_enter, ring->fd, submit, 
+        min, min ? IORING_ENTER_GETEVENTS : 0, NULL, 0));
+}
+
+KK_GIO_API
+int gio_uring_init(struct gio_uring *ring, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+
+  if((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return -1;
+
+  ring->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_map_sz = ring->cq_map_sz = GIO_MAX(ring->sq_map_sz, ring->cq_map_sz);
+
+  ring->sq_map = mmap(NULL, ring->sq_map_sz, PROT_READ | PROT_WRITE, 
+      MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+  if(ring->sq_map == MAP_FAILED)
+    goto fail;
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_sz, PROT_READ | PROT_WRITE, 
+        MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    if(ring->cq_map == MAP_FAILED)
+      goto fail;
+  }
+
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), 
+      PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+  if(ring->sqes == MAP_FAILED)
+    goto fail;
+
+  ring->sq_entries = p.sq_entries;
+  ring->sq_head = (unsigned*)((uint8_t*)ring->sq_map + p.sq_off.head);
+  ring->sq_tail = (unsigned*)((uint8_t*)ring->sq_map + p.sq_off.tail);
+  ring->sq_mask = *(unsigned*)((uint8_t*)ring->sq_map + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)((uint8_t*)ring->sq_map + p.sq_off.array);
+  ring->cq_head = (unsigned*)((uint8_t*)ring->cq_map + p.cq_off.head);
+  ring->cq_tail = (unsigned*)((uint8_t*)ring->cq_map + p.cq_off.tail);
+  ring->cq_mask = *(unsigned*)((uint8_t*)ring->cq_map + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)((uint8_t*)ring->cq_map + p.cq_off.cqes);
+
+  if(!(ring->ops = _gio_xalloc(NULL, p.cq_entries * sizeof(*ring->ops))))
+    goto fail;
+
+  for(unsigned i = 0; i < p.cq_entries; ++i)
+    ring->ops[i].next_free = i + 1 < p.cq_entries ? &ring->ops[i + 1] : NULL;
+  ring->free_ops = ring->ops;
+  return 0;
+
+fail:
+  gio_uring_cleanup(ring);
+  return -1;
+}
+
+KK_GIO_API
+void gio_uring_cleanup(struct gio_uring *ring)
+{
+  if(ring->fd < 0) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    return;
+  }
+
+  if(ring->ops)
+    gio_uring_drain(ring);
+
+  if(ring->sqes != MAP_FAILED && ring->sqes)
+    munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+  if(ring->cq_map != MAP_FAILED && ring->cq_map && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_sz);
+  if(ring->sq_map != MAP_FAILED && ring->sq_map)
+    munmap(ring->sq_map, ring->sq_map_sz);
+
+  close(ring->fd);
+  _gio_xalloc(ring->ops, 0);
+  _gio_xalloc(ring->bufs, 0);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+KK_GIO_API
+int gio_uring_register_buffers(struct gio_uring *ring, 
+    const struct iovec *iov, unsigned n)
+{
+  struct iovec *bufs = NULL;
+
+  if(ring->nbufs) {
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0))
+      return -1;
+    _gio_xalloc(ring->bufs, 0);
+    ring->bufs = NULL;
+    ring->nbufs = 0;
+  }
+
+  if(!n)
+    return 0;
+
+  if(!(bufs = _gio_xalloc(NULL, n * sizeof(*bufs))))
+    return -1;
+  memcpy(bufs, iov, n * sizeof(*bufs));
+
+  if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, bufs, n)) {
+    _gio_xalloc(bufs, 0);
+    return -1;
+  }
+  ring->bufs = bufs;
+  ring->nbufs = n;
+  return 0;
+}
+
+KK_GIO_API
+int gio_uring_register_mem(struct gio_uring *ring, 
+    struct gio_mem * const *mems, unsigned n)
+{
+  int ret;
+  struct iovec *iov;
+
+  if(!n)
+    return gio_uring_register_buffers(ring, NULL, 0);
+
+  if(!(iov = _gio_xalloc(NULL, n * sizeof(*iov))))
+    return -1;
+
+  for(unsigned i = 0; i < n; ++i) {
+    iov[i].iov_base = mems[i]->buf;
+    iov[i].iov_len = mems[i]->sz;
+  }
+  ret = gio_uring_register_buffers(ring, iov, n);
+  _gio_xalloc(iov, 0);
+  return ret;
+}
+
+/* Runs the completions that are there. */
+static
+int _gio_uring_complete(struct gio_uring *ring)
+{
+  int n = 0;
+  unsigned head = *ring->cq_head;
+
+  while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    struct _gio_async_op *op = (struct _gio_async_op*)(uintptr_t)cqe->user_data;
+    ssize_t res = cqe->res;
+
+    /* hand the slot back first, the callback may queue more */
+    __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+    op->gio->inflight--;
+    ring->inflight--;
+    if(op->owned && (res < 0 || (size_t)res < op->len) && !op->gio->err)
+      op->gio->err = res < 0 ? -res : EIO;
+
+    if(op->wait_done) {
+      *op->wait_res = res;
+      *op->wait_done = true;
+    }
+    _gio_xalloc(op->owned, 0);
+    if(op->cb)
+      op->cb(op->gio, res, op->user);
+
+    op->next_free = ring->free_ops;
+    ring->free_ops = op;
+    ++n;
+  }
+  return n;
+}
+
+KK_GIO_API
+int gio_uring_reap(struct gio_uring *ring, unsigned min)
+{
+  int rc;
+
+  if(min > ring->inflight)
+    min = ring->inflight;
+
+  if(ring->queued || min) {
+    while((rc = _gio_uring_enter(ring, ring->queued, min)) < 0 && errno == EINTR)
+      ;
+    if(rc < 0 && errno != EAGAIN && errno != EBUSY)
+      return -1;
+    if(rc > 0)
+      ring->queued -= rc;
+  }
+  return _gio_uring_complete(ring);
+}
+
+KK_GIO_API
+int gio_uring_submit(struct gio_uring *ring)
+{
+  int rc;
+
+  if(!ring->queued)
+    return 0;
+
+  while((rc = _gio_uring_enter(ring, ring->queued, 0)) < 0 && errno == EINTR)
+    ;
+  if(rc < 0)
+    return -1;
+
+  ring->queued -= rc;
+  return rc;
+}
+
+KK_GIO_API
+int gio_uring_drain(struct gio_uring *ring)
+{
+  while(ring->inflight) {
+    if(gio_uring_reap(ring, 1) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* Takes an op and a submission slot, reaping and submitting what's needed 
+ * to free them up. */
+static
+struct io_uring_sqe *_gio_uring_sqe(struct gio_uring *ring, struct _gio_async_op **op)
+{
+  /* callbacks run while reaping may queue ops of their own, 
+   * so check both again after every round */
+  for(;;) {
+    if(!ring->free_ops) {
+      if(gio_uring_reap(ring, 1) < 0)
+        return NULL;
+    } else if(*ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) 
+        >= ring->sq_entries) {
+      if(gio_uring_reap(ring, 0) < 0)
+        return NULL;
+    } else {
+      break;
+    }
+  }
+
+  *op = ring->free_ops;
+  ring->free_ops = (*op)->next_free;
+  memset(*op, 0, sizeof(**op));
+  return &ring->sqes[*ring->sq_tail & ring->sq_mask];
+}
+
+static
+void _gio_uring_push(struct gio_uring *ring)
+{
+  unsigned tail = *ring->sq_tail;
+
+  ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+  ring->inflight++;
+}
+
+/* index of the registered buffer holding [buf, buf + sz) or -1 */
+static
+int _gio_uring_fixed(struct gio_uring *ring, const void *buf, size_t sz)
+{
+  for(unsigned i = 0; i < ring->nbufs; ++i) {
+    const uint8_t *b = ring->bufs[i].iov_base;
+    if(b <= (const uint8_t*)buf && 
+        (const uint8_t*)buf + sz <= b + ring->bufs[i].iov_len)
+      return i;
+  }
+  return -1;
+}
+
+/* Whether the last op of a stream is still queued right before the next 
+ * free slot, so the next one can be linked onto it. */
+static inline
+bool _gio_async_chains(struct gio_async *gio)
+{
+  struct gio_uring *ring = gio->ring;
+  return ring->queued && gio->last_sq == *ring->sq_tail - 1;
+}
+
+/* Waits for the ops of gio in flight, errors stay in gio->err. */
+static
+int _gio_async_idle(struct gio_async *gio)
+{
+  while(gio->inflight) {
+    if(gio_uring_reap(gio->ring, 1) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static
+struct _gio_async_op *_gio_async_queue(struct gio_async *gio, bool write, 
+    const void *buf, size_t sz, gio_async_proc *cb, void *user)
+{
+  struct _gio_async_op *op;
+  struct io_uring_sqe *sqe;
+  bool link = false;
+  int fixed;
+
+  /* as a single write(2) would, anything past this comes back short */
+  sz = GIO_MIN(sz, (size_t)0x7ffff000);
+
+  /* ops at offsets aren't ordered, one touching what's still in flight, 
+   * e.g. a read back after a seek, waits for it to land */
+  if(gio->off >= 0 && gio->inflight && gio->off < gio->busy_hi && 
+      gio->off + (off_t)sz > gio->busy_lo && _gio_async_idle(gio))
+    return NULL;
+
+  for(;;) {
+    if(!(sqe = _gio_uring_sqe(gio->ring, &op)))
+      return NULL;
+    if(gio->off >= 0 || !gio->inflight)
+      break;
+    /* stream ops that can't be linked wait for the ones before, 
+     * the file position gives no order otherwise */
+    if((link = _gio_async_chains(gio)))
+      break;
+    op->next_free = gio->ring->free_ops;
+    gio->ring->free_ops = op;
+    while(gio->inflight) {
+      if(gio_uring_reap(gio->ring, 1) < 0)
+        return NULL;
+    }
+  }
+  if(link)
+    gio->ring->sqes[gio->last_sq & gio->ring->sq_mask].flags |= IOSQE_IO_LINK;
+
+  fixed = _gio_uring_fixed(gio->ring, buf, sz);
+
+  memset(sqe, 0, sizeof(*sqe));
+  if(fixed >= 0) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = fixed;
+  } else {
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+  sqe->fd = gio->fd;
+  sqe->off = gio->off < 0 ? (uint64_t)-1 : (uint64_t)gio->off;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = sz;
+  sqe->user_data = (uintptr_t)op;
+  if(gio->gio.flags & GIO_ASYNC_LINK)
+    sqe->flags |= IOSQE_IO_LINK;
+
+  op->gio = gio;
+  op->cb = cb;
+  op->user = user;
+  op->len = sz;
+
+  if(gio->off >= 0) {
+    if(!gio->inflight) {
+      gio->busy_lo = gio->off;
+      gio->busy_hi = gio->off + (off_t)sz;
+    } else {
+      gio->busy_lo = GIO_MIN(gio->busy_lo, gio->off);
+      gio->busy_hi = GIO_MAX(gio->busy_hi, gio->off + (off_t)sz);
+    }
+    gio->off += sz;
+  }
+  gio->inflight++;
+  gio->last_sq = *gio->ring->sq_tail;
+  _gio_uring_push(gio->ring);
+  return op;
+}
+
+KK_GIO_API
+int gio_async_init(struct gio_async *gio, struct gio_uring *ring, int fd, 
+    off_t off, uint8_t flags)
+{
+  if(gio_alive(&gio->gio))
+    return -1;
+
+  if(!ring || fcntl(fd, F_GETFD) == -1)
+    return -1;
+
+  memset(gio, 0, sizeof(*gio));
+  gio->gio.type = GIO_ASYNC;
+  gio->gio.flags = flags;
+  gio->ring = ring;
+  gio->fd = fd;
+  gio->off = off < 0 ? -1 : off;
+  return 0;
+}
+
+KK_GIO_API
+struct gio_async gio_async_new(struct gio_uring *ring, int fd, off_t off, 
+    uint8_t flags)
+{
+  struct gio_async gio_async = {};
+  int rc = gio_async_init(&gio_async, ring, fd, off, flags);
+  assert(rc == 0);
+  return gio_async;
+}
+
+KK_GIO_API
+int gio_write_async(struct gio_async *gio, const void *buf, size_t sz, 
+    gio_async_proc *cb, void *user)
+{
+  return _gio_async_queue(gio, true, buf, sz, cb, user) ? 0 : -1;
+}
+
+KK_GIO_API
+int gio_read_async(struct gio_async *gio, void *buf, size_t sz, 
+    gio_async_proc *cb, void *user)
+{
+  return _gio_async_queue(gio, false, buf, sz, cb, user) ? 0 : -1;
+}
+
+/* plain gio_write, write-behind from a copy */
+static
+ssize_t _gio_async_write(struct gio_async *gio, const void *buf, size_t sz)
+{
+  struct _gio_async_op *op;
+  void *copy;
+
+  if(!sz)
+    return 0;
+
+  sz = GIO_MIN(sz, (size_t)0x7ffff000);
+  if(!(copy = _gio_xalloc(NULL, sz)))
+    return -1;
+  memcpy(copy, buf, sz);
+
+  if(!(op = _gio_async_queue(gio, true, copy, sz, NULL, NULL))) {
+    _gio_xalloc(copy, 0);
+    return -1;
+  }
+  op->owned = copy;
+  return sz;
+}
+
+/* plain gio_read, blocks until done */
+static
+ssize_t _gio_async_read(struct gio_async *gio, void *buf, size_t sz)
+{
+  struct _gio_async_op *op;
+  ssize_t res = -1;
+  bool done = false;
+  off_t start = gio->off;
+  size_t len;
+
+  if(!(op = _gio_async_queue(gio, false, buf, sz, NULL, NULL)))
+    return -1;
+  len = op->len;
+  op->wait_res = &res;
+  op->wait_done = &done;
+
+  while(!done) {
+    if(gio_uring_reap(gio->ring, 1) < 0) {
+      /* still in flight, don't let its completion write to this frame */
+      op->wait_res = NULL;
+      op->wait_done = NULL;
+      return -1;
+    }
+  }
+
+  if(res < 0) {
+    errno = -res;
+    return -1;
+  }
+  /* the offset moved by the full request, take back what wasn't read
+   * unless more got queued meanwhile */
+  if(start >= 0 && gio->off == start + (off_t)len)
+    gio->off = start + res;
+  return res;
+}
+
+static
+int _gio_async_wait(struct gio_async *gio)
+{
+  int err;
+
+  if(_gio_async_idle(gio))
+    return -1;
+
+  if((err = gio->err)) {
+    gio->err = 0;
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static
+off_t _gio_async_seek(struct gio_async *gio, off_t off, int whence)
+{
+  struct stat st;
+
+  if(gio->off < 0)
+    return _GIO_SYS(GIO_ASYNC, lseek(gio->fd, off, whence));
+
+  switch(whence) {
+  case SEEK_SET: 
+    break;
+  case SEEK_CUR: 
+    off += gio->off; 
+    break;
+  case SEEK_END: 
+    /* what's queued may not have landed yet */
+    if(_gio_async_idle(gio) || fstat(gio->fd, &st))
+      return -1;
+    off += st.st_size;
+    break;
+  default:
+    return -1;
+  }
+
+  if(off < 0)
+    return -1;
+  return gio->off = off;
+}
+
+static
+int _gio_async_ctl(struct gio_async *gio, int op)
+{
+  int ret = -1;
+
+  switch(op) {
+  case GIO_CTL_SYNC:
+    ret = _gio_async_wait(gio);
+    /* as GIO_FILE does, but pipes and sockets have nothing to sync */
+    if(!ret && _GIO_SYS(GIO_ASYNC, fsync(gio->fd)) && errno != EINVAL)
+      ret = -1;
+    break;
+
+  case GIO_CTL_CLOSE: 
+    ret = _gio_async_wait(gio);
+    if(_GIO_SYS(GIO_ASYNC, close(gio->fd)))
+      ret = -1;
+    break;
+  }
+  return ret;
+}
+
+#endif /* KK_GIO_HAS_URING */
+
+/* generic api */
+
+size_t _gio_mem_left(struct gio_mem *gio) 
+{
+  KK_GIO_ASSERT(gio->sz >= gio->off);
+  return gio->sz - gio->off;
+}
+
+int _gio_mem_maybe_grow(struct gio_mem *gio, size_t sz)
+{
+  if(gio->gio.flags & GIO_MEM_ALLOC && gio->gio.flags & GIO_MEM_AUTOGROW) {
+    if(sz > _gio_mem_left(gio)) {
+      size_t new_sz = GIO_MAX(gio->sz * 2, gio->sz + sz);
+      void *new_buf = _gio_mem_xalloc(gio, gio->buf, new_sz);
+      if(!new_buf)
+        return -1;
+
+      gio->buf = new_buf;
+      gio->sz = new_sz;
+    }
+  }
+  return 0;
+}
+
+
+KK_GIO_API
+ssize_t gio_write(gio_t *_gio, const void *buf, size_t sz)
+{
+  ssize_t ret = -1;
+
+  if(!_gio)
+    goto out;
+
+  switch(((struct gio*)_gio)->type) {
+  case GIO_MEM: {
+    struct gio_mem *gio = (struct gio_mem*)_gio;
+
+    if(_gio_mem_maybe_grow(gio, sz))
+      goto out;
+
+    assert(gio->sz >= gio->off);
+    sz = GIO_MIN(sz, gio->sz - gio->off);
+    /* TODO: handle case when the buffer written from is already part of the buffer
+     * written to, i.e. memmove */
+    memcpy(gio->buf + gio->off, buf, sz);
+    gio->off += sz;
+    ret = sz;
+  } break;
+
+  case GIO_MMAP:
+    /* read only */
+    break;
+
+  case GIO_FILE: {
+    struct gio_file *gio = (struct gio_file*)_gio;
+    if(gio->fp)
+      ret = fwrite(buf, 1, sz, gio->fp);
+    else if(_gio_file_drop_ahead(gio))
+      break;
+    else if(gio->wbuf)
+      ret = _gio_file_write_buf(gio, buf, sz);
+    else
+      ret = _GIO_SYS(GIO_FILE, write(gio->fd, buf, sz));
+  } break;
+
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    ret = _gio_async_write((struct gio_async*)_gio, buf, sz);
+    break;
+#endif
+
+  case GIO_OPS: {
+    struct gio_ops *gio = (struct gio_ops*)_gio;
+    if(gio->write) 
+      ret = gio->write(gio, buf, sz);
+  } break;
+
+  defualt:
+    KK_GIO_UNREACHABLE();
+  }
+out:
+  _gio_stat_io(_gio, GIO_EV_WRITE, ret);
+#ifdef KK_GIO_ENABLE_TRACING
+  fprintf(stderr,
+      "%s(): gio=%p { .type=%d }, buf=%p, sz=%zu = %zd\n", 
+      __func__, _gio, ((struct gio*)_gio)->type, buf, sz, ret);
+  fflush(stderr);
+#endif
+  return ret;
+}
+
+
+KK_GIO_API
+ssize_t gio_read(gio_t *_gio, void *buf, size_t sz)
+{
+  ssize_t ret = -1;
+
+  switch(((struct gio*)_gio)->type) {
+  case GIO_MMAP: /* same layout */
+  case GIO_MEM: {
+    struct gio_mem *gio = (struct gio_mem*)_gio;
+    assert(gio->sz >= gio->off);
+    sz = GIO_MIN(sz, gio->sz - gio->off);
+    if(sz)
+      memcpy(buf, gio->buf + gio->off, sz);
+    gio->off += sz;
+    ret = sz;
+  } break;
+
+  case GIO_FILE: {
+    struct gio_file *gio = (struct gio_file*)_gio;
+    if(gio->fp)
+      ret = fread(buf, 1, sz, gio->fp);
+    else if(gio->rbuf)
+      ret = _gio_file_read_buf(gio, buf, sz);
+    else if(_gio_file_drain(gio) == 0)
+      ret = _GIO_SYS(GIO_FILE, read(gio->fd, buf, sz));
+  } break;
+
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    ret = _gio_async_read((struct gio_async*)_gio, buf, sz);
+    break;
+#endif
+
+  case GIO_OPS: {
+    struct gio_ops *gio = (struct gio_ops*)_gio;
+    if(gio->read)
+      ret = gio->read(gio, buf, sz);
+  } break;
+
+  defualt:
+    KK_GIO_UNREACHABLE();
+  }
+  _gio_stat_io(_gio, GIO_EV_READ, ret);
+#ifdef KK_GIO_ENABLE_TRACING
+  fprintf(stderr,
+      "%s(): gio=%p { .type=%d }, buf=%p, sz=%zu = %zd\n", 
+      __func__, _gio, ((struct gio*)_gio)->type, buf, sz, ret);
+  fflush(stderr);
+#endif
+  return ret;
+}
+
+static inline
+size_t _gio_iov_total(const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  for(int i = 0; i < iovcnt; ++i)
+    total += iov[i].iov_len;
+  return total;
+}
+
+/* Writes the iovecs one by one, stops at the first short write, returns
+ * the total or -1 if the first write failed. */
+static
+ssize_t _gio_writev_each(gio_t *_gio, const struct iovec *iov, int iovcnt)
+{
+  ssize_t ret = 0, rc;
+
+  for(int i = 0; i < iovcnt; ++i) {
+    if((rc = gio_write(_gio, iov[i].iov_base, iov[i].iov_len)) < 0)
+      return ret ? ret : -1;
+    ret += rc;
+    if((size_t)rc < iov[i].iov_len)
+      break;
+  }
+  return ret;
+}
+
+static
+ssize_t _gio_readv_each(gio_t *_gio, const struct iovec *iov, int iovcnt)
+{
+  ssize_t ret = 0, rc;
+
+  for(int i = 0; i < iovcnt; ++i) {
+    if((rc = gio_read(_gio, iov[i].iov_base, iov[i].iov_len)) < 0)
+      return ret ? ret : -1;
+    ret += rc;
+    if((size_t)rc < iov[i].iov_len)
+      break;
+  }
+  return ret;
+}
+
+/* Buffered fd writev, small vectors are gathered into the write buffer, 
+ * big ones go out in one writev(2), what it leaves unwritten is finished 
+ * a piece at a time. */
+static
+ssize_t _gio_file_writev_buf(struct gio_file *gio, const struct iovec *iov, 
+    int iovcnt)
+{
+  size_t total = _gio_iov_total(iov, iovcnt), done;
+  ssize_t rc;
+
+  if(total > gio->wcap - gio->wlen && _gio_file_drain(gio))
+    return -1;
+
+  if(total < gio->wcap) {
+    for(int i = 0; i < iovcnt; ++i) {
+      if(!iov[i].iov_len) continue;
+      memcpy(gio->wbuf + gio->wlen, iov[i].iov_base, iov[i].iov_len);
+      gio->wlen += iov[i].iov_len;
+    }
+    return total;
+  }
+
+  while((rc = _GIO_SYS(GIO_FILE, writev(gio->fd, iov, iovcnt))) < 0 && 
+      errno == EINTR)
+    ;
+  if(rc < 0)
+    return -1;
+
+  done = rc;
+  for(int i = 0; i < iovcnt && (size_t)rc < total; ++i) {
+    size_t len = iov[i].iov_len, n;
+    if(done >= len) {
+      done -= len;
+      continue;
+    }
+    n = _gio_fd_write_all(gio->fd, (uint8_t*)iov[i].iov_base + done, len - done);
+    rc += n;
+    if(n < len - done)
+      break;
+    done = 0;
+  }
+  return rc;
+}
+
+KK_GIO_API
+ssize_t gio_writev(gio_t *_gio, const struct iovec *iov, int iovcnt)
+{
+  ssize_t ret = -1;
+  /* those go through gio_write, which counts them already */
+  bool each = false;
+
+  if(!_gio || iovcnt < 0)
+    goto out;
+
+  switch(((struct gio*)_gio)->type) {
+  case GIO_MEM: {
+    struct gio_mem *gio = (struct gio_mem*)_gio;
+    size_t total = _gio_iov_total(iov, iovcnt);
+
+    if(_gio_mem_maybe_grow(gio, total))
+      goto out;
+
+    ret = 0;
+    for(int i = 0; i < iovcnt; ++i) {
+      size_t sz = GIO_MIN(iov[i].iov_len, _gio_mem_left(gio));
+      if(sz)
+        memcpy((uint8_t*)gio->buf + gio->off, iov[i].iov_base, sz);
+      gio->off += sz;
+      ret += sz;
+    }
+  } break;
+
+  case GIO_MMAP:
+    /* read only */
+    break;
+
+  case GIO_FILE: {
+    struct gio_file *gio = (struct gio_file*)_gio;
+    if(gio->fp) {
+      each = true;
+      ret = _gio_writev_each(_gio, iov, iovcnt);
+    } else if(_gio_file_drop_ahead(gio)) {
+      break;
+    } else if(gio->wbuf)
+      ret = _gio_file_writev_buf(gio, iov, iovcnt);
+    else
+      ret = _GIO_SYS(GIO_FILE, writev(gio->fd, iov, iovcnt));
+  } break;
+
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    /* one queued op per iovec, submitted together later anyway */
+    each = true;
+    ret = _gio_writev_each(_gio, iov, iovcnt);
+    break;
+#endif
+
+  case GIO_OPS: {
+    struct gio_ops *gio = (struct gio_ops*)_gio;
+    if(gio->writev) 
+      ret = gio->writev(gio, iov, iovcnt);
+    else if(gio->write) {
+      each = true;
+      ret = _gio_writev_each(_gio, iov, iovcnt);
+    }
+  } break;
+
+  default:
+    KK_GIO_UNREACHABLE();
+  }
+out:
+  if(!each)
+    _gio_stat_io(_gio, GIO_EV_WRITE, ret);
+#ifdef KK_GIO_ENABLE_TRACING
+  fprintf(stderr,
+      "%s(): gio=%p { .type=%d }, iov=%p, iovcnt=%d = %zd\n", 
+      __func__, _gio, ((struct gio*)_gio)->type, iov, iovcnt, ret);
+  fflush(stderr);
+#endif
+  return ret;
+}
+
+KK_GIO_API
+ssize_t gio_readv(gio_t *_gio, const struct iovec *iov, int iovcnt)
+{
+  ssize_t ret = -1;
+  /* those go through gio_read, which counts them already */
+  bool each = false;
+
+  if(!_gio || iovcnt < 0)
+    goto out;
+
+  switch(((struct gio*)_gio)->type) {
+  case GIO_MMAP: /* same layout */
+  case GIO_MEM: {
+    struct gio_mem *gio = (struct gio_mem*)_gio;
+
+    ret = 0;
+    for(int i = 0; i < iovcnt; ++i) {
+      size_t sz = GIO_MIN(iov[i].iov_len, _gio_mem_left(gio));
+      if(sz)
+        memcpy(iov[i].iov_base, (uint8_t*)gio->buf + gio->off, sz);
+      gio->off += sz;
+      ret += sz;
+    }
+  } break;
+
+  case GIO_FILE: {
+    struct gio_file *gio = (struct gio_file*)_gio;
+    /* buffered reads are served out of the read-ahead */
+    if(gio->fp || gio->rbuf) {
+      each = true;
+      ret = _gio_readv_each(_gio, iov, iovcnt);
+    } else if(_gio_file_drain(gio) == 0)
+      ret = _GIO_SYS(GIO_FILE, readv(gio->fd, iov, iovcnt));
+  } break;
+
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    each = true;
+    ret = _gio_readv_each(_gio, iov, iovcnt);
+    break;
+#endif
 
   case GIO_OPS: {
     struct gio_ops *gio = (struct gio_ops*)_gio;
-    if(gio->read)
-      ret = gio->read(gio, buf, sz);
+    if(gio->readv) 
+      ret = gio->readv(gio, iov, iovcnt);
+    else if(gio->read) {
+      each = true;
+      ret = _gio_readv_each(_gio, iov, iovcnt);
+    }
   } break;
 
-  defualt:
+  default:
     KK_GIO_UNREACHABLE();
   }
-  return -1;
+out:
+  if(!each)
+    _gio_stat_io(_gio, GIO_EV_READ, ret);
 #ifdef KK_GIO_ENABLE_TRACING
   fprintf(stderr,
-      "%s(): gio=%p { .type=%d }, buf=%p, sz=%zu = %zd\n", 
-      __func__, _gio, ((struct gio*)_gio)->type, buf, sz, ret);
+      "%s(): gio=%p { .type=%d }, iov=%p, iovcnt=%d = %zd\n", 
+      __func__, _gio, ((struct gio*)_gio)->type, iov, iovcnt, ret);
   fflush(stderr);
 #endif
   return ret;
@@ -518,9 +1987,10 @@ ssize_t gio_read(gio_t *_gio, void *buf, size_t sz)
 KK_GIO_API
 off_t gio_seek(gio_t *_gio, off_t off, int whence)
 {
-  int ret = -1;
+  off_t ret = -1;
 
   switch(((struct gio*)_gio)->type) {
+  case GIO_MMAP: /* same layout */
   case GIO_MEM: {
     struct gio_mem *gio = (struct gio_mem*)_gio;
     switch(whence) {
@@ -559,13 +2029,24 @@ off_t gio_seek(gio_t *_gio, off_t off, int whence)
   }
   case GIO_FILE: {
     struct gio_file *gio = (struct gio_file*)_gio;
-    if(gio->fp)
+    off_t ahead;
+
+    if(gio->fp) {
       ret = fseek(gio->fp, off, whence);
-    else
-      ret = lseek(gio->fd, off, whence);
+    } else if(_gio_file_unbuffer(gio, &ahead) == 0) {
+      if(whence == SEEK_CUR)
+        off -= ahead;
+      if((ret = _GIO_SYS(GIO_FILE, lseek(gio->fd, off, whence))) >= 0)
+        gio->roff = gio->rlen = 0;
+    }
 
     goto out;
   }
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    ret = _gio_async_seek((struct gio_async*)_gio, off, whence);
+    break;
+#endif
   case GIO_OPS: {
     struct gio_ops *gio = (struct gio_ops*)_gio;
     if(gio->seek) 
@@ -588,8 +2069,9 @@ out:
     }
 
     fprintf(stderr,
-        "%s(): gio=%p { .type=%d }, off=%d, whence=%d(%s) = %d\n", 
-        __func__, _gio, ((struct gio*)_gio)->type, off, whence, whence_str, ret);
+        "%s(): gio=%p { .type=%d }, off=%lld, whence=%d(%s) = %lld\n", 
+        __func__, _gio, ((struct gio*)_gio)->type, (long long)off, whence, 
+        whence_str, (long long)ret);
     fflush(stderr);
   } while(0);
 #endif
@@ -597,36 +2079,219 @@ out:
 }
 
 
+KK_GIO_API
+const void *gio_borrow(gio_t *_gio, size_t max, size_t *len)
+{
+  struct gio_mem *gio = _gio;
+  const void *ret;
+
+  *len = 0;
+  if(gio->gio.type != GIO_MEM && gio->gio.type != GIO_MMAP)
+    return NULL;
+
+  KK_GIO_ASSERT(gio->sz >= gio->off);
+  if(!(*len = GIO_MIN(max, gio->sz - gio->off)))
+    return NULL;
+
+  ret = (uint8_t*)gio->buf + gio->off;
+  gio->off += *len;
+  return ret;
+}
+
+#ifdef __linux__
+
+enum {
+  _GIO_PIPE_COPY_FILE_RANGE,
+  _GIO_PIPE_SENDFILE,
+  _GIO_PIPE_SPLICE,
+  _GIO_PIPE_METHODS,
+};
+
+/* max bytes asked for in one call, what sendfile moves at most anyway */
+#define _GIO_PIPE_CHUNK ((size_t)0x7ffff000)
+
+/* Moves in to out until eof with the given method. Returns 0 when done, 
+ * 1 when the method doesn't work for this pair of fds and nothing was 
+ * moved, so the next one should be tried, or -1 on error. */
+static
+int _gio_pipe_fd_method(int method, int in, int out, off_t *moved)
+{
+  bool any = false;
+  ssize_t rc;
+
+  for(;;) {
+    switch(method) {
+    case _GIO_PIPE_COPY_FILE_RANGE:
+#ifdef SYS_copy_file_range
+      rc = _GIO_SYS(GIO_FILE, syscall(SYS_copy_file_range, in, NULL, out, NULL, 
+            _GIO_PIPE_CHUNK, 0));
+      break;
+#else
+      return 1;
+#endif
+    case _GIO_PIPE_SENDFILE:
+      rc = _GIO_SYS(GIO_FILE, sendfile(out, in, NULL, _GIO_PIPE_CHUNK));
+      break;
+    case _GIO_PIPE_SPLICE: {
+      struct stat st_in, st_out;
+      /* one of the ends has to be a pipe */
+      if(!any && (fstat(in, &st_in) || fstat(out, &st_out) ||
+            (!S_ISFIFO(st_in.st_mode) && !S_ISFIFO(st_out.st_mode))))
+        return 1;
+      rc = _GIO_SYS(GIO_FILE, syscall(SYS_splice, in, NULL, out, NULL, 
+            _GIO_PIPE_CHUNK, 0));
+    } break;
+    default:
+      return 1;
+    }
+
+    if(rc > 0) {
+      *moved += rc;
+      any = true;
+      continue;
+    }
+    /* Some files, e.g. in procfs, claim eof straight away to those calls, 
+     * let the next method (in the end a plain read) decide. */
+    if(rc == 0)
+      return any ? 0 : 1;
+    if(errno == EINTR)
+      continue;
+    if(!any && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || 
+          errno == EOPNOTSUPP || errno == EBADF || errno == ESPIPE))
+      return 1;
+    return -1;
+  }
+}
+
+#endif /* __linux__ */
+
 KK_GIO_API
 off_t gio_pipe(gio_t *src, gio_t *dst) 
 {
-  /* TODO: */
-  KK_GIO_UNREACHABLE();
+  off_t ret = -1, moved = 0;
+  uint8_t *buf = NULL;
+  struct gio *gsrc = src, *gdst = dst;
+
+  if(!src || !dst)
+    goto out;
+
+  if(gsrc->type == GIO_MEM || gsrc->type == GIO_MMAP) {
+    struct gio_mem *mem = src;
+
+    while(mem->off < mem->sz) {
+      ssize_t rc = gio_write(dst, (uint8_t*)mem->buf + mem->off, mem->sz - mem->off);
+      if(rc < 0)
+        goto out;
+      if(rc == 0)
+        break;
+      mem->off += rc;
+      moved += rc;
+    }
+    ret = moved;
+    goto out;
+  }
+
+  if(gdst->type == GIO_MEM) {
+    struct gio_mem *mem = dst;
+
+    for(;;) {
+      ssize_t rc;
+
+      if(_gio_mem_maybe_grow(mem, KK_GIO_PIPE_BUFSZ))
+        goto out;
+      if(!_gio_mem_left(mem))
+        break;
+
+      rc = gio_read(src, (uint8_t*)mem->buf + mem->off, _gio_mem_left(mem));
+      if(rc < 0)
+        goto out;
+      if(rc == 0)
+        break;
+      mem->off += rc;
+      moved += rc;
+    }
+    ret = moved;
+    goto out;
+  }
+
+#ifdef __linux__
+  if(gsrc->type == GIO_FILE && gdst->type == GIO_FILE && 
+      !((struct gio_file*)src)->fp && !((struct gio_file*)dst)->fp) {
+    struct gio_file *in = src, *out = dst;
+    int rc = 1;
+
+    /* whatever sits in the buffers goes first, in's pending writes 
+     * included since the kernel reads its fd directly */
+    if(_gio_file_drain(in) || _gio_file_drain(out))
+      goto out;
+    if(in->roff < in->rlen) {
+      size_t n = in->rlen - in->roff;
+      if(_gio_fd_write_all(out->fd, in->rbuf + in->roff, n) < n)
+        goto out;
+      in->roff = in->rlen = 0;
+      moved += n;
+    }
+
+    for(int m = 0; rc == 1 && m < _GIO_PIPE_METHODS; ++m)
+      rc = _gio_pipe_fd_method(m, in->fd, out->fd, &moved);
+
+    if(rc < 0)
+      goto out;
+    if(rc == 0) {
+      ret = moved;
+      goto out;
+    }
+    /* nothing took, bounce */
+  }
+#endif
+
+  if(!(buf = _gio_xalloc(NULL, KK_GIO_PIPE_BUFSZ)))
+    goto out;
+
+  for(;;) {
+    ssize_t rc = gio_read(src, buf, KK_GIO_PIPE_BUFSZ);
+    if(rc < 0)
+      goto out;
+    if(rc == 0)
+      break;
+
+    for(ssize_t done = 0, w; done < rc; done += w) {
+      if((w = gio_write(dst, buf + done, rc - done)) <= 0)
+        goto out;
+    }
+    moved += rc;
+  }
+  ret = moved;
+
+out:
+  _gio_xalloc(buf, 0);
+#ifdef KK_GIO_ENABLE_TRACING
+  fprintf(stderr,
+      "%s(): src=%p, dst=%p = %lld\n", __func__, src, dst, (long long)ret);
+  fflush(stderr);
+#endif
+  return ret;
 }
 
 
 KK_GIO_API
-int gio_nprintf(gio_t *_gio, size_t maxn, const char *fmt, ...) 
+int gio_vnprintf(gio_t *_gio, size_t maxn, const char *fmt, va_list args) 
 {
   int ret = -1;
+  char stack[KK_GIO_PRINTF_BUFSZ];
   void *buf = NULL;
-
-  va_list args;
+  va_list again;
   int len;
 
-  va_start(args, fmt);
-  if((len = vsnprintf(NULL, 0, fmt, args)) < 0)
-    goto out;
-  va_end(args);
+  /* for the rare second pass, when the first one didn't fit */
+  va_copy(again, args);
 
   /* NOTE: We bypass gio_write */
   /* TODO: handle case when the buffer written from is already part of the buffer
    * written to, i.e. memmove */
   if(((struct gio *)_gio)->type == GIO_MEM) {
     struct gio_mem *gio = _gio;
-
-    if(_gio_mem_maybe_grow(gio, len + 1))
-      goto out;
+    size_t lim;
 
     if(gio->gio.flags & GIO_MEM_STRING_AUTOCONTINUE) {
       if(gio->off && *((char*)gio->buf + gio->off - 1) == '\0') {
@@ -635,30 +2300,88 @@ int gio_nprintf(gio_t *_gio, size_t maxn, const char *fmt, ...)
         }
       }
     }
-    
-    maxn = GIO_MIN(_gio_mem_left(gio), maxn);
-    va_start(args, fmt);
-    if((len = vsnprintf(gio->buf + gio->off, maxn, fmt, args)) < 0)
+
+    /* optimistically format into whatever space is left */
+    lim = GIO_MIN(_gio_mem_left(gio), maxn);
+    if((len = vsnprintf(lim ? (char*)gio->buf + gio->off : NULL, lim, fmt, args)) < 0)
       goto out;
-    va_end(args);
+
+    if((size_t)len >= lim && lim < maxn && 
+        gio->gio.flags & GIO_MEM_ALLOC && gio->gio.flags & GIO_MEM_AUTOGROW) {
+      if(_gio_mem_maybe_grow(gio, (size_t)len + 1))
+        goto out;
+
+      lim = GIO_MIN(_gio_mem_left(gio), maxn);
+      if((len = vsnprintf((char*)gio->buf + gio->off, lim, fmt, again)) < 0)
+        goto out;
+    }
+
+    /* truncated output still gets its null terminator */
+    if((size_t)len >= lim)
+      len = lim ? lim - 1 : 0;
 
     gio->off += len;
-    gio->off += 1; /* null terminator */
+    gio->off += lim ? 1 : 0; /* null terminator */
     KK_GIO_ASSERT(gio->sz >= gio->off);
+    ret = len;
+    _gio_stat_io(_gio, GIO_EV_WRITE, ret);
+
+  } else if(((struct gio *)_gio)->type == GIO_FILE && 
+      ((struct gio_file *)_gio)->wbuf && 
+      ((struct gio_file *)_gio)->wcap - ((struct gio_file *)_gio)->wlen > 1) {
+    /* buffered fd, format straight into the write buffer when it fits, 
+     * the null terminator lands past wlen and gets overwritten later */
+    struct gio_file *gio = _gio;
+    size_t room = gio->wcap - gio->wlen;
+
+    if(_gio_file_drop_ahead(gio))
+      goto out;
 
-  } else {
-    maxn = GIO_MIN(len, maxn);
-    if(!(buf = _gio_xalloc(NULL, maxn + 1)))
+    if((len = vsnprintf((char*)gio->wbuf + gio->wlen, room, fmt, args)) < 0)
       goto out;
 
-    va_start(args, fmt);
-    if((len = vsnprintf(buf, maxn + 1, fmt, args)) < 0)
+    /* fits an empty buffer, write out what's there and format again */
+    if((size_t)len >= room && (size_t)len < gio->wcap) {
+      if(_gio_file_drain(gio))
+        goto out;
+      room = gio->wcap;
+      if((len = vsnprintf((char*)gio->wbuf, room, fmt, again)) < 0)
+        goto out;
+    }
+
+    if((size_t)len < room) {
+      len = GIO_MIN((size_t)len, maxn);
+      gio->wlen += len;
+      ret = len;
+      _gio_stat_io(_gio, GIO_EV_WRITE, ret);
+    } else if((size_t)len < sizeof(stack)) {
+      if((len = vsnprintf(stack, sizeof(stack), fmt, again)) < 0)
+        goto out;
+      ret = gio_write(_gio, stack, GIO_MIN((size_t)len, maxn));
+    } else {
+      goto slow;
+    }
+
+  } else {
+    if((len = vsnprintf(stack, sizeof(stack), fmt, args)) < 0)
       goto out;
-    va_end(args);
 
-    ret = gio_write(_gio, buf, maxn);
+    if((size_t)len < sizeof(stack)) {
+      ret = gio_write(_gio, stack, GIO_MIN((size_t)len, maxn));
+    } else {
+slow:
+      maxn = GIO_MIN((size_t)len, maxn);
+      if(!(buf = _gio_xalloc(NULL, maxn + 1)))
+        goto out;
+
+      if((len = vsnprintf(buf, maxn + 1, fmt, again)) < 0)
+        goto out;
+
+      ret = gio_write(_gio, buf, maxn);
+    }
   }
 out:
+  va_end(again);
   _gio_xalloc(buf, 0);
 #ifdef KK_GIO_ENABLE_TRACING
   fprintf(stderr,
@@ -669,6 +2392,18 @@ out:
   return ret;
 }
 
+KK_GIO_API
+int gio_nprintf(gio_t *_gio, size_t maxn, const char *fmt, ...) 
+{
+  int ret;
+  va_list args;
+
+  va_start(args, fmt);
+  ret = gio_vnprintf(_gio, maxn, fmt, args);
+  va_end(args);
+  return ret;
+}
+
 //{  
 //  int ret = -1;
 //
@@ -746,13 +2481,28 @@ int gio_ctl(gio_t *_gio, int op, void *user)
 
     case GIO_CTL_CLOSE: 
       if(gio->gio.flags & GIO_MEM_ALLOC) {
-        _gio_xalloc(gio->buf, 0);
+        _gio_mem_xalloc(gio, gio->buf, 0);
       }
       ret = 0; 
       break;
     }
   }; break;
 
+  case GIO_MMAP: {
+    struct gio_mmap *gio = (struct gio_mmap*)_gio;
+    switch(op) {
+    case GIO_CTL_SYNC:
+      ret = 0; 
+      break;
+
+    case GIO_CTL_CLOSE: 
+      ret = gio->sz ? _GIO_SYS(GIO_MMAP, munmap(gio->buf, gio->sz)) : 0;
+      gio->buf = NULL;
+      gio->sz = gio->off = 0;
+      break;
+    }
+  }; break;
+
   case GIO_FILE: {
     struct gio_file *gio = (struct gio_file*)_gio;
 
@@ -760,23 +2510,40 @@ int gio_ctl(gio_t *_gio, int op, void *user)
     case GIO_CTL_SYNC:
       if(gio->fp)
         ret = fflush(gio->fp);
-      else
-        ret = fsync(gio->fd);
+      else if(_gio_file_drain(gio) == 0)
+        ret = _GIO_SYS(GIO_FILE, fsync(gio->fd));
       break;
 
     case GIO_CTL_CLOSE: 
-      if(gio->fp)
+      if(gio->fp) {
         ret = fclose(gio->fp);
-      else
-        ret = close(gio->fd);
+      } else {
+        /* close even if the last writes failed, but do report it */
+        int rc = _gio_file_drain(gio);
+        ret = _GIO_SYS(GIO_FILE, close(gio->fd)) ? -1 : rc;
+        _gio_xalloc(gio->wbuf, 0);
+        _gio_xalloc(gio->rbuf, 0);
+        gio->wbuf = gio->rbuf = NULL;
+        gio->wlen = gio->rlen = gio->roff = 0;
+      }
       break;
     }
   }; break;
 
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC:
+    ret = _gio_async_ctl((struct gio_async*)_gio, op);
+    break;
+#endif
+
   case GIO_OPS: {
     struct gio_ops *gio = (struct gio_ops*)_gio;
     if(gio->ctl) {
       ret = gio->ctl(gio, op, user);
+    } else if(op == GIO_CTL_SYNC && gio->sync) {
+      ret = gio->sync(gio);
+    } else if(op == GIO_CTL_CLOSE && gio->close) {
+      ret = gio->close(gio);
     } else {
       if(op < GIO_CTL_USER)
         ret = 0;
@@ -807,6 +2574,8 @@ out:
 struct gio_list_data {
   uint8_t flags;
   size_t list_size;
+  /* GIO_LIST_READ, offset of the gio being read */
+  size_t rcur;
   uint8_t list[];
 };
 
@@ -818,8 +2587,14 @@ ssize_t _gio_size(const struct gio *gio)
     return sizeof(struct gio_mem);
   case GIO_FILE: 
     return sizeof(struct gio_file);
+#ifdef KK_GIO_HAS_URING
+  case GIO_ASYNC: 
+    return sizeof(struct gio_async);
+#endif
   case GIO_OPS: 
     return sizeof(struct gio_ops);
+  case GIO_MMAP: 
+    return sizeof(struct gio_mmap);
   }
   return -1;
 }
@@ -852,28 +2627,271 @@ struct gio *_gio_list_next(struct gio_list_data *data, struct gio *gio)
   return gio;
 }
 
+#ifdef KK_GIO_THREADS
+
+/* GIO_LIST_ASYNC sink, the list gets a gio_ops forwarding to one of those,
+ * the caller fills the queue and the worker thread writes it out */
+struct _gio_lsink {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  /* signalled when data is queued or stop is set */
+  pthread_cond_t has_data;
+  /* signalled when the worker takes data from the queue and when it's 
+   * done writing it */
+  pthread_cond_t progress;
+  struct ring q;
+  /* queued or being written */
+  size_t pending;
+  bool stop;
+  /* errno of the first failed write since the last sync */
+  int err;
+  uint8_t *buf;
+  /* copy of the sink */
+  union {
+    struct gio gio;
+    struct gio_mem mem;
+    struct gio_file file;
+    struct gio_mmap mmap;
+    struct gio_ops ops;
+  } sink;
+};
+
+static
+void *_gio_lsink_main(void *arg)
+{
+  struct _gio_lsink *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  for(;;) {
+    size_t n;
+    int err = 0;
+
+    while(ring_empty(&s->q) && !s->stop)
+      pthread_cond_wait(&s->has_data, &s->lock);
+    if(ring_empty(&s->q))
+      break;
+    pthread_mutex_unlock(&s->lock);
+
+    /* single consumer, no need to hold the lock */
+    n = ring_pop_n(&s->q, s->buf, KK_GIO_PIPE_BUFSZ);
+
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_broadcast(&s->progress);
+    pthread_mutex_unlock(&s->lock);
+
+    for(size_t done = 0; done < n; ) {
+      ssize_t rc = gio_write(&s->sink.gio, s->buf + done, n - done);
+      if(rc <= 0) {
+        /* the rest of this chunk is lost, keep going with the next */
+        err = rc < 0 && errno ? errno : EIO;
+        break;
+      }
+      done += rc;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if(err && !s->err)
+      s->err = err;
+    s->pending -= n;
+    pthread_cond_broadcast(&s->progress);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static
+ssize_t _gio_lsink_write(struct gio_ops *ops, const void *buf, size_t sz)
+{
+  struct _gio_lsink *s = ops->data;
+  size_t done = 0;
+
+  pthread_mutex_lock(&s->lock);
+  while(done < sz) {
+    size_t n;
+
+    /* bounded, wait for the worker to make room */
+    while(ring_cnt(&s->q) == ring_cap(&s->q))
+      pthread_cond_wait(&s->progress, &s->lock);
+
+    n = ring_push_n(&s->q, (const uint8_t*)buf + done, sz - done);
+    s->pending += n;
+    done += n;
+    pthread_cond_signal(&s->has_data);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return sz;
+}
+
+/* Waits for the queue to be written out, errors stay in s->err. */
+static
+void _gio_lsink_idle(struct _gio_lsink *s)
+{
+  pthread_mutex_lock(&s->lock);
+  while(s->pending)
+    pthread_cond_wait(&s->progress, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* Same, then returns -1 if any of it failed since the last wait. */
+static
+int _gio_lsink_wait(struct _gio_lsink *s)
+{
+  int err;
+
+  _gio_lsink_idle(s);
+  pthread_mutex_lock(&s->lock);
+  err = s->err;
+  s->err = 0;
+  pthread_mutex_unlock(&s->lock);
+
+  if(err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static
+void _gio_lsink_free(struct _gio_lsink *s)
+{
+  pthread_mutex_lock(&s->lock);
+  s->stop = true;
+  pthread_cond_signal(&s->has_data);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+
+  pthread_cond_destroy(&s->progress);
+  pthread_cond_destroy(&s->has_data);
+  pthread_mutex_destroy(&s->lock);
+  ring_cleanup(&s->q);
+  _gio_xalloc(s->buf, 0);
+  free(s);
+}
+
+static
+int _gio_lsink_ctl(struct gio_ops *ops, int op, void *user)
+{
+  struct _gio_lsink *s = ops->data;
+  int ret;
+
+  switch(op) {
+  case GIO_CTL_SYNC:
+    ret = _gio_lsink_wait(s);
+    /* the worker is idle now, the sink is ours until the next write */
+    if(gio_sync(&s->sink.gio))
+      ret = -1;
+    return ret;
+
+  case GIO_CTL_CLOSE:
+    ret = _gio_lsink_wait(s);
+    if(gio_close(&s->sink.gio))
+      ret = -1;
+    _gio_lsink_free(s);
+    ops->data = NULL;
+    return ret;
+  }
+
+  /* failed writes are left for the next sync to report */
+  _gio_lsink_idle(s);
+  return gio_ctl(&s->sink.gio, op, user);
+}
+
+/* Moves gio into a new async sink, returns the gio_ops to put on the list.*/
+static
+int _gio_lsink_new(struct gio_ops *ops, const struct gio *gio, size_t gio_sz)
+{
+  struct _gio_lsink *s;
+
+  /* the ring in it is cache line aligned, which malloc doesn't promise */
+  if(posix_memalign((void**)&s, _Alignof(struct _gio_lsink), sizeof(*s)))
+    return -1;
+
+  memset(s, 0, sizeof(*s));
+  memcpy(&s->sink, gio, gio_sz);
+
+  if(!(s->buf = _gio_xalloc(NULL, KK_GIO_PIPE_BUFSZ)))
+    goto fail_buf;
+  if(ring_init(&s->q, 1, KK_GIO_LIST_QUEUE_SZ, RING_SPSC))
+    goto fail_ring;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->has_data, NULL);
+  pthread_cond_init(&s->progress, NULL);
+
+  if(pthread_create(&s->thread, NULL, _gio_lsink_main, s))
+    goto fail_thread;
+
+  memset(ops, 0, sizeof(*ops));
+  ops->gio.type = GIO_OPS;
+  ops->data = s;
+  ops->write = _gio_lsink_write;
+  ops->ctl = _gio_lsink_ctl;
+  return 0;
+
+fail_thread:
+  pthread_cond_destroy(&s->progress);
+  pthread_cond_destroy(&s->has_data);
+  pthread_mutex_destroy(&s->lock);
+  ring_cleanup(&s->q);
+fail_ring:
+  _gio_xalloc(s->buf, 0);
+fail_buf:
+  free(s);
+  return -1;
+}
+
+#endif /* KK_GIO_THREADS */
+
 KK_GIO_API
 int gio_list_add(struct gio_ops *list, struct gio *gio) 
 {
   ssize_t gio_sz;
+  size_t list_size;
   void *new_data;
-  struct gio_list_data *data = list->data;
+  struct gio_list_data *data;
+#ifdef KK_GIO_THREADS
+  struct gio_ops sink;
+#endif
 
   if(!list || !gio)
     return -1;
 
+  data = list->data;
+  list_size = data ? data->list_size : 0;
+
   gio_sz = _gio_size(gio);
   KK_GIO_ASSERT(gio_sz > 0);
 
+#ifdef KK_GIO_THREADS
+  if((list->gio.flags & (GIO_LIST_ASYNC | GIO_LIST_READ)) == GIO_LIST_ASYNC &&
+      gio->type != GIO_ASYNC) {
+    if(_gio_lsink_new(&sink, gio, gio_sz))
+      return -1;
+    gio = &sink.gio;
+    gio_sz = sizeof(sink);
+  }
+#endif
+
   new_data = _gio_xalloc(list->data, 
-        sizeof(struct gio_list_data) + data->list_size + gio_sz);
+        sizeof(struct gio_list_data) + list_size + gio_sz);
 
   if(new_data) {
     data = list->data = new_data;
+    if(!list_size) {
+      data->flags = list->gio.flags;
+      data->list_size = 0;
+      data->rcur = 0;
+    }
     memcpy(data->list + data->list_size, gio, gio_sz);
     data->list_size += gio_sz;
     return 0;
   }
+
+#ifdef KK_GIO_THREADS
+  /* hand the gio back untouched */
+  if(gio == &sink.gio)
+    _gio_lsink_free(sink.data);
+#endif
   return -1;
 }
 
@@ -911,88 +2929,80 @@ ssize_t gio_list_write_cb(struct gio_ops *gio_ops, const void *buf, size_t sz)
 #endif
   return min;
 }
-#if 0
 
 KK_GIO_API
-ssize_t gio_list_read_cb(struct gio_ops *gio_ops, void *buf, size_t sz)
+ssize_t gio_list_writev_cb(struct gio_ops *gio_ops, const struct iovec *iov, 
+    int iovcnt)
 {
-  ssize_t ret, min = sz;
+  ssize_t ret, min = _gio_iov_total(iov, iovcnt);
   struct gio *gio = NULL;
-  struct gio_list_data *data = gio_ops->data;
 
-  while(gio = _gio_list_next(data, gio)) {
-    ret = gio_read(gio, buf, sz);
+  while((gio = _gio_list_next(gio_ops->data, gio))) {
+    ret = gio_writev(gio, iov, iovcnt);
 
-    if(data->flags & GIO_LIST_FAIL_FAST && ret < 0) 
+    if(gio_ops->gio.flags & GIO_LIST_FAIL_FAST && ret < 0) 
       return ret;
 
     if(ret < min)
       min = ret;
   }
-
   return min;
 }
-
-
+KK_GIO_API
+ssize_t gio_list_read_cb(struct gio_ops *gio_ops, void *buf, size_t sz)
 {
-  ssize_t ret, min = 0;
-  struct gio *gio = NULL;
-  struct gio_list_data *data = _data
+  ssize_t ret;
+  struct gio_list_data *data = gio_ops->data;
+  struct gio *gio;
 
-#if 0
-  while(gio = _gio_list_next(data, gio)) {
-    ret = gio_read(gio, buf, sz);
+  if(!data || !sz)
+    return 0;
 
-    if(ret != sz) {
-      if(ret < min)
-        min = ret;
+  while(data->rcur < data->list_size) {
+    gio = (struct gio*)(data->list + data->rcur);
+    if((ret = gio_read(gio, buf, sz)) != 0)
+      return ret;
 
-      if(data->flags & GIO_LIST_FAIL_FAST)
-        return ret;
-    }
+    /* this one is done, on to the next */
+    data->rcur += _gio_size(gio);
   }
-#endif
-  return min;
-}
-
-KK_GIO_API
-off_t gio_list_seek_cb(void *_data, off_t off, int whence)
-{
-  if(!_data) return 0;
+  return 0;
 }
 
 KK_GIO_API
-int gio_list_sync_cb(void *_data)
+int gio_list_sync_cb(struct gio_ops *gio_ops)
 {
-  ssize_t ret, min = 0;
+  int ret = 0;
   struct gio *gio = NULL;
-  struct gio_list_data *data = _data
 
-#if 0
-  while(gio = _gio_list_next(data, gio)) {
-    ret = gio_close(gio, buf, sz);
+  /* GIO_LIST_ASYNC sinks all drain at once, 
+   * the slowest one holds this up, not their sum */
+  while((gio = _gio_list_next(gio_ops->data, gio))) {
+    if(gio_sync(gio)) {
+      ret = -1;
+      if(gio_ops->gio.flags & GIO_LIST_FAIL_FAST) 
+        break;
+    }
   }
-#endif
-  return min;
+  return ret;
 }
 
 KK_GIO_API
-ssize_t gio_list_close_cb(void *_data, const void *buf, size_t sz)
+int gio_list_close_cb(struct gio_ops *gio_ops)
 {
-  ssize_t ret, min = 0;
+  int ret = 0;
   struct gio *gio = NULL;
-  struct gio_list_data *data = _data
 
-#if 0
-  while(gio = _gio_list_next(data, gio)) {
-    ret = gio_close(gio, buf, sz);
+  /* closes every gio even when failing fast, the list is gone after this */
+  while((gio = _gio_list_next(gio_ops->data, gio))) {
+    if(gio_close(gio))
+      ret = -1;
   }
-#endif
-  _gio_xalloc(data, 0);
-  return min;
+  _gio_xalloc(gio_ops->data, 0);
+  gio_ops->data = NULL;
+  return ret;
 }
 
-#endif
 KK_GIO_API
 struct gio_ops gio_list_new(uint8_t flags)
 {
@@ -1002,10 +3012,10 @@ struct gio_ops gio_list_new(uint8_t flags)
       .flags = flags,
     },
     .write = !(flags & GIO_LIST_READ) ? gio_list_write_cb : NULL,
-    //.read = (flags & GIO_LIST_READ) ? gio_list_read_cb : NULL,
-//    .seek = gio_list_seek_cb,
-//    .sync = gio_list_sync_cb,
-//    .close = gio_list_close_cb,
+    .writev = !(flags & GIO_LIST_READ) ? gio_list_writev_cb : NULL,
+    .read = (flags & GIO_LIST_READ) ? gio_list_read_cb : NULL,
+    .sync = gio_list_sync_cb,
+    .close = gio_list_close_cb,
     .data = NULL,
   };
 
@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header 64bit hash for strings and byte ranges.
+ *  It's MurmurHash64A by Austin Appleby, fast and good enough for 
+ *  hash tables, not meant to be cryptographically anything.
+ */
+
+#ifndef _KK_HASH_H_
+#define _KK_HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef KK_HASH_SEED
+# define KK_HASH_SEED 0x2545f4914f6cdd1dULL
+#endif
+
+static inline
+uint64_t kk_hash_seed(const void *key, size_t len, uint64_t seed)
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+
+  const uint8_t *p = key, *end = p + (len & ~(size_t)7);
+  uint64_t h = seed ^ (len * m), k;
+
+  for(; p != end; p += 8) {
+    memcpy(&k, p, sizeof(k));
+    k *= m; 
+    k ^= k >> r; 
+    k *= m; 
+    h ^= k;
+    h *= m; 
+  }
+
+  switch(len & 7) {
+  case 7: h ^= (uint64_t)p[6] << 48; /* fallthrough */
+  case 6: h ^= (uint64_t)p[5] << 40; /* fallthrough */
+  case 5: h ^= (uint64_t)p[4] << 32; /* fallthrough */
+  case 4: h ^= (uint64_t)p[3] << 24; /* fallthrough */
+  case 3: h ^= (uint64_t)p[2] << 16; /* fallthrough */
+  case 2: h ^= (uint64_t)p[1] << 8;  /* fallthrough */
+  case 1: h ^= (uint64_t)p[0];
+          h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+static inline
+uint64_t kk_hash(const void *key, size_t len)
+{
+  return kk_hash_seed(key, len, KK_HASH_SEED);
+}
+
+static inline
+uint64_t kk_hash_str(const char *str)
+{
+  return kk_hash(str, strlen(str));
+}
+
+#endif /* _KK_HASH_H_ */
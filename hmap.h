@@ -0,0 +1,272 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header string to pointer hash map.
+ *  Same interface as struct map but backed by a flat open addressing table
+ *  with robin hood probing instead of a tree, for when all you need is
+ *  point lookups and don't care about the order of keys.
+ *  Define KK_HMAP_IMPL to spawn the implementation.
+ */
+
+#ifndef _KK_HMAP_H_
+#define _KK_HMAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+#ifndef HMAP_ASSERT
+# include <assert.h>
+# define HMAP_ASSERT(COND) assert(COND)
+#endif
+
+/* Slot is occupied if key is not NULL. Keeping the full hash next to the key 
+ * lets us skip almost every strcmp and compute probe distances without 
+ * rehashing, one slot is 24 bytes so a probe rarely leaves its cache line. */
+struct hmap_slot {
+  uint64_t hash;
+  char *key;
+  void *data;
+};
+
+struct hmap {
+  struct hmap_slot *slots;
+  size_t cap; /* always a power of two, or 0 */
+  size_t cnt;
+};
+
+int hmap_init(struct hmap *map);
+
+void hmap_cleanup(struct hmap *map);
+
+/* makes room for cnt keys so no rehashing happens until then */
+int hmap_reserve(struct hmap *map, size_t cnt);
+
+/* Unlike map_insert this one replaces the data if the key is already there,
+ * the key is copied. */
+int hmap_insert(struct hmap *map, const char *key, void *data);
+
+void *hmap_search(struct hmap *map, const char *key);
+
+/* returns -1 if there was no such key */
+int hmap_remove(struct hmap *map, const char *key);
+
+/* The same with the hash computed by the caller with kk_hash_str,
+ * e.g. if you need it to pick a map in the first place. */
+int hmap_insert_hash(struct hmap *map, const char *key, uint64_t hash, void *data);
+
+void *hmap_search_hash(struct hmap *map, const char *key, uint64_t hash);
+
+int hmap_remove_hash(struct hmap *map, const char *key, uint64_t hash);
+
+#endif /* _KK_HMAP_H_ */
+
+/* implementation */
+
+#ifdef KK_HMAP_IMPL
+
+#ifndef _KK_HMAP_IMPL_
+#define _KK_HMAP_IMPL_
+
+#define HMAP_LIKELY(X) __builtin_expect((X),1)
+#define HMAP_MIN_CAP 16
+
+/* grow when over 7/8 full, robin hood keeps probes short even then */
+#define _hmap_full(CAP, CNT) ((CNT) * 8 > (CAP) * 7)
+
+static inline
+size_t _hmap_dist(const struct hmap *map, const struct hmap_slot *s, size_t idx)
+{
+  return (idx - (s->hash & (map->cap - 1))) & (map->cap - 1);
+}
+
+int hmap_init(struct hmap *map)
+{
+  memset(map, 0, sizeof(*map));
+  return 0;
+}
+
+void hmap_cleanup(struct hmap *map)
+{
+  for(size_t i = 0; i < map->cap; ++i) {
+    if(map->slots[i].key)
+      free(map->slots[i].key);
+  }
+  free(map->slots);
+  memset(map, 0, sizeof(*map));
+}
+
+/* places a slot known not to be in the table, takes over the key */
+static
+void _hmap_place(struct hmap *map, struct hmap_slot cur)
+{
+  struct hmap_slot tmp, *s;
+  size_t mask = map->cap - 1, idx = cur.hash & mask, dist = 0, sdist;
+
+  for(;; idx = (idx + 1) & mask, dist++) {
+    s = &map->slots[idx];
+
+    if(!s->key) {
+      *s = cur;
+      map->cnt++;
+      return;
+    }
+
+    /* take from the rich, give to the poor */
+    if((sdist = _hmap_dist(map, s, idx)) < dist) {
+      tmp = *s; *s = cur; cur = tmp;
+      dist = sdist;
+    }
+  }
+}
+
+static
+int _hmap_rehash(struct hmap *map, size_t ncap)
+{
+  struct hmap_slot *old = map->slots;
+  size_t ocap = map->cap;
+
+  HMAP_ASSERT(!(ncap & (ncap - 1)));
+
+  if(!(map->slots = realloc(NULL, ncap * sizeof(*map->slots)))) {
+    map->slots = old;
+    return -1;
+  }
+  memset(map->slots, 0, ncap * sizeof(*map->slots));
+  map->cap = ncap;
+  map->cnt = 0;
+
+  for(size_t i = 0; i < ocap; ++i) {
+    if(old[i].key)
+      _hmap_place(map, old[i]);
+  }
+  free(old);
+  return 0;
+}
+
+int hmap_reserve(struct hmap *map, size_t cnt)
+{
+  size_t ncap = map->cap ? map->cap : HMAP_MIN_CAP;
+
+  while(_hmap_full(ncap, cnt))
+    ncap *= 2;
+
+  return ncap > map->cap ? _hmap_rehash(map, ncap) : 0;
+}
+
+static inline
+struct hmap_slot *_hmap_find(struct hmap *map, const char *key, uint64_t hash)
+{
+  struct hmap_slot *s;
+  size_t mask = map->cap - 1, idx, dist;
+
+  if(!map->cnt)
+    return NULL;
+
+  for(idx = hash & mask, dist = 0;; idx = (idx + 1) & mask, dist++) {
+    s = &map->slots[idx];
+
+    /* an empty slot or a slot closer to home than we are means 
+     * our key would have been placed here if it was there at all */
+    if(!s->key || _hmap_dist(map, s, idx) < dist)
+      return NULL;
+
+    if(s->hash == hash && HMAP_LIKELY(!strcmp(s->key, key)))
+      return s;
+  }
+}
+
+int hmap_insert_hash(struct hmap *map, const char *key, uint64_t hash, void *data)
+{
+  size_t len;
+  struct hmap_slot *s, cur;
+
+  if((s = _hmap_find(map, key, hash))) {
+    s->data = data;
+    return 0;
+  }
+
+  if(!map->cap || _hmap_full(map->cap, map->cnt + 1))
+    if(_hmap_rehash(map, map->cap ? map->cap * 2 : HMAP_MIN_CAP))
+      return -1;
+
+  len = strlen(key);
+  if(!(cur.key = realloc(NULL, len + 1)))
+    return -1;
+
+  memcpy(cur.key, key, len + 1);
+  cur.hash = hash;
+  cur.data = data;
+  _hmap_place(map, cur);
+  return 0;
+}
+
+void *hmap_search_hash(struct hmap *map, const char *key, uint64_t hash)
+{
+  struct hmap_slot *s = _hmap_find(map, key, hash);
+  return s ? s->data : NULL;
+}
+
+int hmap_remove_hash(struct hmap *map, const char *key, uint64_t hash)
+{
+  struct hmap_slot *s = _hmap_find(map, key, hash), *next;
+  size_t mask = map->cap - 1, idx;
+
+  if(!s)
+    return -1;
+
+  free(s->key);
+
+  /* backward shift, pull following displaced slots one step closer to home 
+   * so no tombstones are needed */
+  for(idx = s - map->slots;; idx = (idx + 1) & mask) {
+    next = &map->slots[(idx + 1) & mask];
+    if(!next->key || _hmap_dist(map, next, (idx + 1) & mask) == 0)
+      break;
+    map->slots[idx] = *next;
+  }
+  memset(&map->slots[idx], 0, sizeof(map->slots[idx]));
+  map->cnt--;
+  return 0;
+}
+
+int hmap_insert(struct hmap *map, const char *key, void *data)
+{
+  return hmap_insert_hash(map, key, kk_hash_str(key), data);
+}
+
+void *hmap_search(struct hmap *map, const char *key)
+{
+  return hmap_search_hash(map, key, kk_hash_str(key));
+}
+
+int hmap_remove(struct hmap *map, const char *key)
+{
+  return hmap_remove_hash(map, key, kk_hash_str(key));
+}
+
+#endif /* _KK_HMAP_IMPL_ */
+
+#endif /* KK_HMAP_IMPL */
@@ -0,0 +1,228 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header string interning pool.
+ *  Strings are copied once into big bump allocated chunks and looked up 
+ *  through a hash index, so interning the same string again returns the 
+ *  very same pointer. Interned strings are immutable and live until
+ *  intern_cleanup, which releases all of them at once.
+ *  Define KK_INTERN_IMPL to spawn the implementation.
+ */
+
+#ifndef _KK_INTERN_H_
+#define _KK_INTERN_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+#ifndef INTERN_CHUNK_SIZE
+# define INTERN_CHUNK_SIZE (64 * 1024)
+#endif
+
+struct intern_chunk {
+  struct intern_chunk *next;
+};
+
+struct intern_slot {
+  uint64_t hash;
+  /* checked before the bytes so a hash match never reads past str */
+  size_t len;
+  const char *str;
+};
+
+struct intern {
+  struct intern_chunk *chunks;
+  char *cur;
+  char *end;
+  struct intern_slot *slots;
+  size_t cap; /* always a power of two, or 0 */
+  size_t cnt;
+};
+
+int intern_init(struct intern *in);
+
+void intern_cleanup(struct intern *in);
+
+/* returns the interned copy of str, NULL if we ran out of memory */
+const char *intern_str(struct intern *in, const char *str);
+
+/* same with length and kk_hash(str, len) provided by the caller */
+const char *intern_strn_hash(struct intern *in, 
+    const char *str, size_t len, uint64_t hash);
+
+/* returns the interned copy of str if there is one, never interns */
+const char *intern_lookup(const struct intern *in, const char *str);
+
+#endif /* _KK_INTERN_H_ */
+
+/* implementation */
+
+#ifdef KK_INTERN_IMPL
+
+#ifndef _KK_INTERN_IMPL_
+#define _KK_INTERN_IMPL_
+
+#define INTERN_MIN_CAP 64
+
+int intern_init(struct intern *in)
+{
+  memset(in, 0, sizeof(*in));
+  return 0;
+}
+
+void intern_cleanup(struct intern *in)
+{
+  struct intern_chunk *c, *next;
+
+  for(c = in->chunks; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  free(in->slots);
+  memset(in, 0, sizeof(*in));
+}
+
+static
+char *_intern_alloc(struct intern *in, size_t sz)
+{
+  struct intern_chunk *c;
+  size_t csz;
+  char *ret;
+
+  if((size_t)(in->end - in->cur) < sz) {
+    csz = sizeof(*c) + sz;
+    if(csz < INTERN_CHUNK_SIZE)
+      csz = INTERN_CHUNK_SIZE;
+
+    if(!(c = realloc(NULL, csz)))
+      return NULL;
+
+    c->next = in->chunks;
+    in->chunks = c;
+
+    /* an oversized string gets a chunk of its own, 
+     * don't throw away what's left of the current one for it */
+    if(csz > INTERN_CHUNK_SIZE && in->cur)
+      return (char*)(c + 1);
+
+    in->cur = (char*)(c + 1);
+    in->end = (char*)c + csz;
+  }
+
+  ret = in->cur;
+  in->cur += sz;
+  return ret;
+}
+
+static
+int _intern_rehash(struct intern *in, size_t ncap)
+{
+  struct intern_slot *old = in->slots, *s;
+  size_t ocap = in->cap, mask = ncap - 1;
+
+  if(!(in->slots = realloc(NULL, ncap * sizeof(*in->slots)))) {
+    in->slots = old;
+    return -1;
+  }
+  memset(in->slots, 0, ncap * sizeof(*in->slots));
+  in->cap = ncap;
+
+  for(size_t i = 0; i < ocap; ++i) {
+    if(!old[i].str)
+      continue;
+
+    for(s = &in->slots[old[i].hash & mask]; s->str; 
+        s = &in->slots[(s - in->slots + 1) & mask]);
+    *s = old[i];
+  }
+  free(old);
+  return 0;
+}
+
+static inline
+struct intern_slot *_intern_find(const struct intern *in, 
+    const char *str, size_t len, uint64_t hash)
+{
+  struct intern_slot *s;
+  size_t mask = in->cap - 1, idx = hash & mask;
+
+  /* linear probing, stops at an empty slot which we may then fill */
+  for(;; idx = (idx + 1) & mask) {
+    s = &in->slots[idx];
+    if(!s->str)
+      return s;
+
+    if(s->hash == hash && s->len == len && !memcmp(s->str, str, len))
+      return s;
+  }
+}
+
+const char *intern_strn_hash(struct intern *in, 
+    const char *str, size_t len, uint64_t hash)
+{
+  struct intern_slot *s;
+  char *copy;
+
+  /* keep it at most 3/4 full, we have no robin hood here */
+  if(!in->cap || (in->cnt + 1) * 4 > in->cap * 3)
+    if(_intern_rehash(in, in->cap ? in->cap * 2 : INTERN_MIN_CAP))
+      return NULL;
+
+  s = _intern_find(in, str, len, hash);
+  if(s->str)
+    return s->str;
+
+  if(!(copy = _intern_alloc(in, len + 1)))
+    return NULL;
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  s->hash = hash;
+  s->len = len;
+  s->str = copy;
+  in->cnt++;
+  return copy;
+}
+
+const char *intern_str(struct intern *in, const char *str)
+{
+  size_t len = strlen(str);
+  return intern_strn_hash(in, str, len, kk_hash(str, len));
+}
+
+const char *intern_lookup(const struct intern *in, const char *str)
+{
+  size_t len = strlen(str);
+
+  if(!in->cnt)
+    return NULL;
+
+  return _intern_find(in, str, len, kk_hash(str, len))->str;
+}
+
+#endif /* _KK_INTERN_IMPL_ */
+
+#endif /* KK_INTERN_IMPL */
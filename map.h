@@ -26,15 +26,64 @@
 #define _KK_MAP_H_
 
 #include "rbtree.h"
+#include "hash.h"
+#include "arena.h"
+#include "intern.h"
+
+/* Keys shorter than this are kept inline in the node, longer ones get 
+ * their own allocation. With 20 and RBTREE_PACKED_COLOR the whole map node 
+ * is exactly 64 bytes, i.e. a single cache line. */
+#ifndef MAP_KEY_INLINE
+# define MAP_KEY_INLINE 20
+#endif
+
+/* Define MAP_STATS to have every map count what it does in map->stats, 
+ * with RBTREE_STATS as well map->rbt.stats has the tree's side of it.
+ * Keys are ordered by hash first, what the tree can't tell you is how often
+ * two different keys shared one, which is what collisions counts. 
+ * If you define MAP_STATS_HOOK(MAP, EV, VAL) as well it is called after 
+ * any operation that ran into collisions, with VAL their number. */
+#ifdef MAP_STATS
+
+enum {
+  MAP_EV_COLLISION,
+};
+
+struct map_stats {
+  size_t inserts;
+  size_t searches;
+  size_t misses;
+  size_t removes;
+  /* keys too long to be kept inline, copied or interned */
+  size_t long_keys;
+  /* comparisons of two keys with the same hash, and how many of them 
+   * turned out to be different keys */
+  size_t hash_ties;
+  size_t collisions;
+};
+
+#endif /* MAP_STATS */
 
 struct map {
-  /* give it good locality allocator for nodes maybe */
   struct rbtree rbt;
+  /* nodes come from here, for locality and to not hit malloc per insert */
+  struct rbpool pool;
+  /* if set long keys are interned here instead of copied per map */
+  struct intern *intern;
+  /* if set nodes and keys are allocated here */
+  struct arena *arena;
+#ifdef MAP_STATS
+  struct map_stats stats;
+#endif
 };
 
+/* Keys are ordered by hash, then length and only then by the bytes, 
+ * so nearly all comparisons are decided without touching the string. */
 struct _map_key {
-  uint8_t hash[8];
-  char *key;
+  uint64_t hash;
+  uint32_t len;
+  /* the key itself if len < MAP_KEY_INLINE, pointer to it otherwise */
+  char buf[MAP_KEY_INLINE];
 };
 
 struct _map_data {
@@ -43,11 +92,64 @@ struct _map_data {
 
 int map_init(struct map *map);
 
+/* Keys that don't fit inline are interned in the shared pool instead of 
+ * being copied, so any number of maps can point to one copy of a key. 
+ * The pool must outlive the map. */
+int map_init_intern(struct map *map, struct intern *intern);
+
+/* Nodes and keys come from the arena, resetting it disposes of the map 
+ * and there is no need for map_destroy. Removed nodes are still reused. */
+int map_init_arena(struct map *map, struct arena *arena);
+
 int map_insert(struct map *map, const char *key, void *data);
 
 void *map_search(struct map *map, const char *key);
 
+/* Removes the key, its node goes back to the pool for the next insert.
+ * Returns -1 if there was no such key. */
+int map_remove(struct map *map, const char *key);
+
+/* Unlike map_insert, which happily adds a duplicate, replaces the data 
+ * of an existing key in place. Nothing is allocated in that case. */
+int map_insert_or_assign(struct map *map, const char *key, void *data);
+
+/* Removes all keys, the pool keeps its memory for reuse. */
+void map_clear(struct map *map);
+
+/* Releases everything the map holds, map_init it to use it again. */
+void map_destroy(struct map *map);
+
+/* Batched versions of the above, keys are sorted internally so that the tree
+ * can be walked from one key to the next instead of from the root each time.
+ * map_search_batch stores the data found (or NULL) in data[i] for keys[i].
+ * Both return the number of keys inserted/found. */
+size_t map_insert_batch(struct map *map, 
+    const char **keys, void **data, size_t n);
+
+size_t map_search_batch(struct map *map, 
+    const char **keys, void **data, size_t n);
+
+#ifdef MAP_STATS
+
+static inline
+const struct map_stats *map_stats(const struct map *map)
+{
+  return &map->stats;
+}
+
+static inline
+void map_stats_reset(struct map *map)
+{
+  memset(&map->stats, 0, sizeof(map->stats));
+#ifdef RBTREE_STATS
+  rbtree_stats_reset(&map->rbt);
+#endif
+}
 
+/* one line, and one more for the tree with RBTREE_STATS, name is optional */
+void map_stats_dump(const struct map *map, const char *name, FILE *f);
+
+#endif /* MAP_STATS */
 
 #endif /* #ifndef _KK_MAP_H_ */
 
@@ -55,39 +157,135 @@ void *map_search(struct map *map, const char *key);
 
 #ifdef KK_MAP_IMPL
 
+/* the intern pool comes along with the map implementation, the guard in 
+ * intern.h keeps it from being spawned twice when KK_INTERN_IMPL is 
+ * defined in the same unit too */
+#ifndef KK_INTERN_IMPL
+# define KK_INTERN_IMPL
+#endif
+#include "intern.h"
+
 #define MAP_UNLIKELY(X) __builtin_expect((X),0)
 
-int _map_key_init(struct _map_key *mkey, const char *str, bool local)
+_Static_assert(MAP_KEY_INLINE >= sizeof(char*), 
+    "MAP_KEY_INLINE must be able to hold a pointer");
+
+#ifdef MAP_STATS
+
+# ifndef MAP_STATS_HOOK
+#  define MAP_STATS_HOOK(MAP, EV, VAL) ((void)0)
+# endif
+
+/* The comparison doesn't know which map it compares for, so it counts here
+ * and every operation moves what it counted over to its map. */
+static _Thread_local struct {
+  size_t hash_ties;
+  size_t collisions;
+} _map_cmp_stats;
+
+# define MAP_STAT(MAP, FIELD, VAL) ((MAP)->stats.FIELD += (VAL))
+# define MAP_STAT_BEGIN() \
+  (_map_cmp_stats.hash_ties = _map_cmp_stats.collisions = 0)
+# define MAP_STAT_END(MAP) _map_stat_end(MAP)
+
+static inline
+void _map_stat_end(struct map *map)
+{
+  map->stats.hash_ties += _map_cmp_stats.hash_ties;
+  if(MAP_UNLIKELY(_map_cmp_stats.collisions)) {
+    map->stats.collisions += _map_cmp_stats.collisions;
+    MAP_STATS_HOOK(map, MAP_EV_COLLISION, _map_cmp_stats.collisions);
+  }
+}
+
+void map_stats_dump(const struct map *map, const char *name, FILE *f)
+{
+  const struct map_stats *s = &map->stats;
+
+  fprintf(f, "map%s%s: %zu keys, %zu inserts (%zu long keys), "
+      "%zu searches (%zu misses), %zu removes, %zu hash ties, "
+      "%zu collisions\n", name ? " " : "", name ? name : "", map->rbt.cnt, 
+      s->inserts, s->long_keys, s->searches, s->misses, s->removes, 
+      s->hash_ties, s->collisions);
+#ifdef RBTREE_STATS
+  rbtree_stats_dump(&map->rbt, name, f);
+#endif
+}
+
+#else
+# define MAP_STAT(MAP, FIELD, VAL) ((void)0)
+# define MAP_STAT_BEGIN() ((void)0)
+# define MAP_STAT_END(MAP) ((void)0)
+#endif /* MAP_STATS */
+
+static inline
+bool _map_key_is_inline(const struct _map_key *mkey)
+{
+  return mkey->len < MAP_KEY_INLINE;
+}
+
+static inline
+const char *_map_key_str(const struct _map_key *mkey)
+{
+  char *str;
+
+  if(_map_key_is_inline(mkey))
+    return mkey->buf;
+
+  /* buf is not pointer aligned */
+  memcpy(&str, mkey->buf, sizeof(str));
+  return str;
+}
+
+/* local keys point to the string passed in instead of copying it,
+ * they are meant for lookups and must not be freed */
+int _map_key_init(struct map *map, 
+    struct _map_key *mkey, const char *str, bool local)
 {
   size_t len = strlen(str);
+  char *key;
 
-  memset(mkey, 0, sizeof(*mkey));
+  if(len > UINT32_MAX)
+    return -1;
 
-  if(len > sizeof(mkey->hash)/sizeof(mkey->hash[0])) {
-    if(local) {
-      mkey->key = (char*)str; 
-    } else {
-      mkey->key = realloc(NULL, len + 1);
-      if(!mkey->key)
-        return -1;
+  mkey->hash = kk_hash(str, len);
+  mkey->len = len;
 
-      memcpy(mkey->key, str, len);
-      mkey->key[len] = '\0';
-    }
+  if(_map_key_is_inline(mkey)) {
+    memcpy(mkey->buf, str, len + 1);
+    return 0;
+  }
 
-    memcpy(mkey->hash, mkey->key, sizeof(mkey->hash)/sizeof(mkey->hash[0]));
+  if(!local)
+    MAP_STAT(map, long_keys, 1);
+
+  if(local) {
+    key = (char*)str; 
+  } else if(map->intern) {
+    if(!(key = (char*)intern_strn_hash(map->intern, str, len, mkey->hash)))
+      return -1;
   } else {
-    memcpy(mkey->hash, str, len);
+    if(!(key = map->arena 
+          ? arena_realloc(map->arena, NULL, len + 1) 
+          : realloc(NULL, len + 1)))
+      return -1;
+
+    memcpy(key, str, len + 1);
   }
 
+  memcpy(mkey->buf, &key, sizeof(key));
   return 0;
 }
 
-int _map_key_free(struct _map_key *mkey) 
+int _map_key_free(struct map *map, struct _map_key *mkey) 
 {
-  if(mkey->key) {
-    if(realloc(mkey->key, 0)) { /* ignore realloc return value */ };
+  /* interned keys belong to the pool */
+  if(!_map_key_is_inline(mkey) && !map->intern) {
+    if(map->arena)
+      arena_realloc(map->arena, (char*)_map_key_str(mkey), 0);
+    else if(realloc((char*)_map_key_str(mkey), 0)) { /* ignore realloc return value */ };
   }
+  return 0;
 }
 
 static inline 
@@ -96,52 +294,114 @@ int _map_key_cmp(const void *_a, const void *_b)
   const struct _map_key *a = _a;
   const struct _map_key *b = _b;
 
-  int result = memcmp(a->hash, b->hash, 
-      sizeof(a->hash)/sizeof(a->hash[0]));
+  if(a->hash != b->hash)
+    return a->hash < b->hash ? -1 : 1;
 
-  if(MAP_UNLIKELY(!result)) {
-    if(a->key && b->key)
-      return strcmp(a->key, b->key);
-  }
+#ifdef MAP_STATS
+  int ret;
+
+  _map_cmp_stats.hash_ties++;
+  if(MAP_UNLIKELY(a->len != b->len))
+    ret = a->len < b->len ? -1 : 1;
+  else if(_map_key_str(a) == _map_key_str(b))
+    ret = 0;
+  else
+    ret = memcmp(_map_key_str(a), _map_key_str(b), a->len);
+
+  _map_cmp_stats.collisions += ret != 0;
+  return ret;
+#else
+  if(MAP_UNLIKELY(a->len != b->len))
+    return a->len < b->len ? -1 : 1;
 
-  return result;
+  /* same interned string */
+  if(_map_key_str(a) == _map_key_str(b))
+    return 0;
+
+  return memcmp(_map_key_str(a), _map_key_str(b), a->len);
+#endif
 }
 
 int map_init(struct map *map) 
 {
   int ret = -1;
-  if(rbtree_init(&map->rbt, 
+  if(rbpool_init(&map->pool, 
+        rbtree_node_size(sizeof(struct _map_key), sizeof(struct _map_data)),
+        realloc))
+    goto exit;
+
+  if(rbtree_init_pool(&map->rbt, 
         sizeof(struct _map_key),
         sizeof(struct _map_data), 
         _map_key_cmp, 
-        realloc))
+        &map->pool))
     goto exit;
     
+  map->intern = NULL;
+  map->arena = NULL;
+#ifdef MAP_STATS
+  memset(&map->stats, 0, sizeof(map->stats));
+#endif
   ret = 0;
 exit:
   return ret;
 }
 
+int map_init_intern(struct map *map, struct intern *intern)
+{
+  if(map_init(map))
+    return -1;
+
+  map->intern = intern;
+  return 0;
+}
+
+int map_init_arena(struct map *map, struct arena *arena)
+{
+  if(rbpool_init_arena(&map->pool, 
+        rbtree_node_size(sizeof(struct _map_key), sizeof(struct _map_data)),
+        arena))
+    return -1;
+
+  if(rbtree_init_pool(&map->rbt, 
+        sizeof(struct _map_key),
+        sizeof(struct _map_data), 
+        _map_key_cmp, 
+        &map->pool))
+    return -1;
+
+  map->intern = NULL;
+  map->arena = arena;
+#ifdef MAP_STATS
+  memset(&map->stats, 0, sizeof(map->stats));
+#endif
+  return 0;
+}
+
 int map_insert(struct map *map, const char *key, void *data) 
 {
   int ret = -1;
   struct rbnode *rbn;
   struct _map_key mkey = {};
 
-  if(_map_key_init(&mkey, key, false))
+  if(_map_key_init(map, &mkey, key, false))
     goto exit;
 
+  MAP_STAT_BEGIN();
   rbn = rbtree_insert(&map->rbt, &mkey);
+  MAP_STAT_END(map);
   if(!rbn) 
     goto cleanup;
 
+  MAP_STAT(map, inserts, 1);
+
   struct _map_data *mdata = rbnode_get_data(&map->rbt, rbn);
   mdata->data = data;
 
   ret = 0;
   goto exit;
 cleanup:
-  _map_key_free(&mkey);
+  _map_key_free(map, &mkey);
 exit:
   return ret;
 }
@@ -151,14 +411,211 @@ void *map_search(struct map *map, const char *key)
   struct rbnode *rbn;
   struct _map_key mkey = {};
 
-  if(_map_key_init(&mkey, key, true))
+  if(_map_key_init(map, &mkey, key, true))
     return NULL;
 
+  MAP_STAT_BEGIN();
   rbn = rbtree_search(&map->rbt, &mkey);
-  if(!rbn) 
+  MAP_STAT_END(map);
+  MAP_STAT(map, searches, 1);
+  if(!rbn) {
+    MAP_STAT(map, misses, 1);
     return NULL;
+  }
 
   return ((struct _map_data*)rbnode_get_data(&map->rbt, rbn))->data;
 }
 
+int map_remove(struct map *map, const char *key)
+{
+  struct rbnode *rbn;
+  struct _map_key mkey = {};
+
+  if(_map_key_init(map, &mkey, key, true))
+    return -1;
+
+  MAP_STAT_BEGIN();
+  rbn = rbtree_search(&map->rbt, &mkey);
+  MAP_STAT_END(map);
+  if(!rbn) 
+    return -1;
+
+  MAP_STAT(map, removes, 1);
+  _map_key_free(map, (struct _map_key*)rbnode_get_key(&map->rbt, rbn));
+  rbtree_delete(&map->rbt, rbn);
+  return 0;
+}
+
+int map_insert_or_assign(struct map *map, const char *key, void *data)
+{
+  bool inserted;
+  struct rbnode *rbn;
+  struct _map_key mkey = {}, *nkey;
+
+  /* look up with a local key, only a new node gets a key of its own */
+  if(_map_key_init(map, &mkey, key, true))
+    return -1;
+
+  MAP_STAT_BEGIN();
+  rbn = rbtree_insert_unique(&map->rbt, &mkey, &inserted);
+  MAP_STAT_END(map);
+  if(!rbn) 
+    return -1;
+
+  if(inserted) {
+    MAP_STAT(map, inserts, 1);
+    /* same hash and length so the node stays where it is */
+    nkey = (struct _map_key*)rbnode_get_key(&map->rbt, rbn);
+    if(_map_key_init(map, nkey, key, false)) {
+      rbtree_delete(&map->rbt, rbn);
+      return -1;
+    }
+  }
+
+  ((struct _map_data*)rbnode_get_data(&map->rbt, rbn))->data = data;
+  return 0;
+}
+
+static 
+void _map_node_free(struct rbnode *n, void *user)
+{
+  struct map *map = user;
+
+  _map_key_free(map, (struct _map_key*)rbnode_get_key(&map->rbt, n));
+  rbpool_free(&map->pool, n);
+}
+
+static 
+void _map_node_key_free(struct rbnode *n, void *user)
+{
+  struct map *map = user;
+  _map_key_free(map, (struct _map_key*)rbnode_get_key(&map->rbt, n));
+}
+
+void map_clear(struct map *map)
+{
+  /* postorder is fine with us freeing the nodes as we go */
+  rbtree_postorder(&map->rbt, _map_node_free, map);
+  map->rbt.root = NULL;
+  map->rbt.cnt = 0;
+}
+
+void map_destroy(struct map *map)
+{
+  /* interned keys belong to the pool so there is nothing to walk for */
+  if(!map->intern && !map->arena)
+    rbtree_inorder(&map->rbt, _map_node_key_free, map);
+
+  /* the pool is ours alone, no need to free the nodes one by one */
+  rbpool_cleanup(&map->pool);
+  memset(map, 0, sizeof(*map));
+}
+
+struct _map_batch {
+  struct _map_key mkey; /* must go first, we sort with _map_key_cmp */
+  size_t idx;
+};
+
+static
+struct _map_batch *_map_batch_new(struct map *map, 
+    const char **keys, size_t n, bool local)
+{
+  size_t i;
+  struct _map_batch *b = realloc(NULL, n * sizeof(*b));
+  if(!b)
+    return NULL;
+
+  for(i = 0; i < n; ++i) {
+    b[i].idx = i;
+    if(_map_key_init(map, &b[i].mkey, keys[i], local))
+      goto fail;
+  }
+
+  qsort(b, n, sizeof(*b), _map_key_cmp);
+  return b;
+
+fail:
+  while(!local && i--)
+    _map_key_free(map, &b[i].mkey);
+  free(b);
+  return NULL;
+}
+
+size_t map_insert_batch(struct map *map, 
+    const char **keys, void **data, size_t n)
+{
+  size_t i, cnt;
+  struct rbnode **nodes = NULL;
+  struct _map_batch *b = NULL;
+
+  if(!n)
+    return 0;
+
+  if(!(nodes = realloc(NULL, n * sizeof(*nodes))))
+    goto exit;
+
+  if(!(b = _map_batch_new(map, keys, n, false)))
+    goto exit;
+
+  /* sorting the batch compared its own keys, that's not on the map */
+  MAP_STAT_BEGIN();
+  cnt = rbtree_insert_batch(&map->rbt, b, sizeof(*b), n, nodes);
+  MAP_STAT_END(map);
+  MAP_STAT(map, inserts, cnt);
+
+  for(i = 0; i < n; ++i) {
+    if(nodes[i])
+      ((struct _map_data*)rbnode_get_data(&map->rbt, nodes[i]))->data
+        = data[b[i].idx];
+    else
+      _map_key_free(map, &b[i].mkey);
+  }
+
+  free(b);
+  free(nodes);
+  return cnt;
+
+exit:
+  free(nodes);
+  return 0;
+}
+
+size_t map_search_batch(struct map *map, 
+    const char **keys, void **data, size_t n)
+{
+  size_t i, cnt;
+  struct rbnode **nodes = NULL;
+  struct _map_batch *b = NULL;
+
+  if(!n)
+    return 0;
+
+  if(!(nodes = realloc(NULL, n * sizeof(*nodes))))
+    goto exit;
+
+  if(!(b = _map_batch_new(map, keys, n, true)))
+    goto exit;
+
+  MAP_STAT_BEGIN();
+  cnt = rbtree_search_batch(&map->rbt, b, sizeof(*b), n, nodes);
+  MAP_STAT_END(map);
+  MAP_STAT(map, searches, n);
+  MAP_STAT(map, misses, n - cnt);
+
+  for(i = 0; i < n; ++i)
+    data[b[i].idx] = nodes[i] 
+      ? ((struct _map_data*)rbnode_get_data(&map->rbt, nodes[i]))->data 
+      : NULL;
+
+  free(b);
+  free(nodes);
+  return cnt;
+
+exit:
+  for(i = 0; i < n; ++i)
+    data[i] = NULL;
+  free(nodes);
+  return 0;
+}
+
 #endif /* #ifdef KK_MAP_IMPL */
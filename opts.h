@@ -105,6 +105,12 @@ enum {
 
 typedef int (opt_parse_proc)(char *arg, void *val);
 
+/* that many parameters per option are stored in the option itself, 
+ * only more than that go to the heap */
+#ifndef OPTS_PARAMS_INLINE
+# define OPTS_PARAMS_INLINE 4
+#endif
+
 struct opt {
 /* set by the user */
   const char *name;
@@ -133,9 +139,19 @@ struct opt {
 
 /* set by the api */
   bool set;
+  /* Up to OPTS_PARAMS_INLINE params live in _params_inline right below, 
+   * so once parsed the table must not be copied or moved, params of the 
+   * copy would still point into the original. */
   struct arr params;
+  union {
+    const char *s;
+    int i;
+    float f;
+  } _params_inline[OPTS_PARAMS_INLINE];
 };
 
+/* Fills in the table in place, which then has to stay where it is, 
+ * see opt::params. */
 int opts_parse(struct opt *opts, int argc, char **argv, uint8_t flags);
 
 /* 
@@ -162,24 +178,26 @@ void opts_print(struct opt *opts, FILE *stream);
 
 #include <errno.h> 
 #include <string.h> 
+#include "hash.h"
 
 /* only internal, no reason for user to use this */
 #define _opts_for(OPT, OPTS) \
   for(struct opt *(OPT) = (OPTS); (OPT) && (OPT)->name; ++(OPT))
 
+/* "--name", looks at no more characters than it has to, no strlen */
 static inline
 const char *_get_opt_name(const char *arg)
 {
-  size_t len = strlen(arg);
-  if(len >= 3 && arg[0] == '-' && arg[1] == '-' && arg[2] != '-')
+  if(arg[0] == '-' && arg[1] == '-' && arg[2] && arg[2] != '-')
     return (arg + 2);
   return NULL;
 }
 
+/* "-s" */
+static inline
 const char *_get_opt_sname(const char *arg) 
 {
-  size_t len = strlen(arg);
-  if(len == 2 && arg[0] == '-' && arg[1] != '-')
+  if(arg[0] == '-' && arg[1] && arg[1] != '-' && !arg[2])
     return (arg + 1);
   return NULL;
 }
@@ -204,15 +222,90 @@ static struct opt * opt_match(struct opt *opts, const char *arg)
   return NULL;
 }
 
+/* Built on every opts_parse call, so matching an argument is a table 
+ * lookup for short names and a hash lookup for long ones instead of 
+ * a strcmp against every option. Slots hold option index + 1, 0 is empty. 
+ * Only single character short names can ever match so 256 slots do. */
+struct _opts_index {
+  struct opt *opts;
+  uint32_t sname[256];
+  uint32_t *name;
+  size_t mask;
+};
+
+static
+int _opts_index_init(struct _opts_index *idx, struct opt *opts)
+{
+  size_t n = 0, cap = 16;
+
+  memset(idx, 0, sizeof(*idx));
+  idx->opts = opts;
+
+  _opts_for(opt, opts)
+    ++n;
+  while(cap < 2 * n)
+    cap <<= 1;
+
+  if(!(idx->name = ARR_REALLOC(NULL, cap * sizeof(*idx->name))))
+    return -1;
+  memset(idx->name, 0, cap * sizeof(*idx->name));
+  idx->mask = cap - 1;
+
+  for(size_t i = 0; i < n; ++i) {
+    const char *sname = opts[i].sname;
+    size_t h = kk_hash_str(opts[i].name) & idx->mask;
+
+    /* the first of options with the same name wins, as with a linear scan */
+    if(sname && sname[0] && !sname[1] && !idx->sname[(uint8_t)sname[0]])
+      idx->sname[(uint8_t)sname[0]] = i + 1;
+
+    for(; idx->name[h]; h = (h + 1) & idx->mask) {
+      if(!strcmp(opts[idx->name[h] - 1].name, opts[i].name))
+        break;
+    }
+    if(!idx->name[h])
+      idx->name[h] = i + 1;
+  }
+  return 0;
+}
+
+static
+void _opts_index_cleanup(struct _opts_index *idx)
+{
+  if(idx->name && ARR_REALLOC(idx->name, 0)) { /* ignore realloc return value */ }
+  idx->name = NULL;
+}
+
+static
+struct opt *_opts_index_match(struct _opts_index *idx, const char *arg)
+{
+  const char *opt_name;
+  const char *opt_sname;
+  uint32_t i;
+
+  if((opt_sname = _get_opt_sname(arg))) {
+    i = idx->sname[(uint8_t)opt_sname[0]];
+    return i ? &idx->opts[i - 1] : NULL;
+  }
+
+  if(!(opt_name = _get_opt_name(arg)))
+    return NULL;
+
+  for(size_t h = kk_hash_str(opt_name) & idx->mask; (i = idx->name[h]); 
+      h = (h + 1) & idx->mask) {
+    if(!strcmp(idx->opts[i - 1].name, opt_name))
+      return &idx->opts[i - 1];
+  }
+  return NULL;
+}
+
 /* TODO: leading whitespace */
 static inline bool _is_opt(char *arg) 
 {
   if(!arg)
     return false;
 
-  size_t len = strlen(arg);
-
-  if(len >= 2 && arg[0] == '-' && arg[1] != '-')
+  if(arg[0] == '-' && arg[1] && arg[1] != '-')
     return true;
 
   //if(len >= 3 && arg[0] == '-' && arg[1] == '-' && arg[2] != '-')
@@ -379,13 +472,28 @@ int opts_postcheck(struct opt *opts)
   return 0;
 }
 
+/* Number of parameters starting at argv[i], up to the next option. */
+static inline
+int _opts_count_params(int argc, char **argv, int i)
+{
+  int n = 0;
+  while(i + n < argc && !_is_opt(argv[i + n]))
+    ++n;
+  return n;
+}
+
 int opts_parse(struct opt *opts, int argc, char **argv, uint8_t flags)
 {
   int ret = -1;
   struct opt *opt = NULL;
+  struct _opts_index idx;
+  bool indexed;
 
   if(opts_precheck(opts))
-    goto exit;
+    return -1;
+
+  /* without the index we just scan, slower but fine */
+  indexed = !_opts_index_init(&idx, opts);
 
 #if OPTS_DEBUG
   fprintf(stderr, "%s cmdline:", __func__);
@@ -408,7 +516,8 @@ int opts_parse(struct opt *opts, int argc, char **argv, uint8_t flags)
         goto parse_as_opt;
 
       if(!arr_alive(&opt->params))
-        arr_init(&opt->params, _opt_param_size(opt));
+        arr_init_inline(&opt->params, _opt_param_size(opt), 
+            opt->_params_inline, OPTS_PARAMS_INLINE);
 
       if(!arg || _is_opt(arg)) {
         if(opt->flags & OPT_MULPARAM && !arr_empty(&opt->params))
@@ -425,6 +534,27 @@ int opts_parse(struct opt *opts, int argc, char **argv, uint8_t flags)
         goto exit;
       }
 
+      if(opt->flags & OPT_MULPARAM && arr_empty(&opt->params)) {
+        int n = _opts_count_params(argc - s, argv, i - s);
+
+        /* Plain strings are just the argv pointers, take them all at once
+         * (and shift them all at once). */
+        if(!opt->parse && !opt_is_int(opt) && !opt_is_float(opt)) {
+          arr_append_raw(&opt->params, &argv[i - s], n);
+          if(opt->params.cnt != (size_t)n)
+            goto exit;
+
+          if(flags & OPT_PARSE_SHIFT)
+            s += _opts_cmdline_shift(argc - i, &argv[i - s], n);
+          i += n - 1;
+          continue;
+        }
+
+        /* the rest parse one by one, into space made once */
+        if(arr_reserve(&opt->params, n))
+          goto exit;
+      }
+
       if(arg) {
         if(opts_set(opt, arg))
           goto exit;
@@ -446,7 +576,8 @@ parse_as_opt:
       break;
 
     if(_is_opt(arg)) {
-      if((opt = opt_match(opts, arg)) && (opt->set = true)) {
+      opt = indexed ? _opts_index_match(&idx, arg) : opt_match(opts, arg);
+      if(opt && (opt->set = true)) {
         /* parsed an option parameter */
         arg = NULL;
 
@@ -465,7 +596,8 @@ parse_as_opt:
   for(struct opt *opt = opts; opt->name; ++opt) {
     if(!opt->set && (opt->flags & OPT_DEFAULT)) {
       opt->set = true;
-      if(arr_init(&opt->params, _opt_param_size(opt)))
+      if(arr_init_inline(&opt->params, _opt_param_size(opt), 
+            opt->_params_inline, OPTS_PARAMS_INLINE))
         goto exit;
       arr_push(&opt->params, _opt_default_param(opt));
     }
@@ -485,6 +617,8 @@ parse_as_opt:
   OPTS_ASSERT(opts_postcheck(opts) == 0);
   ret = 0;
 exit:
+  if(indexed)
+    _opts_index_cleanup(&idx);
   return ret;
 }
 
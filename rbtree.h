@@ -44,6 +44,7 @@
 #include <time.h>
 #include <stdint.h>
 #include "arr.h"
+#include "arena.h"
 
 #ifndef RB_REALLOC
 # include <stdlib.h> 
@@ -55,6 +56,12 @@
 # define RB_ASSERT(COND) assert(COND)
 #endif
 
+/* batched operations prefetch both children ahead of each comparison,
+ * define it empty to turn that off */
+#ifndef RB_PREFETCH
+# define RB_PREFETCH(PTR) __builtin_prefetch(PTR)
+#endif
+
 /* This macro definition controls whether we pass node itself 
  * or only the node'skk/
  */
@@ -82,9 +89,14 @@
 #define RB_RED 1
 #define RB_BLACK 0
 
-/* TODO: require RB_REALLOC to return aligned address and store
- * colour in the  lower bits of the parent or data pointer, what about that?.
+/* Define RBTREE_PACKED_COLOR to keep the colour in the lowest bit of the 
+ * parent pointer, which takes the node from 32 down to 24 bytes on 64bit.
+ * It requires nodes to be at least 2 byte aligned, which malloc, RB_REALLOC 
+ * and the node pool all guarantee, but mind it with a custom realloc hook.
  */
+#ifndef RBTREE_PACKED_COLOR
+# define RBTREE_PACKED_COLOR 0
+#endif
 
 /* keys and data are stored locally within the rbnode struct to save
  * dereference, this solution is more general and so if you wish to store 
@@ -93,24 +105,148 @@
  * This also allows for mixed solution where e.g. you store a hash plus 
  * a pointer to the actual value in the key. */
 struct rbnode {
+#if RBTREE_PACKED_COLOR
+  uintptr_t pc; /* parent | colour, use rb_parent() */
+#else
   struct rbnode *p; 
+#endif
   struct rbnode *l; 
   struct rbnode *r;
+#if !RBTREE_PACKED_COLOR
   bool col;
+#endif
 };
 
 typedef int (rbtree_cmp_proc)(const void *, const void*);
 typedef void *(rbtree_realloc_proc)(void *, size_t);
 
+/* Node pool.
+ * Nodes are carved out of big chunks taken from the realloc hook and
+ * deleted nodes go onto a free list to be reused by the next insert, 
+ * so a tree of a million keys costs a handful of allocations instead 
+ * of a million and the nodes stay close together in memory. 
+ * The pool may be shared by any number of trees as long as their nodes
+ * fit in nodesz, chunks are only ever returned all at once by rbpool_cleanup.
+ */
+#ifndef RBPOOL_CHUNK_SIZE
+# define RBPOOL_CHUNK_SIZE (64 * 1024)
+#endif
+
+#ifndef RBPOOL_ALIGN
+# define RBPOOL_ALIGN (2 * sizeof(void*))
+#endif
+
+struct rbpool_chunk {
+  struct rbpool_chunk *next;
+};
+
+struct rbpool {
+  struct rbpool_chunk *chunks;
+  void *free;
+  uint8_t *cur;
+  uint8_t *end;
+  size_t nodesz;
+  rbtree_realloc_proc *realloc;
+  /* if set chunks come from here, and go back only with the arena */
+  struct arena *arena;
+};
+
+/* Define RBTREE_STATS to have every tree count its own comparisons, 
+ * rotations and depth in t->stats, without it none of this exists. 
+ * The counters are plain increments, searches included, so trees searched
+ * from several threads at once only get approximate numbers. 
+ * If you define RBTREE_STATS_HOOK(T, EV, VAL) as well it is called on 
+ * every rotation and whenever the tree gets deeper than ever before, 
+ * with VAL the new depth. */
+#ifdef RBTREE_STATS
+
+enum {
+  RBTREE_EV_ROTATE,
+  RBTREE_EV_DEPTH,
+};
+
+struct rbtree_stats {
+  /* all comparisons, whatever they were for */
+  size_t cmps;
+  /* search, lower/upper bound and every key of a search batch */
+  size_t searches;
+  size_t search_cmps;
+  /* every key inserted, and the comparisons spent finding its place */
+  size_t inserts;
+  size_t insert_cmps;
+  size_t deletes;
+  size_t rotations;
+  /* depth of the deepest node ever inserted, the root being 1 */
+  size_t max_depth;
+};
+
+#endif /* RBTREE_STATS */
+
 struct rbtree {
   struct rbnode *root;
   rbtree_cmp_proc *cmp;
   rbtree_realloc_proc *realloc;
+  struct rbpool *pool;
+  struct arena *arena;
   size_t cnt;
   uint32_t keysize;
   uint32_t datasize;
+#ifdef RBTREE_STATS
+  struct rbtree_stats stats;
+#endif
 };
 
+#ifdef RBTREE_STATS
+
+static inline
+const struct rbtree_stats *rbtree_stats(const struct rbtree *t)
+{
+  return &t->stats;
+}
+
+static inline
+void rbtree_stats_reset(struct rbtree *t)
+{
+  memset(&t->stats, 0, sizeof(t->stats));
+}
+
+/* one line, name is optional */
+RBTREE_API
+void rbtree_stats_dump(const struct rbtree *t, const char *name, FILE *f);
+
+#endif /* RBTREE_STATS */
+
+/* size of a single node with its key and data, 
+ * use it to initialise a pool for a tree */
+static inline
+size_t rbtree_node_size(uint32_t keysize, uint32_t datasize)
+{
+  return sizeof(struct rbnode) + keysize + datasize;
+}
+
+RBTREE_API
+int rbpool_init(struct rbpool *p, size_t nodesz, rbtree_realloc_proc *realloc_cb);
+
+/* Same as above with chunks allocated in the arena. */
+RBTREE_API
+int rbpool_init_arena(struct rbpool *p, size_t nodesz, struct arena *arena);
+
+RBTREE_API
+void *rbpool_alloc(struct rbpool *p);
+
+RBTREE_API
+void rbpool_free(struct rbpool *p, void *n);
+
+/* Allocates n nodes in one contiguous chunk of their own, 
+ * nodes are nodesz apart and are freed as any other node. */
+RBTREE_API
+void *rbpool_alloc_bulk(struct rbpool *p, size_t n);
+
+/* Releases all the chunks at once, every node allocated from 
+ * this pool is invalid afterwards, including the ones still in the trees. */
+RBTREE_API
+void rbpool_cleanup(struct rbpool *p);
+
 RBTREE_API
 int rbtree_init(struct rbtree *t, 
     uint32_t keysize,
@@ -118,12 +254,140 @@ int rbtree_init(struct rbtree *t,
     rbtree_cmp_proc *cmp_cb,
     rbtree_realloc_proc *realloc_cb);
 
+/* Same as rbtree_init but nodes are taken from the pool, 
+ * pool's nodesz must be at least rbtree_node_size(keysize, datasize). */
+RBTREE_API
+int rbtree_init_pool(struct rbtree *t, 
+    uint32_t keysize,
+    uint32_t datasize,
+    rbtree_cmp_proc *cmp_cb,
+    struct rbpool *pool);
+
+/* Nodes are allocated straight from the arena. Deleted nodes are not 
+ * reused, so for trees with lots of deletes prefer a pool in the arena.
+ * Resetting the arena takes the tree down with it, no cleanup needed. */
+RBTREE_API
+int rbtree_init_arena(struct rbtree *t, 
+    uint32_t keysize,
+    uint32_t datasize,
+    rbtree_cmp_proc *cmp_cb,
+    struct arena *arena);
+
+/* Frees every node of the tree one by one (no stack, no allocation).
+ * If the pool is owned by this tree only you may as well skip it 
+ * and release everything in bulk with rbpool_cleanup. */
+RBTREE_API
+void rbtree_cleanup(struct rbtree *t);
+
 RBTREE_API
 struct rbnode *rbtree_insert(struct rbtree *t, const void *key);
 
 RBTREE_API
 struct rbnode *rbtree_search(const struct rbtree *t, const void *key);
 
+/* Returns the node with an equal key if there is one, otherwise inserts 
+ * the key and returns the new node, *inserted tells which one happened.
+ * A single descent either way, NULL only on allocation failure. */
+RBTREE_API
+struct rbnode *rbtree_insert_unique(struct rbtree *t, const void *key, 
+    bool *inserted);
+
+/* Unlinks n and gives it back to the pool/allocator. */
+RBTREE_API
+void rbtree_delete(struct rbtree *t, struct rbnode *n);
+
+/* Batched insert and search, keys are stride bytes apart (0 means keysize).
+ * Each descent resumes from the node of the previous key instead of the root,
+ * so for keys sorted in t->cmp order it only climbs as far as it must, which 
+ * for dense batches is a couple of nodes. Unsorted batches still work, 
+ * a key smaller than the previous one simply starts over from the root.
+ * out is optional and receives the inserted/found node (or NULL) per key.
+ * Insert returns number of keys inserted, which is short of n only 
+ * on allocation failure, search returns number of keys found. */
+RBTREE_API
+size_t rbtree_insert_batch(struct rbtree *t, 
+    const void *keys, size_t stride, size_t n, struct rbnode **out);
+
+RBTREE_API
+size_t rbtree_search_batch(const struct rbtree *t, 
+    const void *keys, size_t stride, size_t n, struct rbnode **out);
+
+/* Builds a perfectly balanced tree out of n keys (and data if not NULL)
+ * sorted in the order of t->cmp, both packed tightly by keysize/datasize.
+ * Takes linear time and no comparisons at all, the tree must be empty.
+ * With a pool all nodes go into a single block laid out in key order. */
+RBTREE_API
+int rbtree_build_sorted(struct rbtree *t, 
+    const void *keys, const void *data, size_t n);
+
+/* same as above but takes the keys and optionally data from arrays */
+RBTREE_API
+int rbtree_build_sorted_arr(struct rbtree *t, 
+    const struct arr *keys, const struct arr *data);
+
+typedef void (rbtree_traverse_proc)(struct rbnode *, void *user);
+
+/* None of the traversals allocate, they walk the parent links instead. 
+ * The callback must not modify the tree, except for postorder where it 
+ * may free the node it has been given. */
+RBTREE_API
+int rbtree_preorder(struct rbtree *t, rbtree_traverse_proc *cb, void *user);
+
+RBTREE_API
+int rbtree_inorder(struct rbtree *t, rbtree_traverse_proc *cb, void *user);
+
+RBTREE_API
+int rbtree_postorder(struct rbtree *t, rbtree_traverse_proc *cb, void *user);
+
+/* This one needs a queue though, of at most t->cnt entries. */
+RBTREE_API
+int rbtree_levelorder(struct rbtree *t, rbtree_traverse_proc *cb, void *user);
+
+RBTREE_API
+struct rbnode *rbtree_min(struct rbnode *n);
+
+RBTREE_API
+struct rbnode *rbtree_max(struct rbnode *n);
+
+RBTREE_API
+struct rbnode *rbtree_successor(struct rbtree *t, struct rbnode *n);
+
+RBTREE_API
+struct rbnode *rbtree_predecessor(struct rbtree *t, struct rbnode *n);
+
+/* first node with key not less than the given one, NULL if none */
+RBTREE_API
+struct rbnode *rbtree_lower_bound(const struct rbtree *t, const void *key);
+
+/* first node with key greater than the given one, NULL if none */
+RBTREE_API
+struct rbnode *rbtree_upper_bound(const struct rbtree *t, const void *key);
+
+/* Visits in order every node with lo <= key <= hi, NULL lo or hi leaves 
+ * that side unbounded. Costs two descents plus one successor step per 
+ * visited node, returns number of nodes visited. */
+RBTREE_API
+size_t rbtree_for_range(struct rbtree *t, const void *lo, const void *hi,
+    rbtree_traverse_proc *cb, void *user);
+
+static inline
+struct rbnode *rbtree_first(const struct rbtree *t)
+{
+  return t->root ? rbtree_min(t->root) : NULL;
+}
+
+static inline
+struct rbnode *rbtree_last(const struct rbtree *t)
+{
+  return t->root ? rbtree_max(t->root) : NULL;
+}
+
+/* in order cursor loop, same rules as for the traversal callbacks apply */
+#define rbtree_for(VAR, T) \
+  for(struct rbnode *VAR = rbtree_first(T);\
+      (VAR);\
+      VAR = rbtree_successor((T), VAR))
+
 static inline
 const void *rbnode_get_key(const struct rbtree *t, struct rbnode *n)
 {
@@ -143,18 +407,41 @@ void *rbnode_get_data(const struct rbtree *t, struct rbnode *n)
 
 #ifdef KK_RBTREE_IMPL
 
-static inline bool rb_is_red(struct rbnode *n) 
+#if RBTREE_PACKED_COLOR
+
+static inline struct rbnode *rb_parent(const struct rbnode *n) 
 {
-  return (n->col == RB_RED);
+  return (struct rbnode*)(n->pc & ~(uintptr_t)1);
 }
 
-static inline bool rb_is_black(struct rbnode *n) 
+static inline void rb_set_parent(struct rbnode *n, struct rbnode *p) 
+{
+  RB_ASSERT(!((uintptr_t)p & 1));
+  n->pc = (uintptr_t)p | (n->pc & 1);
+}
+
+static inline void rb_set_color(struct rbnode *n, bool col) 
+{
+  n->pc = (n->pc & ~(uintptr_t)1) | (uintptr_t)col;
+}
+
+static inline bool rb_get_color(struct rbnode *n) 
 {
-  return (!n || n->col == RB_BLACK);
+  return (n->pc & 1);
+}
+
+#else
+
+static inline struct rbnode *rb_parent(const struct rbnode *n) 
+{
+  return n->p;
+}
+
+static inline void rb_set_parent(struct rbnode *n, struct rbnode *p) 
+{
+  n->p = p;
 }
 
-/* I am thinking that if node's addresses are aligned
- * we may store colour in the it's lower bits, hence function */
 static inline void rb_set_color(struct rbnode *n, bool col) 
 {
   n->col = col;
@@ -165,11 +452,94 @@ static inline bool rb_get_color(struct rbnode *n)
   return n->col;
 }
 
+#endif
+
+static inline bool rb_is_red(struct rbnode *n) 
+{
+  return (rb_get_color(n) == RB_RED);
+}
+
+static inline bool rb_is_black(struct rbnode *n) 
+{
+  return (!n || rb_get_color(n) == RB_BLACK);
+}
+
 static inline void rb_copy_color(struct rbnode *dst, struct rbnode *src) 
 {
   rb_set_color(dst, rb_get_color(src));
 }
 
+#ifdef RBTREE_STATS
+
+# ifndef RBTREE_STATS_HOOK
+#  define RBTREE_STATS_HOOK(T, EV, VAL) ((void)0)
+# endif
+
+/* searches take a const tree, the counters are fair game nonetheless */
+# define RB_STAT(T, FIELD, VAL) \
+  (((struct rbtree*)(T))->stats.FIELD += (VAL))
+/* OPS grows by N and CMPS by the comparisons made since RB_STAT_MARK */
+# define RB_STAT_MARK(T) size_t _rb_cmps0 = (T)->stats.cmps
+# define RB_STAT_OP(T, OPS, CMPS, N) \
+  (RB_STAT(T, OPS, N), RB_STAT(T, CMPS, (T)->stats.cmps - _rb_cmps0))
+
+static inline
+void _rbtree_stat_rotate(struct rbtree *t)
+{
+  t->stats.rotations++;
+  RBTREE_STATS_HOOK(t, RBTREE_EV_ROTATE, t->stats.rotations);
+}
+
+/* depth of a node just linked in, before any fixup */
+static inline
+void _rbtree_stat_depth(struct rbtree *t, size_t d)
+{
+  if(d > t->stats.max_depth) {
+    t->stats.max_depth = d;
+    RBTREE_STATS_HOOK(t, RBTREE_EV_DEPTH, d);
+  }
+}
+
+/* for descents that didn't start at the root */
+static inline
+size_t _rbtree_depth(const struct rbnode *n)
+{
+  size_t d = 1;
+
+  while((n = rb_parent(n)))
+    d++;
+  return d;
+}
+
+RBTREE_API
+void rbtree_stats_dump(const struct rbtree *t, const char *name, FILE *f)
+{
+  const struct rbtree_stats *s = &t->stats;
+
+  fprintf(f, "rbtree%s%s: %zu nodes, max depth %zu, %zu searches "
+      "(%.2f cmps/search), %zu inserts (%.2f cmps/insert), %zu deletes, "
+      "%zu rotations, %zu cmps\n", name ? " " : "", name ? name : "", 
+      t->cnt, s->max_depth, 
+      s->searches, s->searches ? (double)s->search_cmps / s->searches : 0.0,
+      s->inserts, s->inserts ? (double)s->insert_cmps / s->inserts : 0.0,
+      s->deletes, s->rotations, s->cmps);
+}
+
+#else
+# define RB_STAT(T, FIELD, VAL) ((void)0)
+# define RB_STAT_MARK(T)
+# define RB_STAT_OP(T, OPS, CMPS, N) ((void)0)
+# define _rbtree_stat_rotate(T) ((void)0)
+# define _rbtree_stat_depth(T, N) ((void)0)
+#endif /* RBTREE_STATS */
+
+static inline
+int _rb_cmp(const struct rbtree *t, const void *a, const void *b)
+{
+  RB_STAT(t, cmps, 1);
+  return t->cmp(a, b);
+}
+
 int rbtree_init(struct rbtree *t, 
     uint32_t keysize,
     uint32_t datasize,
@@ -184,6 +554,142 @@ int rbtree_init(struct rbtree *t,
   return 0;
 }
 
+RBTREE_API
+int rbtree_init_arena(struct rbtree *t, 
+    uint32_t keysize,
+    uint32_t datasize,
+    rbtree_cmp_proc *cmp_cb,
+    struct arena *arena)
+{
+  if(rbtree_init(t, keysize, datasize, cmp_cb, NULL))
+    return -1;
+
+  t->arena = arena;
+  return 0;
+}
+
+static inline
+void *_rb_realloc(struct arena *arena, 
+    rbtree_realloc_proc *realloc_cb, void *ptr, size_t sz)
+{
+  return arena ? arena_realloc(arena, ptr, sz) : realloc_cb(ptr, sz);
+}
+
+#define _RBPOOL_ROUND(X) (((X) + RBPOOL_ALIGN - 1) & ~(RBPOOL_ALIGN - 1))
+
+RBTREE_API
+int rbpool_init(struct rbpool *p, size_t nodesz, rbtree_realloc_proc *realloc_cb)
+{
+  RB_ASSERT(nodesz);
+  memset(p, 0, sizeof(*p));
+  /* we keep the free list link in the node itself */
+  p->nodesz = _RBPOOL_ROUND(nodesz < sizeof(void*) ? sizeof(void*) : nodesz);
+  p->realloc = realloc_cb ? realloc_cb : realloc;
+  return 0;
+}
+
+RBTREE_API
+int rbpool_init_arena(struct rbpool *p, size_t nodesz, struct arena *arena)
+{
+  if(rbpool_init(p, nodesz, NULL))
+    return -1;
+
+  p->arena = arena;
+  return 0;
+}
+
+static
+int _rbpool_add_chunk(struct rbpool *p) 
+{
+  size_t hdrsz = _RBPOOL_ROUND(sizeof(struct rbpool_chunk));
+  size_t cnt = RBPOOL_CHUNK_SIZE > hdrsz + p->nodesz 
+    ? (RBPOOL_CHUNK_SIZE - hdrsz) / p->nodesz : 1;
+  size_t sz = hdrsz + cnt * p->nodesz;
+  struct rbpool_chunk *c = _rb_realloc(p->arena, p->realloc, NULL, sz);
+  if(!c)
+    return -1;
+
+  c->next = p->chunks;
+  p->chunks = c;
+  p->cur = (uint8_t*)c + hdrsz;
+  p->end = (uint8_t*)c + sz;
+  return 0;
+}
+
+RBTREE_API
+void *rbpool_alloc(struct rbpool *p)
+{
+  void *n;
+
+  if(p->free) {
+    n = p->free;
+    p->free = *(void**)n;
+    return n;
+  }
+
+  if(p->cur + p->nodesz > p->end)
+    if(_rbpool_add_chunk(p))
+      return NULL;
+
+  n = p->cur;
+  p->cur += p->nodesz;
+  return n;
+}
+
+RBTREE_API
+void rbpool_free(struct rbpool *p, void *n)
+{
+  *(void**)n = p->free;
+  p->free = n;
+}
+
+RBTREE_API
+void *rbpool_alloc_bulk(struct rbpool *p, size_t n)
+{
+  size_t hdrsz = _RBPOOL_ROUND(sizeof(struct rbpool_chunk));
+  struct rbpool_chunk *c = 
+    _rb_realloc(p->arena, p->realloc, NULL, hdrsz + n * p->nodesz);
+  if(!c)
+    return NULL;
+
+  /* keep bumping from the current chunk, this one is full from the start */
+  c->next = p->chunks;
+  p->chunks = c;
+  return (uint8_t*)c + hdrsz;
+}
+
+RBTREE_API
+void rbpool_cleanup(struct rbpool *p)
+{
+  struct rbpool_chunk *c, *next;
+
+  /* arena chunks go with the arena */
+  for(c = p->arena ? NULL : p->chunks; c; c = next) {
+    next = c->next;
+    p->realloc(c, 0);
+  }
+  p->chunks = NULL;
+  p->free = NULL;
+  p->cur = p->end = NULL;
+}
+
+RBTREE_API
+int rbtree_init_pool(struct rbtree *t, 
+    uint32_t keysize,
+    uint32_t datasize,
+    rbtree_cmp_proc *cmp_cb,
+    struct rbpool *pool)
+{
+  if(!pool || pool->nodesz < rbtree_node_size(keysize, datasize))
+    return -1;
+
+  if(rbtree_init(t, keysize, datasize, cmp_cb, pool->realloc))
+    return -1;
+
+  t->pool = pool;
+  return 0;
+}
+
 static
 int rbnode_init(struct rbtree *t, struct rbnode *n, struct rbnode *parent) 
 {
@@ -193,13 +699,15 @@ int rbnode_init(struct rbtree *t, struct rbnode *n, struct rbnode *parent)
 static
 struct rbnode * rbnode_new(struct rbtree *t, struct rbnode *parent)
 {
-  size_t sz = sizeof(struct rbnode) + t->keysize + t->datasize;
-  struct rbnode *n = t->realloc(NULL, sz);
+  size_t sz = rbtree_node_size(t->keysize, t->datasize);
+  struct rbnode *n = t->pool 
+    ? rbpool_alloc(t->pool) 
+    : _rb_realloc(t->arena, t->realloc, NULL, sz);
   if(!n) 
     return NULL;
 
   memset(n, 0, sz);
-  n->p = parent;
+  rb_set_parent(n, parent);
   rb_set_color(n, parent ? RB_RED : RB_BLACK);
   return n;
 }
@@ -207,7 +715,35 @@ struct rbnode * rbnode_new(struct rbtree *t, struct rbnode *parent)
 static
 void rbnode_free(struct rbtree *t, struct rbnode *n) 
 {
-  t->realloc(n, 0);
+  if(t->pool)
+    rbpool_free(t->pool, n);
+  else
+    _rb_realloc(t->arena, t->realloc, n, 0);
+}
+
+RBTREE_API
+void rbtree_cleanup(struct rbtree *t)
+{
+  struct rbnode *n = t->root, *p;
+
+  /* free leaves bottom up, detaching each from its parent, 
+   * so we never need to remember where we came from */
+  while(n) {
+    if(n->l) { n = n->l; continue; }
+    if(n->r) { n = n->r; continue; }
+
+    if((p = rb_parent(n))) {
+      if(p->l == n) 
+        p->l = NULL;
+      else
+        p->r = NULL;
+    }
+    rbnode_free(t, n);
+    n = p;
+  }
+
+  t->root = NULL;
+  t->cnt = 0;
 }
 
 
@@ -215,96 +751,93 @@ static inline
 struct rbnode **_rbnode_which_child(struct rbnode *n) 
 {
   RB_ASSERT(n);
-  if(n == n->p->r) {
-    return &n->p->r;
+  if(n == rb_parent(n)->r) {
+    return &rb_parent(n)->r;
   } else {
-    RB_ASSERT(n == n->p->l);
-    return &n->p->l;
+    RB_ASSERT(n == rb_parent(n)->l);
+    return &rb_parent(n)->l;
   }
 }
 
-static inline void _rbnode_ptrswap(struct rbnode **a, struct rbnode **b)
-{
-  *(size_t*)a ^= *(size_t*)b; 
-  *(size_t*)b ^= *(size_t*)a; 
-  *(size_t*)a ^= *(size_t*)b; 
-}
-
 static inline void _rbtree_lrot(struct rbtree *t, struct rbnode *n)
 {
-  RB_ASSERT(n->r);
+  struct rbnode *r = n->r;
+  RB_ASSERT(r);
 
-  if(n->p) {
-    *_rbnode_which_child(n) = n->r;
+  if(rb_parent(n)) {
+    *_rbnode_which_child(n) = r;
   } else {
     RB_ASSERT(n == t->root);
-    t->root = n->r;
+    t->root = r;
   }
 
-  if(n->r->l) 
-    n->r->l->p = n;
+  if((n->r = r->l)) 
+    rb_set_parent(r->l, n);
 
-  _rbnode_ptrswap(&n->r->p, &n->r->l);
-  _rbnode_ptrswap(&n->p, &n->r->p);
-  _rbnode_ptrswap(&n->p, &n->r);
+  rb_set_parent(r, rb_parent(n));
+  r->l = n;
+  rb_set_parent(n, r);
+  _rbtree_stat_rotate(t);
 }
 
 static inline void _rbtree_rrot(struct rbtree *t, struct rbnode *n)
 {
-  RB_ASSERT(n->l);
+  struct rbnode *l = n->l;
+  RB_ASSERT(l);
 
-  if(n->p) {
-    *_rbnode_which_child(n) = n->l;
+  if(rb_parent(n)) {
+    *_rbnode_which_child(n) = l;
   } else {
     RB_ASSERT(n == t->root);
-    t->root = n->l;
+    t->root = l;
   }
 
-  if(n->l->r) 
-    n->l->r->p = n;
+  if((n->l = l->r)) 
+    rb_set_parent(l->r, n);
 
-  _rbnode_ptrswap(&n->l->p, &n->l->r);
-  _rbnode_ptrswap(&n->p, &n->l->p);
-  _rbnode_ptrswap(&n->p, &n->l);
+  rb_set_parent(l, rb_parent(n));
+  l->r = n;
+  rb_set_parent(n, l);
+  _rbtree_stat_rotate(t);
 }
 
 static inline void _rbtree_insert_fixup(struct rbtree *t, struct rbnode *n) 
 {
   struct rbnode *gp;
 
-  while(n->p && rb_is_red(n->p)) {
-    gp = n->p->p;
-    RB_ASSERT(n->p != t->root);
+  while(rb_parent(n) && rb_is_red(rb_parent(n))) {
+    gp = rb_parent(rb_parent(n));
+    RB_ASSERT(rb_parent(n) != t->root);
 
-    if(n->p == gp->l) { 
+    if(rb_parent(n) == gp->l) { 
       if(gp->r && rb_is_red(gp->r)) {
-        rb_set_color(n->p, RB_BLACK);
+        rb_set_color(rb_parent(n), RB_BLACK);
         rb_set_color(gp->r, RB_BLACK);
         rb_set_color(gp, RB_RED);
         n = gp;
       } else {
-        if(n == n->p->r) {
-          n = n->p;
+        if(n == rb_parent(n)->r) {
+          n = rb_parent(n);
           _rbtree_lrot(t, n);
         }
-        rb_set_color(n->p, RB_BLACK);
+        rb_set_color(rb_parent(n), RB_BLACK);
         rb_set_color(gp, RB_RED);
         _rbtree_rrot(t, gp);
       }
     } else {
-      RB_ASSERT(n->p == gp->r);
+      RB_ASSERT(rb_parent(n) == gp->r);
 
       if(gp->l && rb_is_red(gp->l)) {
-        rb_set_color(n->p, RB_BLACK);
+        rb_set_color(rb_parent(n), RB_BLACK);
         rb_set_color(gp->l, RB_BLACK);
         rb_set_color(gp, RB_RED);
         n = gp;
       } else {
-        if(n == n->p->l) {
-          n = n->p;
+        if(n == rb_parent(n)->l) {
+          n = rb_parent(n);
           _rbtree_rrot(t, n);
         }
-        rb_set_color(n->p, RB_BLACK);
+        rb_set_color(rb_parent(n), RB_BLACK);
         rb_set_color(gp, RB_RED);
         _rbtree_lrot(t, gp);
       }
@@ -323,25 +856,296 @@ static inline void _rbtree_insert_fixup(struct rbtree *t, struct rbnode *n)
 RBTREE_API
 struct rbnode *rbtree_insert(struct rbtree *t, const void *key)
 {
-  struct rbnode **node = &t->root, *parent = NULL;
+  struct rbnode **node = &t->root, *parent = NULL, *n;
+  RB_STAT_MARK(t);
 
   while(*node) {
     parent = *node;
 
-    if(t->cmp(key, rbnode_get_key(t, *node)) > 0)
+    if(_rb_cmp(t, key, rbnode_get_key(t, *node)) > 0)
       node = &((*node)->r);
     else
       node = &((*node)->l);
   }
 
-  *node = rbnode_new(t, parent);
-  memcpy((char*)rbnode_get_key(t, *node), key, t->keysize);
-  _rbtree_insert_fixup(t, *node);
+  if(!(n = rbnode_new(t, parent)))
+    return NULL;
+
+  /* NOTE: don't return *node, fixup rotations may move another node 
+   * into that slot */
+  *node = n;
+  memcpy((char*)rbnode_get_key(t, n), key, t->keysize);
+  RB_STAT_OP(t, inserts, insert_cmps, 1);
+  /* one comparison per level on the way down from the root */
+  _rbtree_stat_depth(t, t->stats.cmps - _rb_cmps0 + 1);
+  _rbtree_insert_fixup(t, n);
+
+  t->cnt++;
+  return n;
+}
+
+RBTREE_API
+struct rbnode *rbtree_insert_unique(struct rbtree *t, const void *key, 
+    bool *inserted)
+{
+  struct rbnode **node = &t->root, *parent = NULL, *n;
+  int c;
+  RB_STAT_MARK(t);
+
+  *inserted = false;
+
+  while(*node) {
+    parent = *node;
+
+    if(!(c = _rb_cmp(t, key, rbnode_get_key(t, parent)))) {
+      RB_STAT_OP(t, searches, search_cmps, 1);
+      return parent;
+    }
+
+    node = c > 0 ? &parent->r : &parent->l;
+  }
+
+  if(!(n = rbnode_new(t, parent)))
+    return NULL;
+
+  *node = n;
+  memcpy((char*)rbnode_get_key(t, n), key, t->keysize);
+  RB_STAT_OP(t, inserts, insert_cmps, 1);
+  /* one comparison per level on the way down from the root */
+  _rbtree_stat_depth(t, t->stats.cmps - _rb_cmps0 + 1);
+  _rbtree_insert_fixup(t, n);
+
+  t->cnt++;
+  *inserted = true;
+  return n;
+}
+
+
+/* Climbs from the finger f to the root of the smallest subtree key can 
+ * belong to, given key is not smaller than f's key. Returns the parent 
+ * we stopped at in *stop, or NULL when we had to go all the way up. */
+static inline
+struct rbnode *_rbtree_finger(const struct rbtree *t, 
+    struct rbnode *f, const void *key, struct rbnode **stop)
+{
+  struct rbnode *p;
+
+  /* being a right child doesn't narrow the upper bound, 
+   * only the first left turn from below does */
+  for(; (p = rb_parent(f)); f = p) {
+    if(f == p->l && _rb_cmp(t, key, rbnode_get_key(t, p)) <= 0)
+      break;
+  }
+  *stop = p;
+  return f;
+}
+
+RBTREE_API
+size_t rbtree_insert_batch(struct rbtree *t, 
+    const void *keys, size_t stride, size_t n, struct rbnode **out)
+{
+  size_t i, cnt = 0;
+  const uint8_t *key = keys;
+  struct rbnode **node, *parent, *stop, *f = NULL, *nn;
+
+  if(!stride)
+    stride = t->keysize;
+
+  for(i = 0; i < n; ++i, key += stride) {
+    RB_STAT_MARK(t);
+    node = &t->root;
+    parent = NULL;
+
+    /* ties go left, just as in rbtree_insert */
+    if(f && _rb_cmp(t, key, rbnode_get_key(t, f)) > 0) {
+      f = _rbtree_finger(t, f, key, &stop);
+      if(stop) {
+        node = &stop->l;
+        parent = stop;
+      }
+    }
+
+    while(*node) {
+      parent = *node;
+      RB_PREFETCH(parent->l);
+      RB_PREFETCH(parent->r);
+
+      if(_rb_cmp(t, key, rbnode_get_key(t, parent)) > 0)
+        node = &parent->r;
+      else
+        node = &parent->l;
+    }
+
+    if(!(nn = rbnode_new(t, parent)))
+      break;
+
+    *node = nn;
+    memcpy((char*)rbnode_get_key(t, nn), key, t->keysize);
+    RB_STAT_OP(t, inserts, insert_cmps, 1);
+    _rbtree_stat_depth(t, _rbtree_depth(nn));
+    _rbtree_insert_fixup(t, nn);
+    t->cnt++;
+
+    if(out)
+      out[i] = nn;
+    f = nn;
+    cnt++;
+  }
+
+  if(out) 
+    for(; i < n; ++i)
+      out[i] = NULL;
+
+  return cnt;
+}
+
+RBTREE_API
+size_t rbtree_search_batch(const struct rbtree *t, 
+    const void *keys, size_t stride, size_t n, struct rbnode **out)
+{
+  int result;
+  size_t i, cnt = 0;
+  const uint8_t *key = keys;
+  struct rbnode *node, *stop, *f = NULL, *found;
+
+  if(!stride)
+    stride = t->keysize;
+
+  for(i = 0; i < n; ++i, key += stride) {
+    RB_STAT_MARK(t);
+    node = t->root;
+    found = NULL;
+
+    if(f && (result = _rb_cmp(t, key, rbnode_get_key(t, f))) >= 0) {
+      if(!result) {
+        node = NULL;
+        found = f;
+      } else {
+        f = _rbtree_finger(t, f, key, &stop);
+        /* the stop node itself may be the one */
+        node = stop ? stop : f;
+      }
+    }
+
+    while(node) {
+      f = node;
+      RB_PREFETCH(node->l);
+      RB_PREFETCH(node->r);
+      result = _rb_cmp(t, key, rbnode_get_key(t, node));
+
+      /**/ if(result < 0) 
+        node = node->l;
+      else if(result > 0)
+        node = node->r;
+      else
+        break;
+    }
+    found = node ? node : found;
+    RB_STAT_OP(t, searches, search_cmps, 1);
+
+    if(found) {
+      f = found;
+      cnt++;
+    }
+    if(out)
+      out[i] = found;
+  }
+  return cnt;
+}
+
+struct _rbtree_build_data {
+  const uint8_t *keys;
+  const uint8_t *data;
+  uint8_t *block;
+  size_t stride;
+  size_t red_depth;
+};
+
+/* Builds [lo, hi) into *slot, the middle element becomes the subtree root.  
+ * Subtree sizes never differ by more than one so every level but the 
+ * deepest one is full, colouring the deepest level red (and everything 
+ * else black) thus gives every path the same black height. */
+static
+int _rbtree_build(struct rbtree *t, struct _rbtree_build_data *b,
+    struct rbnode *parent, struct rbnode **slot, 
+    size_t lo, size_t hi, size_t depth)
+{
+  size_t mid = lo + (hi - lo) / 2;
+  struct rbnode *n;
+
+  if(lo >= hi)
+    return 0;
+
+  if(b->block) {
+    n = (struct rbnode*)(b->block + mid * b->stride);
+  } else if(!(n = _rb_realloc(t->arena, t->realloc, NULL, b->stride))) {
+    return -1;
+  }
+
+  memset(n, 0, b->stride);
+  rb_set_parent(n, parent);
+  rb_set_color(n, depth == b->red_depth ? RB_RED : RB_BLACK);
+  memcpy((uint8_t*)rbnode_get_key(t, n), b->keys + mid * t->keysize, t->keysize);
+  if(b->data)
+    memcpy(rbnode_get_data(t, n), b->data + mid * t->datasize, t->datasize);
 
+  /* linked right away so on failure rbtree_cleanup can take it apart */
+  *slot = n;
   t->cnt++;
-  return *node;
+
+  if(_rbtree_build(t, b, n, &n->l, lo, mid, depth + 1))
+    return -1;
+
+  return _rbtree_build(t, b, n, &n->r, mid + 1, hi, depth + 1);
+}
+
+RBTREE_API
+int rbtree_build_sorted(struct rbtree *t, 
+    const void *keys, const void *data, size_t n)
+{
+  struct _rbtree_build_data b = {
+    .keys = keys,
+    .data = data,
+  };
+  size_t height = 0;
+
+  if(t->root)
+    return -1;
+
+  if(!n)
+    return 0;
+
+  while((n >> (height + 1)))
+    height++;
+
+  /* a single node is the root, and the root stays black */
+  b.red_depth = height ? height : SIZE_MAX;
+
+  if(t->pool) {
+    b.stride = t->pool->nodesz;
+    if(!(b.block = rbpool_alloc_bulk(t->pool, n)))
+      return -1;
+  } else {
+    b.stride = rbtree_node_size(t->keysize, t->datasize);
+  }
+
+  if(_rbtree_build(t, &b, NULL, &t->root, 0, n, 0)) {
+    rbtree_cleanup(t);
+    return -1;
+  }
+  return 0;
 }
 
+RBTREE_API
+int rbtree_build_sorted_arr(struct rbtree *t, 
+    const struct arr *keys, const struct arr *data)
+{
+  RB_ASSERT(keys->esz == t->keysize);
+  RB_ASSERT(!data || (data->esz == t->datasize && data->cnt == keys->cnt));
+
+  return rbtree_build_sorted(t, 
+      keys->mem, data ? data->mem : NULL, keys->cnt);
+}
 
 static inline size_t ullog2_ceil(size_t x)
 {
@@ -358,12 +1162,6 @@ static inline size_t _rbtree_max_possible_height(struct rbtree *t)
   return (2 * ullog2_ceil(t->cnt));
 }
 
-static inline size_t _rbtree_max_possible_leafs(struct rbtree *t)
-{
-  return (1 << _rbtree_max_possible_height(t));
-}
-
-typedef void (rbtree_traverse_proc)(struct rbnode *, void *user);
 
 void rbnode_sanity(struct rbnode *n) 
 {
@@ -371,127 +1169,109 @@ void rbnode_sanity(struct rbnode *n)
   RB_ASSERT(n != n->r);
   RB_ASSERT(n != n->l);
 
-  if(n->p) {
-    RB_ASSERT(n->p->r == n || n->p->l == n);
-    RB_ASSERT(n->p != n->r);
-    RB_ASSERT(n->p != n->l);
+  if(rb_parent(n)) {
+    RB_ASSERT(rb_parent(n)->r == n || rb_parent(n)->l == n);
+    RB_ASSERT(rb_parent(n) != n->r);
+    RB_ASSERT(rb_parent(n) != n->l);
   }
 }
 
 
+RBTREE_API
 int rbtree_preorder(
     struct rbtree *t, rbtree_traverse_proc *cb, void *user)
 {
-  size_t i = 0, 
-         stack_cap = 4048;//; _rbtree_max_possible_leafs(t);
-
-  struct rbnode *n, **stack = 
-    RB_REALLOC(NULL, stack_cap * sizeof(struct rbnode*));
-
-  if(!(n = t->root))
-    goto exit;
-
-  for(;;) {
-    RB_ASSERT(i <= stack_cap);
+  struct rbnode *n = t->root, *p;
 
+  while(n) {
     cb(n, user);
 
-    if(n->l) { n = (stack[i++] = n)->l; continue; }
+    if(n->l) { n = n->l; continue; }
+    if(n->r) { n = n->r; continue; }
 
-  checkright:
-    if(n->r) { n = (stack[i++] = n)->r; continue; }
-
-  backtrack:
-    if(!i) break;
-
-    if(stack[i-1]->r == n) {
-      n = stack[--i]; goto backtrack;
-    } else {
-      RB_ASSERT(stack[i-1]->l == n);
-      n = stack[--i]; goto checkright;
+    /* backtrack to the closest ancestor with right subtree not yet visited */
+    for(; (p = rb_parent(n)); n = p) {
+      if(n == p->l && p->r) 
+        break;
     }
+    n = p ? p->r : NULL;
   } 
+  return 0;
+}
 
-exit:
-  free(stack);
+RBTREE_API
+int rbtree_inorder(
+    struct rbtree *t, rbtree_traverse_proc *cb, void *user)
+{
+  rbtree_for(n, t)
+    cb(n, user);
   return 0;
 }
 
+/* leftmost node with no children in the subtree, first one in postorder */
+static inline
+struct rbnode *_rbtree_postorder_first(struct rbnode *n)
+{
+  while(n->l || n->r)
+    n = n->l ? n->l : n->r;
+  return n;
+}
 
+RBTREE_API
 int rbtree_postorder(
     struct rbtree *t, rbtree_traverse_proc *cb, void *user)
 {
-  size_t i = 0, 
-         stack_cap = _rbtree_max_possible_leafs(t);
-
-  struct rbnode *n, **stack = 
-    RB_REALLOC(NULL, stack_cap * sizeof(struct rbnode*));
+  struct rbnode *n, *p, *next;
 
-  n = t->root;
+  if(!t->root)
+    return 0;
 
-  for(;;) {
-    RB_ASSERT(i <= stack_cap);
-
-    if(n->l) { n = (stack[i++] = n)->l; continue; }
-
-  checkright:
-    if(n->r) { n = (stack[i++] = n)->r; continue; }
+  for(n = _rbtree_postorder_first(t->root); n; n = next) {
+    /* figure out where to go before cb gets a chance to free the node */
+    p = rb_parent(n);
+    if(p && n == p->l && p->r)
+      next = _rbtree_postorder_first(p->r);
+    else
+      next = p;
 
-  backtrack:
-    // printf("%s node %d %s\n",__func__, *(int*)n->data, rb_is_black(n) ? "black" : "red");
     cb(n, user);
-
-    if(!i) break;
-
-    if(stack[i-1]->r == n) {
-      n = stack[--i]; goto backtrack;
-    } else {
-      RB_ASSERT(stack[i-1]->l == n);
-      n = stack[--i]; goto checkright;
-    }
   } 
-
-  free(stack);
   return 0;
 }
 
+RBTREE_API
 int rbtree_levelorder(
     struct rbtree *t, rbtree_traverse_proc *cb, void *user) 
 {
-  size_t i = 0, queue_end = 0, 
-         queue_cap = _rbtree_max_possible_leafs(t);
+  /* no level holds more than all of the nodes */
+  size_t head = 0, i = 0, queue_cap = t->cnt;
+  struct rbnode *n, **queue;
+
+  if(!t->root)
+    return 0;
 
-  struct rbnode *n, **queue = 
-    RB_REALLOC(NULL, queue_cap * sizeof(struct rbnode*));
+  if(!(queue = RB_REALLOC(NULL, queue_cap * sizeof(struct rbnode*))))
+    return -1;
 
   /* enqueue */
-  queue[queue_end++] = t->root; i++;
-  if(queue_end == queue_cap) queue_end = 0;
+  queue[(head + i++) % queue_cap] = t->root;
 
   while(i) {
     RB_ASSERT(i <= queue_cap);
     /* dequeue */
-    n = queue[
-      queue_end >= i 
-        ? queue_end - (i--)
-        : queue_cap + queue_end - (i--)
-    ];
+    n = queue[head];
+    head = (head + 1) % queue_cap; i--;
 
-    // printf("%s node %d %s\n",__func__, *(int*)n->data, rb_is_black(n) ? "black" : "red");
-
-    //cb(n->data, user);
+    cb(n, user);
 
     /* enqueue */
-    if(n->l) {
-      queue[queue_end++] = n->l; i++;
-      if(queue_end == queue_cap) queue_end = 0;
-    }
-    if(n->r) {
-      queue[queue_end++] = n->r; i++;
-      if(queue_end == queue_cap) queue_end = 0;
-    }
+    if(n->l) 
+      queue[(head + i++) % queue_cap] = n->l;
+    if(n->r) 
+      queue[(head + i++) % queue_cap] = n->r;
   }
   free(queue);
+  return 0;
 }
 
 
@@ -513,7 +1293,7 @@ void _rbtree_validate_traverse_cb(struct rbnode *n, void *user)
         bheight++;
       else
         RB_ASSERT(rb_is_black(n->l) && rb_is_black(n->r));
-      n = n->p;
+      n = rb_parent(n);
     }
 
     /* if we have at least one node, this must be 
@@ -533,12 +1313,14 @@ int rbtree_validate(struct rbtree *t) {
 
   /* property 4 & 5 */
   rbtree_preorder(t, _rbtree_validate_traverse_cb, &v);
+  return 0;
 }
 
 void rbtree_print(struct rbtree *t)
 {
 }
 
+RBTREE_API
 struct rbnode *rbtree_min(struct rbnode *n) 
 {
   while(n->l) 
@@ -546,6 +1328,7 @@ struct rbnode *rbtree_min(struct rbnode *n)
   return n;
 }
 
+RBTREE_API
 struct rbnode *rbtree_max(struct rbnode *n)
 {
   while(n->r)
@@ -553,30 +1336,32 @@ struct rbnode *rbtree_max(struct rbnode *n)
   return n;
 }
 
+RBTREE_API
 struct rbnode *rbtree_successor(struct rbtree *t, struct rbnode *n) 
 {
   if(n->r)
     return rbtree_min(n->r);
 
-  while(n->p) {
-    if(n == n->p->l)
-      return n->p;
+  while(rb_parent(n)) {
+    if(n == rb_parent(n)->l)
+      return rb_parent(n);
 
-    n = n->p;
+    n = rb_parent(n);
   }
   return NULL;
 }
 
+RBTREE_API
 struct rbnode *rbtree_predecessor(struct rbtree *t, struct rbnode *n)
 {
   if(n->l)
     return rbtree_max(n->l);
 
-  while(n->p) {
-    if(n == n->p->r)
-      return n->p;
+  while(rb_parent(n)) {
+    if(n == rb_parent(n)->r)
+      return rb_parent(n);
 
-    n = n->p;
+    n = rb_parent(n);
   }
   return NULL;
 }
@@ -584,7 +1369,7 @@ struct rbnode *rbtree_predecessor(struct rbtree *t, struct rbnode *n)
 struct rbnode *rbtree_transplant(
     struct rbtree *t, struct rbnode *u, struct rbnode *v) 
 {
-  if(u->p) {
+  if(rb_parent(u)) {
     *_rbnode_which_child(u) = v;
   } else {
     RB_ASSERT(u == t->root);
@@ -592,7 +1377,7 @@ struct rbnode *rbtree_transplant(
   }
 
   if(v) 
-    v->p = u->p;
+    rb_set_parent(v, rb_parent(u));
 
   return v;
 }
@@ -601,18 +1386,75 @@ struct rbnode *rbtree_search(const struct rbtree *t, const void *key)
 {
   int result;
   struct rbnode *node = t->root;
+  RB_STAT_MARK(t);
 
   while(node) {
-    result = t->cmp(key, rbnode_get_key(t, node));
+    result = _rb_cmp(t, key, rbnode_get_key(t, node));
 
     /**/ if(result < 0) 
       node = node->l;
     else if(result > 0)
       node = node->r;
     else
-      return node;
+      break;
   }
-  return NULL;
+  RB_STAT_OP(t, searches, search_cmps, 1);
+  return node;
+}
+
+RBTREE_API
+struct rbnode *rbtree_lower_bound(const struct rbtree *t, const void *key) 
+{
+  struct rbnode *node = t->root, *ret = NULL;
+  RB_STAT_MARK(t);
+
+  while(node) {
+    if(_rb_cmp(t, key, rbnode_get_key(t, node)) > 0) {
+      node = node->r;
+    } else {
+      ret = node;
+      node = node->l;
+    }
+  }
+  RB_STAT_OP(t, searches, search_cmps, 1);
+  return ret;
+}
+
+RBTREE_API
+struct rbnode *rbtree_upper_bound(const struct rbtree *t, const void *key) 
+{
+  struct rbnode *node = t->root, *ret = NULL;
+  RB_STAT_MARK(t);
+
+  while(node) {
+    if(_rb_cmp(t, key, rbnode_get_key(t, node)) >= 0) {
+      node = node->r;
+    } else {
+      ret = node;
+      node = node->l;
+    }
+  }
+  RB_STAT_OP(t, searches, search_cmps, 1);
+  return ret;
+}
+
+RBTREE_API
+size_t rbtree_for_range(struct rbtree *t, const void *lo, const void *hi,
+    rbtree_traverse_proc *cb, void *user)
+{
+  size_t cnt = 0;
+  struct rbnode *n, *end;
+
+  if(lo && hi && _rb_cmp(t, lo, hi) > 0)
+    return 0;
+
+  n = lo ? rbtree_lower_bound(t, lo) : rbtree_first(t);
+  end = hi ? rbtree_upper_bound(t, hi) : NULL;
+
+  for(; n != end; n = rbtree_successor(t, n), cnt++)
+    cb(n, user);
+
+  return cnt;
 }
 
 static
@@ -637,14 +1479,14 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
 
   RB_ASSERT(n);
 
-  while(n->p && rb_is_black(n)) {
-    //DUMPNODE(n->p);
+  while(rb_parent(n) && rb_is_black(n)) {
+    //DUMPNODE(rb_parent(n));
     //DUMPNODE(n);
-    //DUMPNODE(n->p->r);
-    //DUMPNODE(n->p->l);
+    //DUMPNODE(rb_parent(n)->r);
+    //DUMPNODE(rb_parent(n)->l);
 
-    if(n == n->p->l) {
-      w = n->p->r;
+    if(n == rb_parent(n)->l) {
+      w = rb_parent(n)->r;
 
       RB_ASSERT(w);
 
@@ -662,12 +1504,12 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
          * This way we convert case 1 into case 2,3 or 4.
          */
         //printf("%s case 1\n", __func__);
-        RB_ASSERT(rb_is_black(n->p));
+        RB_ASSERT(rb_is_black(rb_parent(n)));
 
-        rb_set_color(n->p, RB_RED);
+        rb_set_color(rb_parent(n), RB_RED);
         rb_set_color(w, RB_BLACK);
-        _rbtree_lrot(t, n->p);
-        w = n->p->r;
+        _rbtree_lrot(t, rb_parent(n));
+        w = rb_parent(n)->r;
       }
 
       RB_ASSERT(rb_is_black(w));
@@ -688,7 +1530,7 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
            */
           //printf("%s case 2\n", __func__);
           rb_set_color(w, RB_RED);
-          n = n->p;
+          n = rb_parent(n);
       } else {
         if(rb_is_black(w->r)) {
           /* Case 3
@@ -709,8 +1551,8 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
           rb_set_color(w, RB_RED);
           rb_set_color(w->l, RB_BLACK);
           _rbtree_rrot(t, w);
-          RB_ASSERT(n->p->r == w->p); /* REMOVEME */
-          w = n->p->r;
+          RB_ASSERT(rb_parent(n)->r == rb_parent(w)); /* REMOVEME */
+          w = rb_parent(n)->r;
         }
 
         /* Case 4
@@ -725,30 +1567,30 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
          * One can verify that this will indeed restore the 5th property.
          */
         //printf("%s case 4\n", __func__);
-        rb_copy_color(w, n->p);
+        rb_copy_color(w, rb_parent(n));
         rb_set_color(w->r, RB_BLACK);
-        rb_set_color(n->p, RB_BLACK);
-        _rbtree_lrot(t, n->p);
+        rb_set_color(rb_parent(n), RB_BLACK);
+        _rbtree_lrot(t, rb_parent(n));
         n = t->root;
       }
     } else {
       /* 
        * All cases in this branch are symmetric to the cases in the other branch
        */
-      RB_ASSERT(n == n->p->r);
+      RB_ASSERT(n == rb_parent(n)->r);
 
-      w = n->p->l;
+      w = rb_parent(n)->l;
       RB_ASSERT(w);
 
       if(rb_is_red(w)) {
         /* Case 1 reversed */
         //printf("%s case 1\n", __func__);
-        RB_ASSERT(rb_is_black(n->p));
+        RB_ASSERT(rb_is_black(rb_parent(n)));
 
-        rb_set_color(n->p, RB_RED);
+        rb_set_color(rb_parent(n), RB_RED);
         rb_set_color(w, RB_BLACK);
-        _rbtree_rrot(t, n->p);
-        w = n->p->l;
+        _rbtree_rrot(t, rb_parent(n));
+        w = rb_parent(n)->l;
       }
 
       RB_ASSERT(rb_is_black(w));
@@ -757,7 +1599,7 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
           /* Case 2 reversed */
           //printf("%s case 2 reversed\n", __func__);
           rb_set_color(w, RB_RED);
-          n = n->p;
+          n = rb_parent(n);
       } else {
         //DUMPNODE(w);
         if(rb_is_black(w->l)) {
@@ -765,28 +1607,28 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
           //printf("%s case 3 reversed\n", __func__);
 
           //DUMPNODE(n);
-          //DUMPNODE(n->p);
+          //DUMPNODE(rb_parent(n));
           //DUMPNODE(w);
           //DUMPNODE(w->r);
           rb_set_color(w, RB_RED);
           rb_set_color(w->r, RB_BLACK);
           _rbtree_lrot(t, w);
-          RB_ASSERT(n->p->l == w->p); /* REMOVEME */
-          w = n->p->l;
+          RB_ASSERT(rb_parent(n)->l == rb_parent(w)); /* REMOVEME */
+          w = rb_parent(n)->l;
 
           //DUMPNODE(w);
-          //DUMPNODE(w->p->l);
-          //DUMPNODE(w->p->r);
+          //DUMPNODE(rb_parent(w)->l);
+          //DUMPNODE(rb_parent(w)->r);
           //DUMPNODE(w->r);
           //DUMPNODE(w->l);
-          //DUMPNODE(w->l->p);
+          //DUMPNODE(rb_parent(w->l));
         }
         /* Case 4 reversed */
         //printf("%s case 4 reversed\n", __func__);
-        rb_copy_color(w, n->p);
+        rb_copy_color(w, rb_parent(n));
         rb_set_color(w->l, RB_BLACK);
-        rb_set_color(n->p, RB_BLACK);
-        _rbtree_rrot(t, n->p);
+        rb_set_color(rb_parent(n), RB_BLACK);
+        _rbtree_rrot(t, rb_parent(n));
         n = t->root;
       }
     }
@@ -794,13 +1636,13 @@ void _rbtree_delete_fixup(struct rbtree *t, struct rbnode *n)
   rb_set_color(n, RB_BLACK);
 }
 
+RBTREE_API
 void rbtree_delete(struct rbtree *t, struct rbnode *n) 
 {
   struct rbnode *s, *x;
 
-  struct rbnode dummy = {
-    .col = RB_BLACK,
-  };
+  struct rbnode dummy = {};
+  rb_set_color(&dummy, RB_BLACK);
 
   bool col = rb_get_color(n);
 
@@ -817,21 +1659,21 @@ void rbtree_delete(struct rbtree *t, struct rbnode *n)
 
     if(!x) {
       x = &dummy;
-      (s->r = x)->p = s;
+      rb_set_parent((s->r = x), s);
     }
 
     RB_ASSERT(x);
 
-    if(s->p == n) {
-      RB_ASSERT(x->p == s);
-      x->p = s;
+    if(rb_parent(s) == n) {
+      RB_ASSERT(rb_parent(x) == s);
+      rb_set_parent(x, s);
     } else {
       rbtree_transplant(t, s, s->r);
-      (s->r = n->r)->p = s;
+      rb_set_parent((s->r = n->r), s);
     }
 
     rbtree_transplant(t, n, s);
-    (s->l = n->l)->p = s;
+    rb_set_parent((s->l = n->l), s);
     rb_copy_color(s, n);
   }
 
@@ -845,6 +1687,8 @@ void rbtree_delete(struct rbtree *t, struct rbnode *n)
   RB_ASSERT(dummy.l == NULL);
 
   rbnode_free(t, n);
+  t->cnt--;
+  RB_STAT(t, deletes, 1);
 }
 
 #endif /* #ifdef KK_RBTREE_IMPL */
@@ -0,0 +1,382 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header fixed capacity ring buffer queue of fixed size elements,
+ *  slots live in a struct arr so it takes the same esz as arr does.
+ *  Two modes, picked at init:
+ *
+ *   RING_SPSC - one producer and one consumer thread, push and pop are 
+ *               wait-free, each side only writes its own index and keeps 
+ *               a cached copy of the other one so it rarely has to touch 
+ *               the other side's cache line.
+ *   RING_MPMC - any number of producers and consumers, bounded queue with 
+ *               a sequence number per slot (D. Vyukov's), a push or pop 
+ *               is a single CAS on the index unless it races with another.
+ *
+ *  Push copies the element in and pop copies it out, both O(1) and never 
+ *  move the rest of the queue. The _n variants move as many elements as 
+ *  fit or are there at once and return how many that was.
+ *
+ *   struct ring r;
+ *   ring_init(&r, sizeof(struct msg), 1024, RING_SPSC);
+ *   // producer                    // consumer
+ *   while(ring_push(&r, &m))       while(ring_pop(&r, &m))
+ *     ; // full                      ; // empty
+ *
+ *  Define KK_RING_IMPL (along with KK_ARR_IMPL) to spawn the 
+ *  implementation.
+ */
+
+#ifndef _KK_RING_H_
+#define _KK_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "arr.h"
+
+#ifndef RING_CACHELINE
+# define RING_CACHELINE 64
+#endif
+
+enum {
+  RING_SPSC = 0,
+  RING_MPMC = 1,
+};
+
+struct ring {
+  /* written by producers */
+  size_t tail __attribute__((aligned(RING_CACHELINE)));
+  /* SPSC only, the producer's last look at head */
+  size_t head_cache;
+
+  /* written by consumers */
+  size_t head __attribute__((aligned(RING_CACHELINE)));
+  /* SPSC only, the consumer's last look at tail */
+  size_t tail_cache;
+
+  /* read only after init */
+  struct arr slots __attribute__((aligned(RING_CACHELINE)));
+  /* MPMC only, sequence number per slot */
+  size_t *seq;
+  size_t mask;
+  uint32_t mode;
+};
+
+/* Capacity is rounded up to a power of two. Returns 0 or -1 on bad 
+ * arguments or allocation failure. */
+int ring_init(struct ring *r, size_t esz, size_t cap, uint32_t mode);
+
+/* No thread may be using the ring anymore. */
+void ring_cleanup(struct ring *r);
+
+static inline
+size_t ring_cap(const struct ring *r)
+{
+  return r->mask + 1;
+}
+
+/* Only a snapshot when other threads are pushing or popping. */
+static inline
+size_t ring_cnt(const struct ring *r)
+{
+  size_t h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  size_t t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  return t - h <= r->mask + 1 ? t - h : 0;
+}
+
+static inline
+bool ring_empty(const struct ring *r)
+{
+  return ring_cnt(r) == 0;
+}
+
+static inline
+void *_ring_slot(const struct ring *r, size_t pos)
+{
+  return (uint8_t*)r->slots.mem + (pos & r->mask) * r->slots.esz;
+}
+
+/* Returns 0 or -1 when full. */
+static inline
+int ring_push(struct ring *r, const void *e)
+{
+  size_t esz = r->slots.esz;
+
+  if(r->mode == RING_SPSC) {
+    size_t t = r->tail;
+
+    if(t - r->head_cache > r->mask) {
+      r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if(t - r->head_cache > r->mask) return -1;
+    }
+    memcpy(_ring_slot(r, t), e, esz);
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  size_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  for(;;) {
+    size_t s = __atomic_load_n(&r->seq[pos & r->mask], __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)(s - pos);
+
+    if(dif == 0) {
+      if(__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if(dif < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+  }
+  memcpy(_ring_slot(r, pos), e, esz);
+  __atomic_store_n(&r->seq[pos & r->mask], pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Copies the oldest element to out, returns 0 or -1 when empty. */
+static inline
+int ring_pop(struct ring *r, void *out)
+{
+  size_t esz = r->slots.esz;
+
+  if(r->mode == RING_SPSC) {
+    size_t h = r->head;
+
+    if(h == r->tail_cache) {
+      r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if(h == r->tail_cache) return -1;
+    }
+    memcpy(out, _ring_slot(r, h), esz);
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  size_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  for(;;) {
+    size_t s = __atomic_load_n(&r->seq[pos & r->mask], __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)(s - (pos + 1));
+
+    if(dif == 0) {
+      if(__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if(dif < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    }
+  }
+  memcpy(out, _ring_slot(r, pos), esz);
+  __atomic_store_n(&r->seq[pos & r->mask], pos + r->mask + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Pushes up to n elements from src, returns how many were pushed. */
+size_t ring_push_n(struct ring *r, const void *src, size_t n);
+
+/* Pops up to n elements to dst, returns how many were popped. */
+size_t ring_pop_n(struct ring *r, void *dst, size_t n);
+
+/* Pops up to n elements appending them to dst, which must have the 
+ * ring's esz. Returns how many were popped or (size_t)-1 if dst couldn't 
+ * grow, in which case nothing is popped. */
+size_t ring_pop_arr(struct ring *r, struct arr *dst, size_t n);
+
+#endif /* _KK_RING_H_ */
+
+/* implementation */
+
+#ifdef KK_RING_IMPL
+
+#ifndef _KK_RING_IMPL_
+#define _KK_RING_IMPL_
+
+int ring_init(struct ring *r, size_t esz, size_t cap, uint32_t mode)
+{
+  size_t pow = 1;
+
+  memset(r, 0, sizeof(*r));
+  if(!esz || !cap || mode > RING_MPMC) return -1;
+
+  while(pow < cap) {
+    if(pow > SIZE_MAX / 2) return -1;
+    pow <<= 1;
+  }
+
+  if(arr_init_ex(&r->slots, esz, 0, ARR_ALIGNED)) return -1;
+  if(arr_resize(&r->slots, pow)) goto fail;
+
+  if(mode == RING_MPMC) {
+    r->seq = ARR_REALLOC(NULL, pow * sizeof(size_t));
+    if(!r->seq) goto fail;
+    for(size_t i = 0; i < pow; ++i)
+      r->seq[i] = i;
+  }
+
+  r->mask = pow - 1;
+  r->mode = mode;
+  return 0;
+
+fail:
+  arr_cleanup(&r->slots);
+  memset(r, 0, sizeof(*r));
+  return -1;
+}
+
+void ring_cleanup(struct ring *r)
+{
+  arr_cleanup(&r->slots);
+  if(r->seq && ARR_REALLOC(r->seq, 0)) { /* ignore realloc return value */ }
+  memset(r, 0, sizeof(*r));
+}
+
+/* Copies n elements between the ring starting at pos and buf, 
+ * in two pieces when the range wraps around. */
+static inline
+void _ring_copy(struct ring *r, size_t pos, void *buf, size_t n, bool in)
+{
+  size_t esz = r->slots.esz;
+  size_t fst = r->mask + 1 - (pos & r->mask);
+  uint8_t *slot = _ring_slot(r, pos);
+
+  if(fst > n) fst = n;
+  if(in) {
+    memcpy(slot, buf, fst * esz);
+    memcpy(r->slots.mem, (uint8_t*)buf + fst * esz, (n - fst) * esz);
+  } else {
+    memcpy(buf, slot, fst * esz);
+    memcpy((uint8_t*)buf + fst * esz, r->slots.mem, (n - fst) * esz);
+  }
+}
+
+/* MPMC, claims up to n consecutive positions of idx (tail for producers,
+ * head for consumers) whose slots are ready, i.e. their sequence number 
+ * is the position plus lap, 0 for producers and 1 for consumers. 
+ * Returns how many were claimed and the first one in *pos. */
+static
+size_t _ring_claim(struct ring *r, size_t *idx, size_t n, size_t lap, size_t *pos)
+{
+  size_t p = __atomic_load_n(idx, __ATOMIC_RELAXED);
+
+  for(;;) {
+    size_t k = 0;
+    for(; k < n; ++k) {
+      size_t s = __atomic_load_n(&r->seq[(p + k) & r->mask], __ATOMIC_ACQUIRE);
+      if(s != p + k + lap) break;
+    }
+
+    if(!k) {
+      size_t s = __atomic_load_n(&r->seq[p & r->mask], __ATOMIC_ACQUIRE);
+      /* slot a lap behind, full or empty */
+      if((intptr_t)(s - (p + lap)) < 0) return 0;
+      /* someone else took p already */
+      p = __atomic_load_n(idx, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if(__atomic_compare_exchange_n(idx, &p, p + k, true,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      *pos = p;
+      return k;
+    }
+  }
+}
+
+size_t ring_push_n(struct ring *r, const void *src, size_t n)
+{
+  size_t pos;
+
+  if(!n) return 0;
+  if(n > r->mask + 1) n = r->mask + 1;
+
+  if(r->mode == RING_SPSC) {
+    pos = r->tail;
+    if(n > r->mask + 1 - (pos - r->head_cache)) {
+      r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      size_t room = r->mask + 1 - (pos - r->head_cache);
+      if(n > room) n = room;
+      if(!n) return 0;
+    }
+    _ring_copy(r, pos, (void*)src, n, true);
+    __atomic_store_n(&r->tail, pos + n, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  if(!(n = _ring_claim(r, &r->tail, n, 0, &pos))) return 0;
+
+  _ring_copy(r, pos, (void*)src, n, true);
+  for(size_t i = 0; i < n; ++i)
+    __atomic_store_n(&r->seq[(pos + i) & r->mask], pos + i + 1, __ATOMIC_RELEASE);
+  return n;
+}
+
+size_t ring_pop_n(struct ring *r, void *dst, size_t n)
+{
+  size_t pos;
+
+  if(!n) return 0;
+  if(n > r->mask + 1) n = r->mask + 1;
+
+  if(r->mode == RING_SPSC) {
+    pos = r->head;
+    if(n > r->tail_cache - pos) {
+      r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if(n > r->tail_cache - pos) n = r->tail_cache - pos;
+      if(!n) return 0;
+    }
+    _ring_copy(r, pos, dst, n, false);
+    __atomic_store_n(&r->head, pos + n, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  if(!(n = _ring_claim(r, &r->head, n, 1, &pos))) return 0;
+
+  _ring_copy(r, pos, dst, n, false);
+  for(size_t i = 0; i < n; ++i)
+    __atomic_store_n(&r->seq[(pos + i) & r->mask], pos + i + r->mask + 1, 
+        __ATOMIC_RELEASE);
+  return n;
+}
+
+size_t ring_pop_arr(struct ring *r, struct arr *dst, size_t n)
+{
+  size_t cnt = dst->cnt;
+
+  ARR_ASSERT(dst->esz == r->slots.esz);
+  if(n > r->mask + 1) n = r->mask + 1;
+  /* grown by the array's policy, an exact reserve would reallocate 
+   * on every call */
+  while(dst->cap < cnt + n)
+    if(arr_grow(dst)) return (size_t)-1;
+
+  n = ring_pop_n(r, (uint8_t*)dst->mem + cnt * dst->esz, n);
+  dst->cnt = cnt + n;
+  return n;
+}
+
+#endif /* _KK_RING_IMPL_ */
+
+#endif /* KK_RING_IMPL */
@@ -0,0 +1,304 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header structure of arrays container.
+ *  Every field of a record gets an arr of its own, all sharing one count, 
+ *  so a loop over a single field streams only that field through the 
+ *  cache. Columns are ARR_ALIGNMENT aligned and grow under the usual arr 
+ *  growth policy.
+ *
+ *   struct particle { float x, y, z; uint32_t id; };
+ *
+ *   struct soa_field fields[] = { 
+ *     SOA_FIELD(struct particle, x), 
+ *     SOA_FIELD(struct particle, y), 
+ *     SOA_FIELD(struct particle, z), 
+ *     SOA_FIELD(struct particle, id), 
+ *   };
+ *   soa_init(&s, fields, 4);
+ *   soa_push(&s, &(struct particle){ 1, 2, 3, 42 });
+ *
+ *   float *x = soa_colt(float, &s, 0);
+ *   for(size_t i = 0; i < soa_cnt(&s); ++i)
+ *     x[i] *= 2;
+ *
+ *  Define KK_SOA_IMPL (along with KK_ARR_IMPL) to spawn the implementation.
+ */
+
+#ifndef _KK_SOA_H_
+#define _KK_SOA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arr.h"
+
+#ifndef SOA_MAX_COLS
+# define SOA_MAX_COLS 16
+#endif
+
+/* where a field lives in the record, for soa_push and soa_get */
+struct soa_field {
+  size_t esz;
+  size_t off;
+};
+
+#define SOA_FIELD(T, F) { sizeof(((T*)0)->F), offsetof(T, F) }
+
+struct soa {
+  struct arr cols[SOA_MAX_COLS];
+  struct soa_field fields[SOA_MAX_COLS];
+  size_t ncols;
+};
+
+int soa_init(struct soa *s, const struct soa_field *fields, size_t ncols);
+
+/* same with growth policy passed to every column, see arr_init_ex */
+int soa_init_ex(struct soa *s, const struct soa_field *fields, size_t ncols,
+    uint32_t min_cap, uint32_t flags);
+
+void soa_cleanup(struct soa *s);
+
+/* dst must be soa_init'ed with the same fields */
+int soa_copy(struct soa *dst, const struct soa *src);
+
+static inline
+size_t soa_cnt(const struct soa *s)
+{
+  return s->ncols ? s->cols[0].cnt : 0;
+}
+
+/* first element of the column, the column is soa_cnt elements long */
+static inline
+void *soa_col(const struct soa *s, size_t col)
+{
+  ARR_ASSERT(col < s->ncols);
+  return s->cols[col].mem;
+}
+
+#define soa_colt(TYPE, S, COL) ((TYPE*)soa_col(S, COL))
+
+static inline
+void *soa_at(const struct soa *s, size_t col, size_t idx)
+{
+  ARR_ASSERT(col < s->ncols);
+  return arr_at(&s->cols[col], idx);
+}
+
+/* Makes room for cap records in every column. */
+int soa_reserve(struct soa *s, size_t cap);
+
+/* New records are zeroed. */
+int soa_resize(struct soa *s, size_t cnt);
+
+void soa_clear(struct soa *s);
+
+/* Scatters the fields of rec into the columns, NULL pushes a zeroed record.
+ * Returns index of the new record or (size_t)-1 if a column couldn't grow,
+ * in which case nothing is pushed. */
+size_t soa_push(struct soa *s, const void *rec);
+
+/* Gathers record idx back into rec, fields not in the soa are left alone. */
+void soa_get(const struct soa *s, size_t idx, void *rec);
+
+/* Overwrites the fields of record idx. */
+void soa_set(struct soa *s, size_t idx, const void *rec);
+
+/* Removes record idx keeping the order, moves every following record. */
+int soa_remove_at(struct soa *s, size_t idx);
+
+/* Removes record idx by moving the last one in its place, O(1). */
+int soa_swap_remove(struct soa *s, size_t idx);
+
+#endif /* _KK_SOA_H_ */
+
+/* implementation */
+
+#ifdef KK_SOA_IMPL
+
+#ifndef _KK_SOA_IMPL_
+#define _KK_SOA_IMPL_
+
+#include <string.h>
+
+int soa_init_ex(struct soa *s, const struct soa_field *fields, size_t ncols,
+    uint32_t min_cap, uint32_t flags)
+{
+  size_t i;
+
+  if(!ncols || ncols > SOA_MAX_COLS)
+    return -1;
+
+  memset(s, 0, sizeof(*s));
+  for(i = 0; i < ncols; ++i) {
+    if(arr_init_ex(&s->cols[i], fields[i].esz, min_cap, flags | ARR_ALIGNED))
+      return -1;
+    s->fields[i] = fields[i];
+  }
+  s->ncols = ncols;
+  return 0;
+}
+
+int soa_init(struct soa *s, const struct soa_field *fields, size_t ncols)
+{
+  return soa_init_ex(s, fields, ncols, 0, 0);
+}
+
+void soa_cleanup(struct soa *s)
+{
+  size_t i;
+
+  for(i = 0; i < s->ncols; ++i)
+    arr_cleanup(&s->cols[i]);
+  memset(s, 0, sizeof(*s));
+}
+
+int soa_copy(struct soa *dst, const struct soa *src)
+{
+  size_t i;
+
+  if(dst->ncols != src->ncols)
+    return -1;
+
+  for(i = 0; i < src->ncols; ++i) 
+    if(arr_copy(&dst->cols[i], (struct arr*)&src->cols[i]))
+      return -1;
+  return 0;
+}
+
+int soa_reserve(struct soa *s, size_t cap)
+{
+  size_t i;
+
+  for(i = 0; i < s->ncols; ++i)
+    if(arr_reserve(&s->cols[i], cap))
+      return -1;
+  return 0;
+}
+
+int soa_resize(struct soa *s, size_t cnt)
+{
+  size_t i;
+
+  /* make room first so a failure leaves the counts in sync */
+  if(cnt > soa_cnt(s)) {
+    for(i = 0; i < s->ncols; ++i)
+      if(cnt > s->cols[i].cap && arr_reserve(&s->cols[i], cnt))
+        return -1;
+  }
+
+  for(i = 0; i < s->ncols; ++i)
+    if(arr_resize(&s->cols[i], cnt))
+      return -1;
+  return 0;
+}
+
+void soa_clear(struct soa *s)
+{
+  size_t i;
+
+  for(i = 0; i < s->ncols; ++i)
+    arr_clear(&s->cols[i]);
+}
+
+size_t soa_push(struct soa *s, const void *rec)
+{
+  size_t i, idx = soa_cnt(s);
+  struct arr *c;
+
+  for(i = 0; i < s->ncols; ++i) {
+    c = &s->cols[i];
+    if(c->cnt == c->cap && arr_grow(c))
+      return (size_t)-1;
+  }
+
+  for(i = 0; i < s->ncols; ++i) {
+    c = &s->cols[i];
+    if(rec)
+      memcpy((uint8_t*)c->mem + idx * c->esz, 
+          (const uint8_t*)rec + s->fields[i].off, c->esz);
+    else
+      memset((uint8_t*)c->mem + idx * c->esz, 0, c->esz);
+    c->cnt++;
+  }
+  return idx;
+}
+
+void soa_get(const struct soa *s, size_t idx, void *rec)
+{
+  size_t i;
+  const struct arr *c;
+
+  ARR_ASSERT(idx < soa_cnt(s));
+  for(i = 0; i < s->ncols; ++i) {
+    c = &s->cols[i];
+    memcpy((uint8_t*)rec + s->fields[i].off, 
+        (const uint8_t*)c->mem + idx * c->esz, c->esz);
+  }
+}
+
+void soa_set(struct soa *s, size_t idx, const void *rec)
+{
+  size_t i;
+  struct arr *c;
+
+  ARR_ASSERT(idx < soa_cnt(s));
+  for(i = 0; i < s->ncols; ++i) {
+    c = &s->cols[i];
+    memcpy((uint8_t*)c->mem + idx * c->esz, 
+        (const uint8_t*)rec + s->fields[i].off, c->esz);
+  }
+}
+
+int soa_remove_at(struct soa *s, size_t idx)
+{
+  size_t i;
+
+  if(idx >= soa_cnt(s))
+    return -1;
+
+  for(i = 0; i < s->ncols; ++i)
+    arr_remove_at(&s->cols[i], idx);
+  return 0;
+}
+
+int soa_swap_remove(struct soa *s, size_t idx)
+{
+  size_t i, last = soa_cnt(s) - 1;
+  struct arr *c;
+
+  if(idx > last || !soa_cnt(s))
+    return -1;
+
+  for(i = 0; i < s->ncols; ++i) {
+    c = &s->cols[i];
+    if(idx != last)
+      memcpy((uint8_t*)c->mem + idx * c->esz, 
+          (uint8_t*)c->mem + last * c->esz, c->esz);
+    c->cnt--;
+  }
+  return 0;
+}
+
+#endif /* _KK_SOA_IMPL_ */
+
+#endif /* KK_SOA_IMPL */
@@ -0,0 +1,85 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * arr: removing elements while iterating.
+ *
+ *   $ gcc -I.. arr.c -o arr && ./arr
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KK_ARR_IMPL
+#include "arr.h"
+
+#define CHECK(COND) \
+  do { \
+    if(!(COND)) { \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #COND); \
+      exit(1); \
+    } \
+  } while(0)
+
+static struct arr make(int n)
+{
+  struct arr arr = arr_new(sizeof(int));
+  for(int i = 0; i < n; ++i)
+    CHECK(arr_push(&arr, &i));
+  return arr;
+}
+
+/* every element seen once, the removed ones gone and the rest in order */
+static void remove_in_rfor(int n, int every)
+{
+  struct arr arr = make(n);
+  int seen = 0, expect = n - 1;
+
+  arr_rfor(int, e, &arr) {
+    CHECK(*e == expect--);
+    seen++;
+    if(*e % every == 0)
+      CHECK(arr_remove_in_loop(&arr, e, (void**)&e) == 0);
+  }
+  CHECK(seen == n);
+
+  expect = 0;
+  arr_for(int, e, &arr) {
+    while(expect % every == 0)
+      expect++;
+    CHECK(*e == expect++);
+  }
+  arr_cleanup(&arr);
+}
+
+int main(void)
+{
+  /* the last element first, then some, then all of them */
+  remove_in_rfor(10, 9);
+  remove_in_rfor(10, 3);
+  remove_in_rfor(10, 1);
+  remove_in_rfor(1, 1);
+
+  CHECK(arr_prev(&(struct arr){ .esz = sizeof(int) }, NULL) == NULL);
+  printf("arr: ok\n");
+  return 0;
+}
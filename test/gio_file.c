@@ -0,0 +1,106 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ * Buffered fd gio: reading and writing one file through the same gio.
+ *
+ *   $ gcc -I.. gio_file.c -o gio_file && ./gio_file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define KK_GIO_IMPL
+#include "gio.h"
+
+#define CHECK(COND) \
+  do { \
+    if(!(COND)) { \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #COND); \
+      exit(1); \
+    } \
+  } while(0)
+
+enum { WRITE, WRITEV, PRINTF };
+
+/* a write right after a buffered read lands where the read stopped, 
+ * not where the read-ahead left the fd */
+static void read_then_write(int how)
+{
+  char path[] = "/tmp/kk-gio-file-XXXXXX";
+  struct gio_file gio = {};
+  struct iovec iov[2] = { { "X", 1 }, { "Y", 1 } };
+  char buf[16] = {};
+  int fd;
+
+  CHECK((fd = mkstemp(path)) >= 0);
+  unlink(path);
+  CHECK(write(fd, "abcdefgh", 8) == 8);
+  CHECK(lseek(fd, 0, SEEK_SET) == 0);
+
+  CHECK(gio_file_init_fd_buf(&gio, fd, 16, 16) == 0);
+  CHECK(gio_read(&gio, buf, 2) == 2 && !memcmp(buf, "ab", 2));
+
+  switch(how) {
+  case WRITE:  CHECK(gio_write(&gio, "XY", 2) == 2); break;
+  case WRITEV: CHECK(gio_writev(&gio, iov, 2) == 2); break;
+  case PRINTF: CHECK(gio_nprintf(&gio, 16, "%s", "XY") == 2); break;
+  }
+  CHECK(gio_sync(&gio) == 0);
+
+  CHECK(pread(fd, buf, sizeof(buf), 0) == 8);
+  CHECK(!memcmp(buf, "abXYefgh", 8));
+
+  /* and reading goes on after what was written */
+  CHECK(gio_read(&gio, buf, 2) == 2 && !memcmp(buf, "ef", 2));
+  CHECK(gio_close(&gio) == 0);
+}
+
+/* a seek that fails, as on a pipe, keeps what was read ahead */
+static void failed_seek(void)
+{
+  struct gio_file gio = {};
+  char buf[8] = {};
+  int fds[2];
+
+  CHECK(pipe(fds) == 0);
+  CHECK(write(fds[1], "abcdef", 6) == 6);
+  close(fds[1]);
+
+  CHECK(gio_file_init_fd_buf(&gio, fds[0], 0, 16) == 0);
+  CHECK(gio_read(&gio, buf, 2) == 2 && !memcmp(buf, "ab", 2));
+  CHECK(gio_seek(&gio, 0, SEEK_SET) == -1);
+  CHECK(gio_read(&gio, buf, sizeof(buf)) == 4 && !memcmp(buf, "cdef", 4));
+  CHECK(gio_close(&gio) == 0);
+}
+
+int main(void)
+{
+  read_then_write(WRITE);
+  read_then_write(WRITEV);
+  read_then_write(PRINTF);
+  failed_seek();
+  printf("gio_file: ok\n");
+  return 0;
+}
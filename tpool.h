@@ -0,0 +1,701 @@
+/*
+ * The MIT License (MIT)
+ *
+ *  Copyright (c) Kacper Kokot
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ *
+ *  Single header work-stealing thread pool, plus parallel loops over arr.
+ *  Every worker owns a task queue on its own cache line, it runs its own 
+ *  tasks newest first and when it runs dry steals the oldest ones from 
+ *  the others. Threads waiting for a group of tasks don't just block, 
+ *  they run tasks meanwhile, so tasks may freely spawn and wait for more.
+ *  Define KK_TPOOL_IMPL (along with KK_ARR_IMPL) to spawn the 
+ *  implementation. Link with -lpthread.
+ */
+
+#ifndef _KK_TPOOL_H_
+#define _KK_TPOOL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arr.h"
+
+#ifndef TPOOL_CACHELINE
+# define TPOOL_CACHELINE 64
+#endif
+
+/* per worker, tasks submitted to a full queue run right away instead */
+#ifndef TPOOL_QUEUE_SIZE
+# define TPOOL_QUEUE_SIZE 1024
+#endif
+
+typedef void (tpool_task_proc)(void *arg);
+
+struct tpool;
+
+/* Called by each worker thread before it takes any task, 
+ * idx goes from 0 to the number of workers - 1. */
+typedef void (tpool_pin_proc)(struct tpool *pool, size_t idx, void *user);
+
+/* Counts tasks that haven't finished yet, zero it before first use. */
+struct tpool_wg {
+  size_t cnt;
+};
+
+struct tpool_task {
+  tpool_task_proc *fn;
+  void *arg;
+  struct tpool_wg *wg;
+};
+
+struct tpool_worker {
+  pthread_mutex_t lock;
+  /* tasks live in [head, tail), both only ever grow */
+  size_t head;
+  size_t tail;
+  struct tpool_task tasks[TPOOL_QUEUE_SIZE];
+  struct tpool *pool;
+  pthread_t thread;
+  size_t idx;
+} __attribute__((aligned(TPOOL_CACHELINE)));
+
+struct tpool {
+  struct tpool_worker *workers;
+  size_t nworkers;
+  tpool_pin_proc *pin;
+  void *pin_user;
+  /* the rest is for sleeping when there's nothing to do, workers and 
+   * tpool_wait alike, submitters only take the lock when someone sleeps */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pending;
+  size_t sleeping;
+  size_t next;
+  bool stop;
+};
+
+/* nthreads 0 means one per cpu, pin may be NULL */
+int tpool_init(struct tpool *pool, size_t nthreads, 
+    tpool_pin_proc *pin, void *pin_user);
+
+/* Runs whatever is still queued and joins the workers. */
+void tpool_cleanup(struct tpool *pool);
+
+/* wg is optional, it's incremented here and decremented once fn returns */
+void tpool_submit(struct tpool *pool, 
+    tpool_task_proc *fn, void *arg, struct tpool_wg *wg);
+
+/* Runs tasks until every task counted by wg has finished, sleeps while 
+ * there are none to run. */
+void tpool_wait(struct tpool *pool, struct tpool_wg *wg);
+
+/* Pool with one worker per cpu created on first use and never destroyed,
+ * the arr_parallel_* functions run on it. */
+struct tpool *tpool_default(void);
+
+/* Pin hook of the default pool, e.g. tpool_pin_cpu. Fails once the pool 
+ * has been created, so call it before the first tpool_default(). */
+int tpool_default_pin(tpool_pin_proc *pin, void *user);
+
+/* pin hook binding worker idx to cpu idx modulo the number of cpus,
+ * linux with _GNU_SOURCE only, a no-op elsewhere */
+void tpool_pin_cpu(struct tpool *pool, size_t idx, void *user);
+
+/* parallel arr */
+
+/* gets n consecutive elements starting at beg */
+typedef void (arr_range_proc)(void *beg, size_t n, void *user);
+
+/* folds n elements starting at beg into acc */
+typedef void (arr_fold_proc)(void *acc, const void *beg, size_t n, void *user);
+
+/* folds another partial result into acc */
+typedef void (arr_combine_proc)(void *acc, const void *part, void *user);
+
+/* Calls cb on consecutive chunks of about chunk elements (0 picks a size) 
+ * on the default pool and returns once all of them are done. Chunks are 
+ * rounded so that they start on cache line boundaries where the element 
+ * size allows, neighbouring chunks never write to the same line. */
+int arr_parallel_for(struct arr *arr, size_t chunk, 
+    arr_range_proc *cb, void *user);
+
+/* Folds every chunk into a copy of acc of accsz bytes, which must hold 
+ * the identity on entry, then combines the partial results into acc 
+ * in the order of the chunks. */
+int arr_parallel_reduce(struct arr *arr, size_t chunk, 
+    void *acc, size_t accsz, 
+    arr_fold_proc *fold, arr_combine_proc *combine, void *user);
+
+/* Quicksort with both sides of each partition sorted as separate tasks,
+ * small ranges are left to qsort. Not stable. */
+int arr_parallel_qsort(struct arr *arr, arr_cmp_proc *cmp);
+
+#endif /* _KK_TPOOL_H_ */
+
+/* implementation */
+
+#ifdef KK_TPOOL_IMPL
+
+#ifndef _KK_TPOOL_IMPL_
+#define _KK_TPOOL_IMPL_
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ranges shorter than this are sorted by qsort in place */
+#ifndef TPOOL_QSORT_MIN
+# define TPOOL_QSORT_MIN 4096
+#endif
+
+/* worker we are running on, if any */
+static _Thread_local struct tpool_worker *_tpool_self;
+
+static
+bool _tpool_push(struct tpool_worker *w, struct tpool_task *t)
+{
+  bool ok;
+
+  pthread_mutex_lock(&w->lock);
+  if((ok = w->tail - w->head < TPOOL_QUEUE_SIZE))
+    w->tasks[w->tail++ % TPOOL_QUEUE_SIZE] = *t;
+  pthread_mutex_unlock(&w->lock);
+  return ok;
+}
+
+/* owner takes the newest, thieves the oldest */
+static
+bool _tpool_pop(struct tpool_worker *w, struct tpool_task *t, bool steal)
+{
+  bool ok;
+
+  pthread_mutex_lock(&w->lock);
+  if((ok = w->head != w->tail))
+    *t = steal 
+      ? w->tasks[w->head++ % TPOOL_QUEUE_SIZE] 
+      : w->tasks[--w->tail % TPOOL_QUEUE_SIZE];
+  pthread_mutex_unlock(&w->lock);
+  return ok;
+}
+
+static
+bool _tpool_take(struct tpool *pool, struct tpool_task *t)
+{
+  size_t i, beg;
+  struct tpool_worker *self = _tpool_self;
+
+  if(self && self->pool != pool)
+    self = NULL;
+
+  if(self && _tpool_pop(self, t, false))
+    goto took;
+
+  /* start stealing next to us so thieves don't all go for worker 0 */
+  beg = self ? self->idx + 1 : 0;
+  for(i = 0; i < pool->nworkers; ++i) {
+    struct tpool_worker *w = &pool->workers[(beg + i) % pool->nworkers];
+    if(w != self && _tpool_pop(w, t, true))
+      goto took;
+  }
+  return false;
+
+took:
+  __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  return true;
+}
+
+/* Wakes the sleepers, the check pairs with the one in _tpool_sleep: 
+ * either they see what changed or we see them sleeping. */
+static
+void _tpool_wake(struct tpool *pool, bool all)
+{
+  if(!__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST))
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  if(all)
+    pthread_cond_broadcast(&pool->cond);
+  else
+    pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Sleeps until a task is pending, the pool stops or, with a wg, that 
+ * drops to zero. Returns whether the pool stopped with nothing left. */
+static
+bool _tpool_sleep(struct tpool *pool, struct tpool_wg *wg)
+{
+  bool stop;
+
+  pthread_mutex_lock(&pool->lock);
+  __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+  while(!pool->stop && !__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) &&
+      (!wg || __atomic_load_n(&wg->cnt, __ATOMIC_SEQ_CST)))
+    pthread_cond_wait(&pool->cond, &pool->lock);
+  __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+  /* leave only once the queues are drained */
+  stop = pool->stop && !__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE);
+  pthread_mutex_unlock(&pool->lock);
+  return stop;
+}
+
+static
+void _tpool_run(struct tpool *pool, struct tpool_task *t)
+{
+  t->fn(t->arg);
+  /* the last one wakes whoever waits on the group */
+  if(t->wg && !__atomic_sub_fetch(&t->wg->cnt, 1, __ATOMIC_SEQ_CST))
+    _tpool_wake(pool, true);
+}
+
+static
+void *_tpool_worker_main(void *_w)
+{
+  struct tpool_worker *w = _w;
+  struct tpool *pool = w->pool;
+  struct tpool_task t;
+
+  _tpool_self = w;
+  if(pool->pin)
+    pool->pin(pool, w->idx, pool->pin_user);
+
+  for(;;) {
+    if(_tpool_take(pool, &t))
+      _tpool_run(pool, &t);
+    else if(_tpool_sleep(pool, NULL))
+      break;
+  }
+  return NULL;
+}
+
+int tpool_init(struct tpool *pool, size_t nthreads, 
+    tpool_pin_proc *pin, void *pin_user)
+{
+  size_t i;
+  long ncpu;
+
+  memset(pool, 0, sizeof(*pool));
+
+  if(!nthreads) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu > 0 ? (size_t)ncpu : 1;
+  }
+
+  if(posix_memalign((void**)&pool->workers, TPOOL_CACHELINE, 
+        nthreads * sizeof(*pool->workers)))
+    return -1;
+
+  memset(pool->workers, 0, nthreads * sizeof(*pool->workers));
+  pool->pin = pin;
+  pool->pin_user = pin_user;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  for(i = 0; i < nthreads; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].idx = i;
+    pthread_mutex_init(&pool->workers[i].lock, NULL);
+  }
+
+  /* all queues exist before anyone tries to steal from them */
+  pool->nworkers = nthreads;
+  for(i = 0; i < nthreads; ++i) {
+    if(pthread_create(&pool->workers[i].thread, NULL, 
+          _tpool_worker_main, &pool->workers[i]))
+      goto fail;
+  }
+  return 0;
+
+fail:
+  /* join the ones we've started and give up */
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  
+  while(i--)
+    pthread_join(pool->workers[i].thread, NULL);
+  pool->nworkers = 0;
+  tpool_cleanup(pool);
+  return -1;
+}
+
+void tpool_cleanup(struct tpool *pool)
+{
+  size_t i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i = 0; i < pool->nworkers; ++i)
+    pthread_join(pool->workers[i].thread, NULL);
+
+  for(i = 0; i < pool->nworkers; ++i)
+    pthread_mutex_destroy(&pool->workers[i].lock);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->workers);
+  memset(pool, 0, sizeof(*pool));
+}
+
+void tpool_submit(struct tpool *pool, 
+    tpool_task_proc *fn, void *arg, struct tpool_wg *wg)
+{
+  struct tpool_task t = { fn, arg, wg };
+  struct tpool_worker *w = _tpool_self;
+
+  if(wg)
+    __atomic_add_fetch(&wg->cnt, 1, __ATOMIC_RELAXED);
+
+  /* workers keep their own tasks, anyone else deals them out */
+  if(!w || w->pool != pool)
+    w = &pool->workers[
+      __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->nworkers];
+
+  /* counted before it's visible so it can't be taken first */
+  __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+  if(!_tpool_push(w, &t)) {
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    _tpool_run(pool, &t);
+    return;
+  }
+  _tpool_wake(pool, false);
+}
+
+void tpool_wait(struct tpool *pool, struct tpool_wg *wg)
+{
+  struct tpool_task t;
+
+  while(__atomic_load_n(&wg->cnt, __ATOMIC_ACQUIRE)) {
+    if(_tpool_take(pool, &t))
+      _tpool_run(pool, &t);
+    else
+      _tpool_sleep(pool, wg);
+  }
+}
+
+static struct tpool _tpool_default;
+static pthread_once_t _tpool_default_once = PTHREAD_ONCE_INIT;
+static tpool_pin_proc *_tpool_default_pin;
+static void *_tpool_default_pin_user;
+static bool _tpool_default_made;
+
+static
+void _tpool_default_init(void)
+{
+  __atomic_store_n(&_tpool_default_made, true, __ATOMIC_SEQ_CST);
+  if(tpool_init(&_tpool_default, 0, _tpool_default_pin, _tpool_default_pin_user))
+    _tpool_default.nworkers = 0;
+}
+
+struct tpool *tpool_default(void)
+{
+  pthread_once(&_tpool_default_once, _tpool_default_init);
+  return _tpool_default.nworkers ? &_tpool_default : NULL;
+}
+
+int tpool_default_pin(tpool_pin_proc *pin, void *user)
+{
+  if(__atomic_load_n(&_tpool_default_made, __ATOMIC_SEQ_CST))
+    return -1;
+
+  _tpool_default_pin = pin;
+  _tpool_default_pin_user = user;
+  return 0;
+}
+
+void tpool_pin_cpu(struct tpool *pool, size_t idx, void *user)
+{
+#if defined(__linux__) && defined(CPU_SET)
+  cpu_set_t set;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  CPU_ZERO(&set);
+  CPU_SET(idx % (ncpu > 0 ? (size_t)ncpu : 1), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+  (void)pool; (void)idx; (void)user;
+}
+
+/* parallel arr */
+
+struct _tpool_chunk {
+  uint8_t *beg;
+  size_t n;
+  void *acc;
+  void *user;
+  union {
+    arr_range_proc *cb;
+    arr_fold_proc *fold;
+  };
+};
+
+static
+void _tpool_chunk_for(void *_c)
+{
+  struct _tpool_chunk *c = _c;
+  c->cb(c->beg, c->n, c->user);
+}
+
+static
+void _tpool_chunk_fold(void *_c)
+{
+  struct _tpool_chunk *c = _c;
+  c->fold(c->acc, c->beg, c->n, c->user);
+}
+
+static inline
+size_t _tpool_gcd(size_t a, size_t b)
+{
+  size_t t;
+  while(b) { t = a % b; a = b; b = t; }
+  return a;
+}
+
+/* Splits the array into chunks of whole cache lines, the first one being 
+ * shorter if need be so the rest start on a line. Returns the number of 
+ * chunks and a fresh array of them in *out, 0 if out of memory. */
+static
+size_t _tpool_split(struct arr *arr, size_t chunk, 
+    size_t nworkers, struct _tpool_chunk **out)
+{
+  size_t esz = arr->esz, n = arr->cnt, line, first = 0, cnt, i, off;
+  uintptr_t addr = (uintptr_t)arr->mem;
+  struct _tpool_chunk *c;
+
+  /* that many elements always take whole lines */
+  line = TPOOL_CACHELINE / _tpool_gcd(esz, TPOOL_CACHELINE);
+
+  /* a few chunks per worker so stealing can even things out */
+  if(!chunk)
+    chunk = n / (4 * nworkers) + 1;
+  chunk = (chunk + line - 1) / line * line;
+
+  /* first element that starts a line, if any does */
+  for(i = 0; i < line && i < n; ++i) {
+    if(!((addr + i * esz) % TPOOL_CACHELINE)) {
+      first = i;
+      break;
+    }
+  }
+
+  cnt = (first ? 1 : 0) + (n - first + chunk - 1) / chunk;
+  if(!(c = ARR_REALLOC(NULL, cnt * sizeof(*c))))
+    return 0;
+
+  for(i = 0, off = 0; i < cnt; ++i) {
+    size_t len = (i == 0 && first) ? first : chunk;
+    if(len > n - off)
+      len = n - off;
+
+    memset(&c[i], 0, sizeof(c[i]));
+    c[i].beg = (uint8_t*)arr->mem + off * esz;
+    c[i].n = len;
+    off += len;
+  }
+
+  *out = c;
+  return cnt;
+}
+
+int arr_parallel_for(struct arr *arr, size_t chunk, 
+    arr_range_proc *cb, void *user)
+{
+  size_t i, cnt;
+  struct _tpool_chunk *c;
+  struct tpool_wg wg = {0};
+  struct tpool *pool = tpool_default();
+
+  if(!arr->cnt)
+    return 0;
+
+  if(!pool) {
+    cb(arr->mem, arr->cnt, user);
+    return 0;
+  }
+
+  if(!(cnt = _tpool_split(arr, chunk, pool->nworkers, &c)))
+    return -1;
+
+  for(i = 0; i < cnt; ++i) {
+    c[i].cb = cb;
+    c[i].user = user;
+    tpool_submit(pool, _tpool_chunk_for, &c[i], &wg);
+  }
+  tpool_wait(pool, &wg);
+
+  if(ARR_REALLOC(c, 0)) { /* ignore realloc return value */ }
+  return 0;
+}
+
+int arr_parallel_reduce(struct arr *arr, size_t chunk, 
+    void *acc, size_t accsz, 
+    arr_fold_proc *fold, arr_combine_proc *combine, void *user)
+{
+  size_t i, cnt, stride;
+  uint8_t *parts;
+  struct _tpool_chunk *c;
+  struct tpool_wg wg = {0};
+  struct tpool *pool = tpool_default();
+
+  if(!arr->cnt)
+    return 0;
+
+  if(!pool) {
+    fold(acc, arr->mem, arr->cnt, user);
+    return 0;
+  }
+
+  if(!(cnt = _tpool_split(arr, chunk, pool->nworkers, &c)))
+    return -1;
+
+  /* every partial result on lines of its own */
+  stride = (accsz + TPOOL_CACHELINE - 1) / TPOOL_CACHELINE * TPOOL_CACHELINE;
+  if(posix_memalign((void**)&parts, TPOOL_CACHELINE, cnt * stride)) {
+    if(ARR_REALLOC(c, 0)) { /* ignore realloc return value */ }
+    return -1;
+  }
+
+  for(i = 0; i < cnt; ++i) {
+    memcpy(parts + i * stride, acc, accsz);
+    c[i].acc = parts + i * stride;
+    c[i].fold = fold;
+    c[i].user = user;
+    tpool_submit(pool, _tpool_chunk_fold, &c[i], &wg);
+  }
+  tpool_wait(pool, &wg);
+
+  for(i = 0; i < cnt; ++i)
+    combine(acc, parts + i * stride, user);
+
+  free(parts);
+  if(ARR_REALLOC(c, 0)) { /* ignore realloc return value */ }
+  return 0;
+}
+
+struct _tpool_qsort {
+  struct tpool *pool;
+  struct tpool_wg *wg;
+  uint8_t *base;
+  size_t n;
+  size_t esz;
+  arr_cmp_proc *cmp;
+  unsigned depth;
+};
+
+static inline
+void _tpool_swap(uint8_t *a, uint8_t *b, size_t esz)
+{
+  uint8_t tmp[64];
+  size_t k;
+
+  for(; esz; a += k, b += k, esz -= k) {
+    k = esz < sizeof(tmp) ? esz : sizeof(tmp);
+    memcpy(tmp, a, k);
+    memcpy(a, b, k);
+    memcpy(b, tmp, k);
+  }
+}
+
+static void _tpool_qsort_task(void *_q);
+
+static
+void _tpool_qsort_spawn(struct _tpool_qsort *q, uint8_t *base, size_t n)
+{
+  struct _tpool_qsort *sub;
+
+  /* if we can't make a task we just do it ourselves */
+  if(n < TPOOL_QSORT_MIN || !q->depth || !(sub = ARR_REALLOC(NULL, sizeof(*sub)))) {
+    qsort(base, n, q->esz, q->cmp);
+    return;
+  }
+
+  *sub = *q;
+  sub->base = base;
+  sub->n = n;
+  sub->depth--;
+  tpool_submit(q->pool, _tpool_qsort_task, sub, q->wg);
+}
+
+static
+void _tpool_qsort_task(void *_q)
+{
+  struct _tpool_qsort *q = _q;
+  size_t esz = q->esz, n = q->n, m = (n - 1) / 2, i, j;
+  uint8_t *a = q->base, pivot[esz];
+  arr_cmp_proc *cmp = q->cmp;
+
+#define _TPQ_AT(I) (a + (I) * esz)
+  /* same scheme as ARR_DEFINE_SORT, a[0] <= a[m] <= a[n-1] */
+  if(cmp(_TPQ_AT(m), _TPQ_AT(0)) < 0) 
+    _tpool_swap(_TPQ_AT(m), _TPQ_AT(0), esz);
+  if(cmp(_TPQ_AT(n - 1), _TPQ_AT(m)) < 0) {
+    _tpool_swap(_TPQ_AT(n - 1), _TPQ_AT(m), esz);
+    if(cmp(_TPQ_AT(m), _TPQ_AT(0)) < 0) 
+      _tpool_swap(_TPQ_AT(m), _TPQ_AT(0), esz);
+  }
+  memcpy(pivot, _TPQ_AT(m), esz);
+
+  for(i = 0, j = n - 1;; ++i, --j) {
+    while(cmp(_TPQ_AT(i), pivot) < 0) i++;
+    while(cmp(pivot, _TPQ_AT(j)) < 0) j--;
+    if(i >= j)
+      break;
+    _tpool_swap(_TPQ_AT(i), _TPQ_AT(j), esz);
+  }
+
+  _tpool_qsort_spawn(q, a, j + 1);
+  _tpool_qsort_spawn(q, _TPQ_AT(j + 1), n - j - 1);
+#undef _TPQ_AT
+
+  if(ARR_REALLOC(q, 0)) { /* ignore realloc return value */ }
+}
+
+int arr_parallel_qsort(struct arr *arr, arr_cmp_proc *cmp)
+{
+  size_t k;
+  struct tpool_wg wg = {0};
+  struct _tpool_qsort q = {
+    .pool = tpool_default(), .wg = &wg, 
+    .esz = arr->esz, .cmp = cmp,
+  };
+
+  if(!q.pool || arr->cnt < TPOOL_QSORT_MIN) {
+    arr_qsort(arr, cmp);
+    return 0;
+  }
+
+  /* past that many levels the splits are bad, qsort takes over */
+  for(k = arr->cnt; k > 1; k >>= 1)
+    q.depth += 2;
+
+  _tpool_qsort_spawn(&q, arr->mem, arr->cnt);
+  tpool_wait(q.pool, &wg);
+  return 0;
+}
+
+#endif /* _KK_TPOOL_IMPL_ */
+
+#endif /* KK_TPOOL_IMPL */